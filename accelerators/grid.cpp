@@ -24,25 +24,26 @@
 // grid.cpp*
 #include "pbrt.h"
 #include "primitive.h"
+#include "parallel.h"
 static StatsRatio rayTests("Grid Accelerator", "Intersection tests per ray"); // NOBOOK
 static StatsRatio rayHits("Grid Accelerator", "Intersections found per ray"); // NOBOOK
 // GridAccel Forward Declarations
 struct MailboxPrim;
 struct Voxel;
 // MailboxPrim Declarations
+// Primitives are not mailboxed: rays may be traced from several threads
+// at once, and retesting a primitive finds the same closest hit
 struct MailboxPrim {
 	MailboxPrim(const Reference<Primitive> &p) {
 		primitive = p;
-		lastMailboxId = -1;
 	}
 	Reference<Primitive> primitive;
-	int lastMailboxId;
 };
 // Voxel Declarations
 struct Voxel {
 	// Voxel Public Methods
 	Voxel(MailboxPrim *op) {
-		allCanIntersect = false;
+		allCanIntersect = 0;
 		nPrimitives = 1;
 		onePrimitive = op;
 	}
@@ -69,15 +70,16 @@ struct Voxel {
 		if (nPrimitives > 1) delete[] primitives;
 	}
 	bool Intersect(const Ray &ray,
-	               Intersection *isect,
-				   int rayId);
-	bool IntersectP(const Ray &ray, int rayId);
+	               Intersection *isect);
+	bool IntersectP(const Ray &ray);
+	void Refine();
 	union {
 		MailboxPrim *onePrimitive;
 		MailboxPrim **primitives;
 	};
-	u_int allCanIntersect:1;
-	u_int nPrimitives:31;
+	u_int nPrimitives;
+	// Set once _Refine()_ has replaced every unintersectable primitive
+	volatile int allCanIntersect;
 };
 // GridAccel Declarations
 class  GridAccel : public Aggregate {
@@ -116,7 +118,6 @@ private:
 	Vector Width, InvWidth;
 	Voxel **voxels;
 	ObjectArena<Voxel> voxelArena;
-	static int curMailboxId;
 };
 // GridAccel Method Definitions
 GridAccel::GridAccel(const vector<Reference<Primitive> > &p,
@@ -234,8 +235,6 @@ bool GridAccel::Intersect(const Ray &ray,
 	else if (!bounds.IntersectP(ray, &rayT))
 		return false;
 	Point gridIntersect = ray(rayT);
-	// Get ray mailbox id
-	int rayId = ++curMailboxId;
 	// Set up 3D DDA for ray
 	float NextCrossingT[3], DeltaT[3];
 	int Step[3], Out[3], Pos[3];
@@ -267,7 +266,7 @@ bool GridAccel::Intersect(const Ray &ray,
 		Voxel *voxel =
 			voxels[Offset(Pos[0],	Pos[1], Pos[2])];
 		if (voxel != NULL)
-			hitSomething |= voxel->Intersect(ray, isect, rayId);
+			hitSomething |= voxel->Intersect(ray, isect);
 		// Advance to next voxel
 		// Find _stepAxis_ for stepping to next voxel
 		int bits = ((NextCrossingT[0] < NextCrossingT[1]) << 2) +
@@ -284,30 +283,36 @@ bool GridAccel::Intersect(const Ray &ray,
 	}
 	return hitSomething;
 }
-int GridAccel::curMailboxId = 0;
-bool Voxel::Intersect(const Ray &ray,
-                      Intersection *isect,
-					  int rayId) {
-	// Refine primitives in voxel if needed
-	if (!allCanIntersect) {
-		MailboxPrim **mpp;
-		if (nPrimitives == 1) mpp = &onePrimitive;
-		else mpp = primitives;
-		for (u_int i = 0; i < nPrimitives; ++i) {
-			MailboxPrim *mp = mpp[i];
-			// Refine primitive in _mp_ if it's not intersectable
-			if (!mp->primitive->CanIntersect()) {
-				vector<Reference<Primitive> > p;
-				mp->primitive->FullyRefine(p);
-				Assert(p.size() > 0); // NOBOOK
-				if (p.size() == 1)
-					mp->primitive = p[0];
-				else
-					mp->primitive = new GridAccel(p, true, false);
-			}
+// Voxels refine their primitives lazily, one thread at a time
+static Mutex refineMutex;
+void Voxel::Refine() {
+	MutexLock lock(refineMutex);
+	// Another thread may have refined the voxel while this one waited
+	if (allCanIntersect) return;
+	MailboxPrim **mpp;
+	if (nPrimitives == 1) mpp = &onePrimitive;
+	else mpp = primitives;
+	for (u_int i = 0; i < nPrimitives; ++i) {
+		MailboxPrim *mp = mpp[i];
+		// Refine primitive in _mp_ if it's not intersectable
+		if (!mp->primitive->CanIntersect()) {
+			vector<Reference<Primitive> > p;
+			mp->primitive->FullyRefine(p);
+			Assert(p.size() > 0); // NOBOOK
+			if (p.size() == 1)
+				mp->primitive = p[0];
+			else
+				mp->primitive = new GridAccel(p, true, false);
 		}
-		allCanIntersect = true;
 	}
+	// Threads that see the flag without the lock also see the refined
+	// primitives
+	AtomicStoreRelease(&allCanIntersect, 1);
+}
+bool Voxel::Intersect(const Ray &ray,
+                      Intersection *isect) {
+	// Refine primitives in voxel if needed
+	if (!AtomicLoadAcquire(&allCanIntersect)) Refine();
 	// Loop over primitives in voxel and find intersections
 	bool hitSomething = false;
 	MailboxPrim **mpp;
@@ -315,11 +320,7 @@ bool Voxel::Intersect(const Ray &ray,
 	else mpp = primitives;
 	for (u_int i = 0; i < nPrimitives; ++i) {
 		MailboxPrim *mp = mpp[i];
-		// Do mailbox check between ray and primitive
-		if (mp->lastMailboxId == rayId)
-			continue;
 		// Check for ray--primitive intersection
-		mp->lastMailboxId = rayId;
 		rayTests.Add(1, 0); // NOBOOK
 		if (mp->primitive->Intersect(ray, isect)) {
 			rayHits.Add(1, 0); // NOBOOK
@@ -333,7 +334,6 @@ bool GridAccel::IntersectP(const Ray &ray) const {
 		rayTests.Add(0, 1); // NOBOOK
 		rayHits.Add(0, 1); // NOBOOK
 	} // NOBOOK
-	int rayId = ++curMailboxId;
 	// Check ray against overall grid bounds
 	float rayT;
 	if (bounds.Inside(ray(ray.mint)))
@@ -370,7 +370,7 @@ bool GridAccel::IntersectP(const Ray &ray) const {
 	for (;;) {
 		int offset = Offset(Pos[0], Pos[1], Pos[2]);
 		Voxel *voxel = voxels[offset];
-		if (voxel && voxel->IntersectP(ray, rayId))
+		if (voxel && voxel->IntersectP(ray))
 			return true;
 		// Advance to next voxel
 		// Find _stepAxis_ for stepping to next voxel
@@ -388,37 +388,15 @@ bool GridAccel::IntersectP(const Ray &ray) const {
 	}
 	return false;
 }
-bool Voxel::IntersectP(const Ray &ray, int rayId) {
+bool Voxel::IntersectP(const Ray &ray) {
 	// Refine primitives in voxel if needed
-	if (!allCanIntersect) {
-		MailboxPrim **mpp;
-		if (nPrimitives == 1) mpp = &onePrimitive;
-		else mpp = primitives;
-		for (u_int i = 0; i < nPrimitives; ++i) {
-			MailboxPrim *mp = mpp[i];
-			// Refine primitive in _mp_ if it's not intersectable
-			if (!mp->primitive->CanIntersect()) {
-				vector<Reference<Primitive> > p;
-				mp->primitive->FullyRefine(p);
-				Assert(p.size() > 0); // NOBOOK
-				if (p.size() == 1)
-					mp->primitive = p[0];
-				else
-					mp->primitive = new GridAccel(p, true, false);
-			}
-		}
-		allCanIntersect = true;
-	}
+	if (!AtomicLoadAcquire(&allCanIntersect)) Refine();
 	MailboxPrim **mpp;
 	if (nPrimitives == 1) mpp = &onePrimitive;
 	else mpp = primitives;
 	for (u_int i = 0; i < nPrimitives; ++i) {
 		MailboxPrim *mp = mpp[i];
-		// Do mailbox check between ray and primitive
-		if (mp->lastMailboxId == rayId)
-			continue;
 		// Check for ray--primitive intersection for shadow ray
-		mp->lastMailboxId = rayId;
 		rayTests.Add(1, 0);
 		if (mp->primitive->IntersectP(ray)) {
 			rayHits.Add(1, 0);
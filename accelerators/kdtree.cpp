@@ -25,13 +25,13 @@
 #include "pbrt.h"
 #include "primitive.h"
 // KdAccelNode Declarations
+// Primitives are not mailboxed: rays may be traced from several threads
+// at once, and retesting a primitive finds the same closest hit
 struct MailboxPrim {
 	MailboxPrim(const Reference<Primitive> &p) {
 		primitive = p;
-		lastMailboxId = -1;
 	}
 	Reference<Primitive> primitive;
-	int lastMailboxId;
 };
 struct KdAccelNode {
 	// KdAccelNode Methods
@@ -127,7 +127,6 @@ private:
 	float emptyBonus;
 	u_int nMailboxes;
 	MailboxPrim *mailboxPrims;
-	mutable int curMailboxId;
 	KdAccelNode *nodes;
 	int nAllocedNodes, nextFreeNode;
 	BBox bounds;
@@ -148,7 +147,6 @@ KdTreeAccel::
 	for (u_int i = 0; i < p.size(); ++i)
 		p[i]->FullyRefine(prims);
 	// Initialize mailboxes for _KdTreeAccel_
-	curMailboxId = 0;
 	nMailboxes = prims.size();
 	mailboxPrims = (MailboxPrim *)AllocAligned(nMailboxes *
 		sizeof(MailboxPrim));
@@ -317,7 +315,6 @@ bool KdTreeAccel::Intersect(const Ray &ray,
 	if (!bounds.IntersectP(ray, &tmin, &tmax))
 		return false;
 	// Prepare to traverse kd-tree for ray
-	int rayId = curMailboxId++;
 	Vector invDir(1.f/ray.d.x, 1.f/ray.d.y, 1.f/ray.d.z);
 	#define MAX_TODO 64
 	KdToDo todo[MAX_TODO];
@@ -370,22 +367,16 @@ bool KdTreeAccel::Intersect(const Ray &ray,
 			if (nPrimitives == 1) {
 				MailboxPrim *mp = node->onePrimitive;
 				// Check one primitive inside leaf node
-				if (mp->lastMailboxId != rayId) {
-					mp->lastMailboxId = rayId;
-					if (mp->primitive->Intersect(ray, isect))
-						hit = true;
-				}
+				if (mp->primitive->Intersect(ray, isect))
+					hit = true;
 			}
 			else {
 				MailboxPrim **prims = node->primitives;
 				for (u_int i = 0; i < nPrimitives; ++i) {
 					MailboxPrim *mp = prims[i];
 					// Check one primitive inside leaf node
-					if (mp->lastMailboxId != rayId) {
-						mp->lastMailboxId = rayId;
-						if (mp->primitive->Intersect(ray, isect))
-							hit = true;
-					}
+					if (mp->primitive->Intersect(ray, isect))
+						hit = true;
 				}
 			}
 			// Grab next node to process from todo list
@@ -407,7 +398,6 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
 	if (!bounds.IntersectP(ray, &tmin, &tmax))
 		return false;
 	// Prepare to traverse kd-tree for ray
-	int rayId = curMailboxId++;
 	Vector invDir(1.f/ray.d.x, 1.f/ray.d.y, 1.f/ray.d.z);
 	#define MAX_TODO 64
 	KdToDo todo[MAX_TODO];
@@ -423,21 +413,15 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
 			u_int nPrimitives = node->nPrimitives();
 			if (nPrimitives == 1) {
 				MailboxPrim *mp = node->onePrimitive;
-				if (mp->lastMailboxId != rayId) {
-					mp->lastMailboxId = rayId;
-					if (mp->primitive->IntersectP(ray))
-						return true;
-				}
+				if (mp->primitive->IntersectP(ray))
+					return true;
 			}
 			else {
 				MailboxPrim **prims = node->primitives;
 				for (u_int i = 0; i < nPrimitives; ++i) {
 					MailboxPrim *mp = prims[i];
-					if (mp->lastMailboxId != rayId) {
-						mp->lastMailboxId = rayId;
-						if (mp->primitive->IntersectP(ray))
-							return true;
-					}
+					if (mp->primitive->IntersectP(ray))
+						return true;
 				}
 			}
 			// Grab next node to process from todo list
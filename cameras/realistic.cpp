@@ -0,0 +1,2302 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+// realistic.cpp*
+#include "camera.h"
+#include "film.h"
+#include "paramset.h"
+#include "mc.h"
+#include "lens.h"
+#include "parallel.h"
+#include <fstream>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+// LensInterface Declarations
+struct LensInterface {
+	// LensInterface Data
+	float radius;      // Signed radius of curvature (0 for the stop)
+	float zpos;        // Axial position of the interface vertex
+	float eta;         // Index of refraction behind the interface
+	float aperture;    // Clear aperture diameter
+	bool isStop;
+	float abbe;        // Abbe number $V_d$, or 0 if not given
+	float sellmeierB[3], sellmeierC[3]; // Sellmeier terms, $C$ in $\mu m^2$
+	bool aspheric;
+	float conic;       // Conic constant $k$ of an aspheric surface
+	float asphere[LENS_ASPHERE_TERMS]; // Even terms from $r^4$ upward
+	float thickness;   // Axial gap to the next interface
+	vector<float> spacing; // Gap for each zoom and focus state, if it moves
+};
+// Lens Dispersion Declarations
+// Fraunhofer C, d and F lines (nm) traced for the red, green and blue
+// channels; the tabulated index N is the index at the d line
+static const float lensChannelWavelength[COLOR_SAMPLES] = {
+	656.3f, 587.6f, 486.1f
+};
+// LensPolynomial Declarations
+#define LENS_POLY_RAY_OUTPUTS 4
+#define LENS_POLY_MAX_DEGREE 9
+#define LENS_POLY_MAX_TERMS 220
+#define LENS_POLY_MAX_MISMATCH .01f
+struct LensPolyTerm {
+	// LensPolyTerm Data: exponents of film radius and pupil $x$, $y$
+	u_char i, j, k;
+};
+struct LensPolynomial {
+	// LensPolynomial Data: sparse terms for outputs along $x$ and $y$, and
+	// coefficients per output: front plane $x$, $y$ and exit direction $x$,
+	// $y$, then the $x$, $y$ hit point on each interface in
+	// _clipInterfaces_ whose rim vignettes rays
+	int degree;
+	vector<LensPolyTerm> terms[2];
+	vector<int> clipInterfaces;
+	vector<vector<float> > coeffs;
+};
+// LensField Declarations
+#define LENS_FIELD_BLOCKED 2.f
+struct LensFieldEntry {
+	// LensFieldEntry Data: front plane $x$, $y$ and exit direction $x$,
+	// $y$, with _dx_ set to LENS_FIELD_BLOCKED if the lens blocks the ray
+	float ox, oy, dx, dy;
+};
+struct LensFieldHeader {
+	// LensFieldHeader Data
+	char magic[8];
+	u_int lensHash;
+	int nLenses, nr, nx, ny;
+	float filmZ, filmRadius;
+	float pupilMinX, pupilMinY, pupilMaxX, pupilMaxY;
+};
+// LensPupilHeader Declarations
+struct LensPupilHeader {
+	// LensPupilHeader Data, followed in the cache file by _nBins_ rear
+	// plane rectangles $(x_0, y_0, x_1, y_1)$, empty where $x_0 > x_1$
+	char magic[8];
+	u_int lensHash;
+	int nBins;
+};
+// IrisPupilBound Declarations
+struct IrisPupilBound {
+	// IrisPupilBound Data: polygon of the iris's orientation and
+	// circumradius _radius_ around every rear plane point that passes for
+	// one exit pupil bin, centered at _centerScale_ times the film point;
+	// _area_ is zero where the bin's rectangle is smaller
+	float centerScale, radius, area;
+};
+// ThickLensRegion Declarations
+#define THICK_LENS_MAX_MISMATCH .005f
+struct ThickLensRegion {
+	// ThickLensRegion Data: whether the thick lens may stand in for exact
+	// tracing over one exit pupil bin, and the rear plane disk, or iris
+	// shape of circumradius _pupilRadius_, its rays pass through,
+	// centered at _centerScale_ times the film radius along the film
+	// point's direction
+	bool useThick;
+	float centerScale, pupilRadius;
+	float maxError;    // Largest calibration error (pixels)
+};
+// LensRayCache Declarations
+struct LensRayCacheHeader {
+	// LensRayCacheHeader Data, followed in the cache file by the index
+	// of each pixel's first entry, then the entry count, and the entries,
+	// ordered by pixel and then by sample hash within the pixel
+	char magic[8];
+	u_int lensHash;
+	int xStart, xEnd, yStart, yEnd;
+	int nEntries;
+};
+struct LensRayCacheEntry {
+	// LensRayCacheEntry Data: hash of the camera sample the ray was
+	// generated for, its weight, zero where the lens blocks it, and the
+	// camera space lens ray; derivatives for one pixel steps keep the
+	// upper 16 bits of each float, since they only size texture filters
+	u_int sampleHash;
+	float weight;
+	Point o;
+	Vector d;
+	u_short deriv[12];
+};
+// Pixels are recorded in blocks the size of the renderer's image tiles,
+// so that one thread at a time records into each block; a block's rays
+// are spilled to its row's temporary file every _RAY_CACHE_SPILL_ rays
+#define RAY_CACHE_BLOCK TILE_SIZE
+#define RAY_CACHE_SPILL 128
+struct LensRayCacheRecord {
+	u_int pixel;
+	LensRayCacheEntry entry;
+};
+struct LensRayCacheBlock {
+	Mutex mutex;
+	vector<LensRayCacheRecord> records;
+};
+class MappedFile {
+public:
+	// MappedFile Public Methods
+	MappedFile();
+	~MappedFile();
+	bool Map(const string &filename);
+	const void *Data() const { return data; }
+	size_t Size() const { return size; }
+private:
+	// MappedFile Private Data
+#ifdef WIN32
+	HANDLE file, mapping;
+#endif
+	void *data;
+	size_t size;
+};
+// RealisticCamera Declarations
+class RealisticCamera : public Camera {
+public:
+	// RealisticCamera Public Methods
+	RealisticCamera(const Transform &world2cam, float hither,
+		float yon, float sopen, float sclose,
+		const vector<LensInterface> &lenses, float filmdistance,
+		float filmdiag, bool simpleweighting, int pupilbins,
+		bool usepolynomial, int polydegree, float polytolerance,
+		const string &polyfile, const string &lightfieldcache,
+		int lightfieldres, bool dispersion, float dispersiontolerance,
+		bool thicklens, float thicktolerance, const LensStateTable &states,
+		float zoom, float focusdistance, const string &statecache,
+		const LensIris &iris, const string &raycache, Film *film);
+	~RealisticCamera();
+	float GenerateRay(const Sample &sample, Ray *) const;
+	float GenerateSpectralRay(const Sample &sample, Ray *ray,
+		Spectrum *channelWeights) const;
+	float GenerateRayDifferential(const Sample &sample,
+		RayDifferential *ray, Spectrum *channelWeights) const;
+	void GenerateRayDifferentials(const Sample *const *samples,
+		int nSamples, RayDifferential *rays, Spectrum *channelWeights,
+		float *rayWeights) const;
+	int RayBatchSize() const;
+private:
+	// RealisticCamera Private Methods
+	Point FilmPoint(const Sample &sample) const {
+		// Compute film point for raster sample, inverted by the lens
+		float sx = sample.imageX / film->xResolution;
+		float sy = sample.imageY / film->yResolution;
+		return Point((sx - .5f) * -filmWidth, (.5f - sy) * -filmHeight,
+			filmZ);
+	}
+	bool TracesPackets() const {
+		// Only exact tracing, without the ray cache or the thick lens
+		// hybrid, takes camera samples a packet at a time
+		return !lensField && !usePolynomial && !dispersive &&
+			thickRegions.empty() && rayCacheFile == "";
+	}
+	float GenerateLensRay(const Sample &sample, Ray *ray,
+		LensRayDerivatives *deriv) const;
+	void FilmRayDerivatives(const Ray &rFilm, const Point &pRear,
+		LensRayDerivatives *deriv) const;
+	void LensRayDifferentials(const LensRayDerivatives &deriv,
+		RayDifferential *ray) const;
+	void CountBlockedLensRay(bool blocked) const;
+	bool TraceLensesFromFilm(const Ray &rCamera, Ray *rOut,
+		Point *pHits = NULL) const;
+	int TraceLensesFromFilm(const LensRayPacket &rCamera,
+		LensRayPacket *rOut, int activeMask, const float *laneEta = NULL,
+		LensDerivativePacket *deriv = NULL) const;
+	float CameraRayWeight(const Ray &rFilm, float boundsArea,
+		Ray *ray) const;
+	void CameraRayToWorld(const Sample &sample, Ray *ray) const;
+	bool ChannelRaysMatch(const LensRayPacket &r, int a, int b) const;
+	void PlaceLens(const int state[4], const float weight[4], int nStates,
+		float filmdistance);
+	void InitStatePupilBounds(const int state[4], const float weight[4],
+		int nStates, float filmdistance, const string &cachedir);
+	BBox BoundExitPupil(float filmR0, float filmR1) const;
+	bool ExitPupilCovered(float filmR0, float filmR1,
+		const BBox &pupilBounds) const;
+	int ExitPupilBin(float rFilm) const {
+		return Clamp(Floor2Int(rFilm / filmRadius * exitPupilBounds.size()),
+			0, int(exitPupilBounds.size()) - 1);
+	}
+	Point RotateToFilmAngle(float px, float py, float cosTheta,
+			float sinTheta) const {
+		return Point(cosTheta * px - sinTheta * py,
+		             sinTheta * px + cosTheta * py, rearZ);
+	}
+	void BoundIrisPupils();
+	Point SampleExitPupil(float filmX, float filmY, float u1, float u2,
+		float *boundsArea, float *pupilX = NULL, float *pupilY = NULL) const;
+	bool SamplePupilForFit(int index, float *r, float *px,
+		float *py) const;
+	bool FitLensPolynomial(int degree, LensPolynomial *poly) const;
+	bool ValidateLensPolynomial(const LensPolynomial &poly, float tolerance,
+		float *posError, float *dirError, float *mismatch) const;
+	bool ReadLensPolynomial(const string &filename,
+		LensPolynomial *poly) const;
+	void WriteLensPolynomial(const string &filename,
+		const LensPolynomial &poly) const;
+	bool ExactLensOutputs(float r, float px, float py,
+		float out[LENS_POLY_RAY_OUTPUTS], Point *pHits = NULL) const;
+	bool EvaluateLensPolynomial(const LensPolynomial &poly, float r,
+		float px, float py, float out[LENS_POLY_RAY_OUTPUTS]) const;
+	bool TraceLensPolynomial(float filmX, float filmY, float px, float py,
+		Ray *rOut) const;
+	void RotateLensRay(float filmX, float filmY,
+		const float out[LENS_POLY_RAY_OUTPUTS], Ray *rOut) const;
+	u_int HashLensSystem() const;
+	void InitLensFieldHeader(int res, LensFieldHeader *header) const;
+	void BuildLensField(const LensFieldHeader &header,
+		vector<LensFieldEntry> *entries) const;
+	bool MapLensField(const string &filename,
+		const LensFieldHeader &header);
+	void InitLensField(const string &cachedir, int res);
+	bool TraceLensField(float filmX, float filmY, float px, float py,
+		const Ray &rFilm, Ray *rOut) const;
+	bool ComputeThickLens();
+	void CalibrateThickLens(float tolerance);
+	void TraceThickLens(const Point &pFilm, const Point &pRear, Ray *rOut,
+		LensRayDerivatives *deriv) const;
+	float ThickLensError(const Ray &rThick, const Ray &rExact) const;
+	u_int HashRayCache() const;
+	bool MapRayCache(const string &filename);
+	void RecordLensRay(int pixel, const LensRayCacheEntry &e) const;
+	void SpillRayCacheBlock(int band, LensRayCacheBlock *block) const;
+	string RayCacheBandName(int band) const;
+	void WriteRayCache(const string &filename) const;
+	int RayCachePixel(float imageX, float imageY) const {
+		const LensRayCacheHeader &h = rayCacheHeader;
+		int x = Clamp(Floor2Int(imageX), h.xStart, h.xEnd - 1) - h.xStart;
+		int y = Clamp(Floor2Int(imageY), h.yStart, h.yEnd - 1) - h.yStart;
+		return y * (h.xEnd - h.xStart) + x;
+	}
+	float CachedLensRay(const Sample &sample, Ray *ray,
+		LensRayDerivatives *deriv) const;
+	// RealisticCamera Private Data
+	vector<LensInterface> lenses;
+	LensPrescription prescription;
+	float filmZ, filmWidth, filmHeight, filmRadius;
+	float rearZ, rearRadius;
+	bool simpleWeighting;
+	vector<BBox> exitPupilBounds;
+	vector<IrisPupilBound> irisBounds;
+	float pupilExtent, frontZ;
+	bool usePolynomial;
+	LensPolynomial lensPoly;
+	LensFieldHeader lensFieldHeader;
+	vector<LensFieldEntry> lensFieldStorage;
+	MappedFile *lensFieldFile;
+	const LensFieldEntry *lensField;
+	bool dispersive;
+	float dispersionTolerance;
+	vector<float> spectralEta;
+	float thickFrontZ, thickRearZ, thickFocalLength;
+	vector<ThickLensRegion> thickRegions;
+	string rayCacheFile;
+	LensRayCacheHeader rayCacheHeader;
+	MappedFile *rayCacheFileMapping;
+	const u_int *rayCachePixels;
+	const LensRayCacheEntry *rayCache;
+	bool recordRayCache;
+	int rayCacheBlocksX;
+	vector<LensRayCacheBlock *> rayCacheBlocks;
+	mutable vector<u_int> rayCacheCounts;
+	mutable vector<FILE *> rayCacheBands;
+	mutable Mutex rayCacheBandMutex;
+	mutable bool rayCacheFailed;
+};
+// RealisticCamera Utility Functions
+static void ParseFloatList(const char *s, vector<float> *values) {
+	values->clear();
+	for (;;) {
+		char *end;
+		float v = float(strtod(s, &end));
+		if (end == s) break;
+		values->push_back(v);
+		s = end;
+	}
+}
+static bool LoadLensFile(const string &filename,
+		vector<LensInterface> *lenses, LensStateTable *states) {
+	// Parse lens interfaces in the _lensSystem::Load_ format
+	std::ifstream lensfile(filename.c_str());
+	if (!lensfile) {
+		Error("Unable to open lens specification file \"%s\"",
+			filename.c_str());
+		return false;
+	}
+	lenses->clear();
+	states->zoom.clear();
+	states->focus.clear();
+	bool hasSpacing = false;
+	float z = 0.f;
+	string line;
+	while (std::getline(lensfile, line)) {
+		// Skip comments and empty lines
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#')
+			continue;
+		// Read zoom positions, focus distances, and the gap after the
+		// previous interface for each of their states
+		size_t last = line.find_first_of(" \t\r", first);
+		string keyword = line.substr(first, last - first);
+		if (keyword == "zoom" || keyword == "focus" || keyword == "spacing") {
+			vector<float> values;
+			ParseFloatList(line.c_str() + first + keyword.size(), &values);
+			bool ok = !values.empty();
+			if (keyword == "spacing") {
+				ok &= !lenses->empty() && lenses->back().spacing.empty() &&
+					int(values.size()) == states->NumStates();
+				if (ok) lenses->back().spacing = values;
+				hasSpacing = true;
+			}
+			else {
+				// States must be ordered and declared before any gaps
+				ok &= !hasSpacing;
+				for (u_int i = 1; i < values.size(); ++i)
+					ok &= (keyword == "zoom") ? values[i] > values[i - 1] :
+						values[i] < values[i - 1];
+				(keyword == "zoom" ? states->zoom : states->focus) = values;
+			}
+			if (!ok) {
+				Error("Malformed %s line in lens file \"%s\": \"%s\"",
+					keyword.c_str(), filename.c_str(), line.c_str());
+				return false;
+			}
+			continue;
+		}
+		// Read conic constant and even asphere terms for the previous
+		// interface from an "asphere" line
+		if (line.compare(first, 7, "asphere") == 0) {
+			float k, a[LENS_ASPHERE_TERMS];
+			int nRead = sscanf(line.c_str() + first + 7,
+				"%f %f %f %f %f %f %f", &k, &a[0], &a[1], &a[2], &a[3],
+				&a[4], &a[5]);
+			if (nRead < 1 || lenses->empty() || lenses->back().isStop) {
+				Error("Malformed asphere line in lens file \"%s\": \"%s\"",
+					filename.c_str(), line.c_str());
+				return false;
+			}
+			LensInterface &prev = lenses->back();
+			prev.aspheric = true;
+			prev.conic = k;
+			for (int j = 0; j < LENS_ASPHERE_TERMS; ++j)
+				prev.asphere[j] = (j < nRead - 1) ? a[j] : 0.f;
+			continue;
+		}
+		// Read optional Abbe number or Sellmeier coefficients after
+		// the four _lensSystem::Load_ columns
+		float rad, sep, ndr, aper, disp[6];
+		int nRead = sscanf(line.c_str(), "%f %f %f %f %f %f %f %f %f %f",
+			&rad, &sep, &ndr, &aper, &disp[0], &disp[1], &disp[2],
+			&disp[3], &disp[4], &disp[5]);
+		if (nRead != 4 && nRead != 5 && nRead != 10) {
+			Error("Malformed line in lens file \"%s\": \"%s\"",
+				filename.c_str(), line.c_str());
+			return false;
+		}
+		LensInterface li;
+		li.abbe = (nRead == 5) ? disp[0] : 0.f;
+		for (int j = 0; j < 3; ++j) {
+			li.sellmeierB[j] = (nRead == 10) ? disp[j] : 0.f;
+			li.sellmeierC[j] = (nRead == 10) ? disp[j + 3] : 0.f;
+		}
+		li.aspheric = false;
+		li.conic = 0.f;
+		for (int j = 0; j < LENS_ASPHERE_TERMS; ++j)
+			li.asphere[j] = 0.f;
+		li.radius = rad;
+		li.zpos = z;
+		li.thickness = sep;
+		li.isStop = (rad == 0.f && ndr == 0.f);
+		li.eta = (ndr == 0.f) ? 1.f : ndr;
+		li.aperture = aper;
+		lenses->push_back(li);
+		z -= sep;
+	}
+	if (lenses->size() < 2) {
+		Error("Lens file \"%s\" describes fewer than two interfaces",
+			filename.c_str());
+		return false;
+	}
+	return true;
+}
+static float PlaceLensInterfaces(vector<LensInterface> *lenses,
+		const int state[4], const float weight[4], int nStates) {
+	// Position interfaces for a blend of zoom and focus states, returning
+	// the gap behind the rear interface as the back focal distance
+	float z = 0.f;
+	for (u_int i = 0; i < lenses->size(); ++i) {
+		LensInterface &li = (*lenses)[i];
+		li.zpos = z;
+		z -= li.spacing.empty() ? li.thickness :
+			LensStateTable::Interpolate(li.spacing, state, weight, nStates);
+	}
+	return lenses->back().zpos - z;
+}
+static u_int HashBytes(const void *bytes, size_t n, u_int hash) {
+	// Accumulate FNV-1a hash of _bytes_
+	const u_char *b = (const u_char *)bytes;
+	for (size_t i = 0; i < n; ++i) {
+		hash ^= b[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+static string TempCacheName(const string &filename) {
+	char suffix[32];
+#ifdef WIN32
+	sprintf(suffix, ".%d.tmp", _getpid());
+#else
+	sprintf(suffix, ".%d.tmp", int(getpid()));
+#endif
+	return filename + suffix;
+}
+static bool PublishCacheFile(const string &tmpname, const string &filename,
+		bool written) {
+	// Replace _filename_ with the written temporary file in one rename
+#ifdef WIN32
+	if (written) remove(filename.c_str());
+#endif
+	if (written && rename(tmpname.c_str(), filename.c_str()) == 0)
+		return true;
+	remove(tmpname.c_str());
+	return false;
+}
+static bool WriteCacheFile(const string &filename, const void *header,
+		size_t headerSize, const void *data, size_t dataSize) {
+	// Write to a temporary file and publish it with an atomic rename
+	string tmpname = TempCacheName(filename);
+	FILE *f = fopen(tmpname.c_str(), "wb");
+	bool written = f && fwrite(header, headerSize, 1, f) == 1 &&
+		fwrite(data, dataSize, 1, f) == 1;
+	if (f) written = (fclose(f) == 0) && written;
+	return PublishCacheFile(tmpname, filename, written);
+}
+static bool HasDispersion(const LensInterface &li) {
+	return li.abbe > 0.f || li.sellmeierB[0] != 0.f ||
+		li.sellmeierB[1] != 0.f || li.sellmeierB[2] != 0.f;
+}
+static float LensIndex(const LensInterface &li, float lambda) {
+	if (li.sellmeierB[0] != 0.f || li.sellmeierB[1] != 0.f ||
+			li.sellmeierB[2] != 0.f) {
+		// Evaluate Sellmeier equation with wavelength in micrometres
+		float l2 = lambda * lambda * 1e-6f;
+		float n2 = 1.f;
+		for (int j = 0; j < 3; ++j)
+			n2 += li.sellmeierB[j] * l2 / (l2 - li.sellmeierC[j]);
+		return sqrtf(n2);
+	}
+	if (li.abbe > 0.f) {
+		// Fit Cauchy's equation $n = A + B / \lambda^2$ to $n_d$ and $V_d$
+		const float lambdaC = 656.3f, lambdaD = 587.6f, lambdaF = 486.1f;
+		float B = (li.eta - 1.f) / li.abbe /
+			(1.f / (lambdaF * lambdaF) - 1.f / (lambdaC * lambdaC));
+		return li.eta + B * (1.f / (lambda * lambda) -
+			1.f / (lambdaD * lambdaD));
+	}
+	return li.eta;
+}
+// RealisticCamera Method Definitions
+RealisticCamera::RealisticCamera(const Transform &world2cam,
+		float hither, float yon, float sopen, float sclose,
+		const vector<LensInterface> &lens, float filmdistance,
+		float filmdiag, bool simpleweighting, int pupilbins,
+		bool usepolynomial, int polydegree, float polytolerance,
+		const string &polyfile, const string &lightfieldcache,
+		int lightfieldres, bool dispersion, float dispersiontolerance,
+		bool thicklens, float thicktolerance, const LensStateTable &states,
+		float zoom, float focusdistance, const string &statecache,
+		const LensIris &iris, const string &raycache, Film *f)
+	: Camera(world2cam, hither, yon, sopen, sclose, f) {
+	// Place lens groups for the requested zoom and focus state
+	lenses = lens;
+	int state[4];
+	float weight[4];
+	int nStates = states.Bracket(zoom, focusdistance, state, weight);
+	PlaceLens(state, weight, nStates, filmdistance);
+	simpleWeighting = simpleweighting;
+	// Compute physical film extent from diagonal
+	float aspect = float(film->yResolution) / float(film->xResolution);
+	filmWidth = filmdiag / sqrtf(1.f + aspect * aspect);
+	filmHeight = filmWidth * aspect;
+	filmRadius = .5f * filmdiag;
+	// Precompute exit pupil bounds for radial film intervals, or combine
+	// those cached for the neighbouring lens states
+	exitPupilBounds.resize(pupilbins);
+	if (statecache != "" && states.NumStates() > 1)
+		InitStatePupilBounds(state, weight, nStates, filmdistance,
+			statecache);
+	else
+		for (int i = 0; i < pupilbins; ++i) {
+			float r0 = float(i) / pupilbins * filmRadius;
+			float r1 = float(i + 1) / pupilbins * filmRadius;
+			exitPupilBounds[i] = BoundExitPupil(r0, r1);
+		}
+	// Add iris blades once the round stop's pupil bounds are known; as
+	// the blades lie inside its circle, these hold at every film angle
+	prescription.iris = iris;
+	if (iris.IsPolygon())
+		BoundIrisPupils();
+	// Calibrate thick lens approximation against exact tracing
+	if (thicklens) {
+		if (ComputeThickLens())
+			CalibrateThickLens(thicktolerance);
+		else
+			Warning("Lens system has no finite focal length; "
+				"ignoring \"thicklens\"");
+	}
+	// Fit or read polynomial approximation of the lens system
+	usePolynomial = false;
+	if (usepolynomial) {
+		float posError = 0.f, dirError = 0.f, mismatch = 0.f;
+		if (polyfile != "" && ReadLensPolynomial(polyfile, &lensPoly) &&
+			ValidateLensPolynomial(lensPoly, polytolerance,
+				&posError, &dirError, &mismatch))
+			usePolynomial = true;
+		for (int degree = 3; !usePolynomial && degree <= polydegree;
+				degree += 2)
+			if (FitLensPolynomial(degree, &lensPoly) &&
+				ValidateLensPolynomial(lensPoly, polytolerance,
+					&posError, &dirError, &mismatch)) {
+				usePolynomial = true;
+				if (polyfile != "")
+					WriteLensPolynomial(polyfile, lensPoly);
+			}
+		if (usePolynomial)
+			Info("Lens polynomial of degree %d: rms position error %g mm, "
+				"rms direction error %g, vignetting mismatch %.2f%%",
+				lensPoly.degree, posError, dirError, 100.f * mismatch);
+		else
+			Warning("No lens polynomial up to degree %d meets tolerance %g; "
+				"tracing lens system exactly", polydegree, polytolerance);
+	}
+	// Map or build tabulated lens light field
+	lensFieldFile = NULL;
+	lensField = NULL;
+	if (lightfieldcache != "")
+		InitLensField(lightfieldcache, lightfieldres);
+	// Tabulate per-channel refraction ratios for dispersive tracing
+	dispersive = dispersion;
+	dispersionTolerance = dispersiontolerance * filmWidth / film->xResolution;
+	if (dispersive) {
+		spectralEta.resize(lenses.size() * LENS_PACKET_SIZE);
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			float lambda = lensChannelWavelength[min(lane, COLOR_SAMPLES - 1)];
+			float etaFront = 1.f;
+			for (u_int i = 0; i < lenses.size(); ++i) {
+				float etaBehind = LensIndex(lenses[i], lambda);
+				spectralEta[i * LENS_PACKET_SIZE + lane] = etaBehind / etaFront;
+				etaFront = etaBehind;
+			}
+		}
+	}
+	// Read the shot's lens rays, or record them during this frame
+	rayCacheFile = raycache;
+	rayCacheFileMapping = NULL;
+	rayCachePixels = NULL;
+	rayCache = NULL;
+	recordRayCache = false;
+	rayCacheFailed = false;
+	if (rayCacheFile != "") {
+		if (MapRayCache(rayCacheFile))
+			Info("Mapped %d lens rays from ray cache \"%s\"",
+				rayCacheHeader.nEntries, rayCacheFile.c_str());
+		else {
+			Info("Recording lens rays in ray cache \"%s\"",
+				rayCacheFile.c_str());
+			recordRayCache = true;
+			const LensRayCacheHeader &h = rayCacheHeader;
+			rayCacheBlocksX = (h.xEnd - h.xStart + RAY_CACHE_BLOCK - 1) /
+				RAY_CACHE_BLOCK;
+			int nBands = (h.yEnd - h.yStart + RAY_CACHE_BLOCK - 1) /
+				RAY_CACHE_BLOCK;
+			for (int i = 0; i < rayCacheBlocksX * nBands; ++i)
+				rayCacheBlocks.push_back(new LensRayCacheBlock);
+			rayCacheBands.resize(nBands, NULL);
+			rayCacheCounts.resize((h.xEnd - h.xStart) * (h.yEnd - h.yStart), 0);
+		}
+	}
+}
+RealisticCamera::~RealisticCamera() {
+	delete lensFieldFile;
+	// Publish the rays traced for this frame to the frames that follow
+	if (recordRayCache)
+		WriteRayCache(rayCacheFile);
+	for (u_int i = 0; i < rayCacheBlocks.size(); ++i)
+		delete rayCacheBlocks[i];
+	delete rayCacheFileMapping;
+}
+void RealisticCamera::PlaceLens(const int state[4], const float weight[4],
+		int nStates, float filmdistance) {
+	// Position interfaces and rebuild the flattened prescription
+	float backFocus = PlaceLensInterfaces(&lenses, state, weight, nStates);
+	prescription.Clear();
+	for (u_int i = 0; i < lenses.size(); ++i) {
+		prescription.AddSurface(lenses[i].radius, lenses[i].zpos,
+			lenses[i].eta, lenses[i].aperture, lenses[i].isStop);
+		if (lenses[i].aspheric)
+			prescription.SetAsphere(i, lenses[i].conic, lenses[i].asphere);
+	}
+	// Place film behind the rear lens element, at the lens file's back
+	// focal distance unless one is given
+	rearZ = lenses.back().zpos;
+	rearRadius = lenses.back().aperture * .5f;
+	filmZ = rearZ - ((filmdistance > 0.f) ? filmdistance : backFocus);
+	pupilExtent = 1.5f * rearRadius;
+	frontZ = lenses[0].zpos;
+}
+void RealisticCamera::InitStatePupilBounds(const int state[4],
+		const float weight[4], int nStates, float filmdistance,
+		const string &cachedir) {
+	// Union the exit pupil bounds of the states around the requested
+	// one, reading each from the cache or computing and caching it
+	int nBins = int(exitPupilBounds.size());
+	vector<float> rects(4 * nBins), area(4 * nBins);
+	for (int i = 0; i < nBins; ++i) {
+		area[4 * i] = area[4 * i + 1] = INFINITY;
+		area[4 * i + 2] = area[4 * i + 3] = -INFINITY;
+	}
+	for (int s = 0; s < nStates; ++s) {
+		int single[4] = { state[s], 0, 0, 0 };
+		float unit[4] = { 1.f, 0.f, 0.f, 0.f };
+		PlaceLens(single, unit, 1, filmdistance);
+		LensPupilHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "PBRTEP1", 8);
+		u_int hash = HashLensSystem();
+		float film[2] = { rearZ - filmZ, filmRadius };
+		header.lensHash = HashBytes(film, sizeof(film), hash);
+		header.nBins = nBins;
+		char name[64];
+		sprintf(name, "lenspupil-%08x.bin", header.lensHash);
+		string filename = cachedir + "/" + name;
+		LensPupilHeader cached;
+		FILE *f = fopen(filename.c_str(), "rb");
+		bool found = f && fread(&cached, sizeof(cached), 1, f) == 1 &&
+			memcmp(&cached, &header, sizeof(header)) == 0 &&
+			fread(&rects[0], sizeof(float), rects.size(), f) == rects.size();
+		if (f) fclose(f);
+		if (!found) {
+			for (int i = 0; i < nBins; ++i) {
+				BBox b = BoundExitPupil(float(i) / nBins * filmRadius,
+					float(i + 1) / nBins * filmRadius);
+				rects[4 * i] = b.pMin.x;
+				rects[4 * i + 1] = b.pMin.y;
+				rects[4 * i + 2] = b.pMax.x;
+				rects[4 * i + 3] = b.pMax.y;
+			}
+			if (!WriteCacheFile(filename, &header, sizeof(header),
+					&rects[0], rects.size() * sizeof(float)))
+				Warning("Unable to write lens state pupil bounds \"%s\"",
+					filename.c_str());
+		}
+		for (int i = 0; i < 4 * nBins; i += 4) {
+			if (rects[i] > rects[i + 2]) continue;
+			area[i] = min(area[i], rects[i]);
+			area[i + 1] = min(area[i + 1], rects[i + 1]);
+			area[i + 2] = max(area[i + 2], rects[i + 2]);
+			area[i + 3] = max(area[i + 3], rects[i + 3]);
+		}
+	}
+	// Restore the requested state and use the union in its rear plane
+	PlaceLens(state, weight, nStates, filmdistance);
+	for (int i = 0; i < nBins; ++i) {
+		const float *a = &area[4 * i];
+		exitPupilBounds[i] = (a[0] > a[2]) ? BBox() :
+			BBox(Point(a[0], a[1], rearZ), Point(a[2], a[3], rearZ));
+	}
+	if (nStates == 1) return;
+	// An interpolated state's pupil need not lie inside the union, so
+	// pad it and probe the actual state, recomputing bins that leak
+	static StatsPercentage recomputed("Camera",
+		"Interpolated lens state pupil bins recomputed"); // NOBOOK
+	int nLeaks = 0;
+	for (int i = 0; i < nBins; ++i) {
+		float r0 = float(i) / nBins * filmRadius;
+		float r1 = float(i + 1) / nBins * filmRadius;
+		BBox &b = exitPupilBounds[i];
+		if (b.pMin.x <= b.pMax.x) {
+			b.Expand(.02f * rearRadius);
+			b.pMin.z = b.pMax.z = rearZ;
+		}
+		bool leaks = !ExitPupilCovered(r0, r1, b);
+		if (leaks) {
+			b = BoundExitPupil(r0, r1);
+			++nLeaks;
+		}
+		recomputed.Add(leaks ? 1 : 0, 1); // NOBOOK
+	}
+	if (nLeaks > 0)
+		Warning("%d of %d exit pupil bins for the interpolated lens state "
+			"fell outside its neighbours' bounds and were recomputed",
+			nLeaks, nBins);
+}
+bool RealisticCamera::ExitPupilCovered(float filmR0, float filmR1,
+		const BBox &pupilBounds) const {
+	// Trace a sparse fan from the film interval to rear plane points
+	// outside _pupilBounds_; any that pass show the bounds too small
+	const int nFilm = 3, nRear = 32;
+	float rearExtent = 1.5f * rearRadius;
+	for (int f = 0; f < nFilm; ++f) {
+		Point pFilm(Lerp((f + .5f) / nFilm, filmR0, filmR1), 0.f, filmZ);
+		for (int y = 0; y < nRear; ++y)
+			for (int x0 = 0; x0 < nRear; x0 += LENS_PACKET_SIZE) {
+				LensRayPacket packet, packetOut;
+				int activeMask = 0;
+				for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+					int x = min(x0 + lane, nRear - 1);
+					Point pRear(
+						Lerp((x + .5f) / nRear, -rearExtent, rearExtent),
+						Lerp((y + .5f) / nRear, -rearExtent, rearExtent),
+						rearZ);
+					Vector d = Normalize(pRear - pFilm);
+					packet.ox[lane] = pFilm.x;
+					packet.oy[lane] = pFilm.y;
+					packet.oz[lane] = pFilm.z;
+					packet.dx[lane] = d.x;
+					packet.dy[lane] = d.y;
+					packet.dz[lane] = d.z;
+					if (!pupilBounds.Inside(pRear))
+						activeMask |= (1 << lane);
+				}
+				if (activeMask &&
+					TraceLensesFromFilm(packet, &packetOut, activeMask))
+					return false;
+			}
+	}
+	return true;
+}
+BBox RealisticCamera::BoundExitPupil(float filmR0, float filmR1) const {
+	// Trace a dense fan of rays from the film interval to the rear plane
+	BBox pupilBounds;
+	const int nFilm = 8, nRear = 128;
+	float rearExtent = 1.5f * rearRadius;
+	for (int f = 0; f < nFilm; ++f) {
+		Point pFilm(Lerp((f + .5f) / nFilm, filmR0, filmR1), 0.f, filmZ);
+		for (int y = 0; y < nRear; ++y)
+			for (int x0 = 0; x0 < nRear; x0 += LENS_PACKET_SIZE) {
+				// Build packet of rays toward the rear plane
+				LensRayPacket packet, packetOut;
+				Point pRear[LENS_PACKET_SIZE];
+				int activeMask = 0;
+				for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+					int x = min(x0 + lane, nRear - 1);
+					pRear[lane] = Point(
+						Lerp((x + .5f) / nRear, -rearExtent, rearExtent),
+						Lerp((y + .5f) / nRear, -rearExtent, rearExtent),
+						rearZ);
+					Vector d = Normalize(pRear[lane] - pFilm);
+					packet.ox[lane] = pFilm.x;
+					packet.oy[lane] = pFilm.y;
+					packet.oz[lane] = pFilm.z;
+					packet.dx[lane] = d.x;
+					packet.dy[lane] = d.y;
+					packet.dz[lane] = d.z;
+					// Skip rays whose result cannot grow the bounds
+					if (!pupilBounds.Inside(pRear[lane]))
+						activeMask |= (1 << lane);
+				}
+				if (!activeMask) continue;
+				int hitMask = TraceLensesFromFilm(packet, &packetOut,
+					activeMask);
+				for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane)
+					if (hitMask & (1 << lane))
+						pupilBounds = Union(pupilBounds, pRear[lane]);
+			}
+	}
+	if (pupilBounds.pMin.x > pupilBounds.pMax.x)
+		return pupilBounds;
+	// Expand bounds by one grid cell to cover undersampling
+	pupilBounds.Expand(2.f * rearExtent / nRear);
+	pupilBounds.pMin.z = pupilBounds.pMax.z = rearZ;
+	return pupilBounds;
+}
+Point RealisticCamera::SampleExitPupil(float filmX, float filmY,
+		float u1, float u2, float *boundsArea, float *pupilX,
+		float *pupilY) const {
+	// Find exit pupil bound for sample distance from film center
+	float rFilm = sqrtf(filmX * filmX + filmY * filmY);
+	int bin = ExitPupilBin(rFilm);
+	const BBox &pupilBounds = exitPupilBounds[bin];
+	if (pupilBounds.pMin.x > pupilBounds.pMax.x) {
+		*boundsArea = 0.f;
+		return Point(0.f, 0.f, rearZ);
+	}
+	float sinTheta = (rFilm != 0.f) ? filmY / rFilm : 0.f;
+	float cosTheta = (rFilm != 0.f) ? filmX / rFilm : 1.f;
+	if (!irisBounds.empty() && irisBounds[bin].area > 0.f) {
+		// Sample the iris polygon around the pupil directly, so that no
+		// samples fall between its blades and the rectangle's corners
+		const IrisPupilBound &b = irisBounds[bin];
+		float dx, dy;
+		prescription.iris.SamplePolygon(u1, u2, &dx, &dy);
+		Point pRear(b.centerScale * filmX + b.radius * dx,
+		            b.centerScale * filmY + b.radius * dy, rearZ);
+		*boundsArea = b.area;
+		if (pupilX) *pupilX = cosTheta * pRear.x + sinTheta * pRear.y;
+		if (pupilY) *pupilY = cosTheta * pRear.y - sinTheta * pRear.x;
+		return pRear;
+	}
+	*boundsArea = (pupilBounds.pMax.x - pupilBounds.pMin.x) *
+	              (pupilBounds.pMax.y - pupilBounds.pMin.y);
+	// Generate sample point inside exit pupil bound
+	float px = Lerp(u1, pupilBounds.pMin.x, pupilBounds.pMax.x);
+	float py = Lerp(u2, pupilBounds.pMin.y, pupilBounds.pMax.y);
+	if (pupilX) *pupilX = px;
+	if (pupilY) *pupilY = py;
+	// Rotate sample point by angle of film point to $+x$ axis
+	return RotateToFilmAngle(px, py, cosTheta, sinTheta);
+}
+void RealisticCamera::BoundIrisPupils() {
+	// Trace a grid over each bin's rectangle from film points spread over
+	// one blade sector, and fit a polygon of the iris's orientation
+	// around the rays that pass
+	const LensIris &iris = prescription.iris;
+	const int nFilm = 4, nAngle = 4, nGrid = 32;
+	int nBins = int(exitPupilBounds.size()), nUsed = 0;
+	vector<float> passX, passY, passFilmX, passFilmY;
+	irisBounds.resize(nBins);
+	for (int bin = 0; bin < nBins; ++bin) {
+		IrisPupilBound &b = irisBounds[bin];
+		b.centerScale = b.radius = b.area = 0.f;
+		const BBox &bounds = exitPupilBounds[bin];
+		if (bounds.pMin.x > bounds.pMax.x) continue;
+		float cellX = (bounds.pMax.x - bounds.pMin.x) / nGrid;
+		float cellY = (bounds.pMax.y - bounds.pMin.y) / nGrid;
+		passX.clear(); passY.clear(); passFilmX.clear(); passFilmY.clear();
+		float centerSum = 0.f, filmRSum = 0.f;
+		for (int f = 0; f < nFilm * nAngle; ++f) {
+			float filmR = (bin + (f % nFilm + .5f) / nFilm) / nBins *
+				filmRadius;
+			float theta = (f / nFilm + .5f) / nAngle * 2.f * M_PI /
+				iris.blades;
+			float cosTheta = cosf(theta), sinTheta = sinf(theta);
+			Point pFilm(cosTheta * filmR, sinTheta * filmR, filmZ);
+			for (int j = 0; j < nGrid; ++j)
+				for (int i = 0; i < nGrid; ++i) {
+					float px = bounds.pMin.x + (i + .5f) * cellX;
+					Point pRear = RotateToFilmAngle(px,
+						bounds.pMin.y + (j + .5f) * cellY, cosTheta, sinTheta);
+					Ray rFilm(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY);
+					Ray rOut;
+					if (!TraceLensesFromFilm(rFilm, &rOut)) continue;
+					passX.push_back(pRear.x);
+					passY.push_back(pRear.y);
+					passFilmX.push_back(pFilm.x);
+					passFilmY.push_back(pFilm.y);
+					centerSum += px;
+					filmRSum += filmR;
+				}
+		}
+		if (passX.empty()) continue;
+		// Grow the polygon by half a grid cell diagonal, the furthest the
+		// pupil's edge may lie beyond the passing cell centers
+		b.centerScale = centerSum / filmRSum;
+		for (u_int k = 0; k < passX.size(); ++k)
+			b.radius = max(b.radius, iris.PolygonNorm(
+				passX[k] - b.centerScale * passFilmX[k],
+				passY[k] - b.centerScale * passFilmY[k]));
+		b.radius += .5f * sqrtf(cellX * cellX + cellY * cellY) /
+			cosf(M_PI / iris.blades);
+		float area = b.radius * b.radius * iris.PolygonArea();
+		if (area < cellX * cellY * nGrid * nGrid) {
+			b.area = area;
+			++nUsed;
+		}
+	}
+	Info("Sampling iris-shaped exit pupils for %d of %d film radius bins",
+		nUsed, nBins);
+	if (nUsed == 0) irisBounds.clear();
+}
+bool RealisticCamera::ComputeThickLens() {
+	// Trace rays parallel to the axis from each side; the exit ray crosses
+	// the axis at the focal point and reaches its entry height at the
+	// principal plane
+	float x = .001f * rearRadius;
+	Ray rScene(Point(x, 0.f, frontZ + 1.f), Vector(0.f, 0.f, -1.f));
+	Ray rFilm(Point(x, 0.f, rearZ - 1.f), Vector(0.f, 0.f, 1.f));
+	Ray rSceneOut, rFilmOut;
+	if (!prescription.TraceFromScene(rScene, &rSceneOut) ||
+		!prescription.TraceFromFilm(rFilm, &rFilmOut) ||
+		rSceneOut.d.x == 0.f || rFilmOut.d.x == 0.f)
+		return false;
+	float tFocus = -rSceneOut.o.x / rSceneOut.d.x;
+	float tRear = (x - rSceneOut.o.x) / rSceneOut.d.x;
+	float tFront = (x - rFilmOut.o.x) / rFilmOut.d.x;
+	thickRearZ = rSceneOut.o.z + tRear * rSceneOut.d.z;
+	thickFrontZ = rFilmOut.o.z + tFront * rFilmOut.d.z;
+	thickFocalLength = thickRearZ - (rSceneOut.o.z + tFocus * rSceneOut.d.z);
+	return thickFocalLength > 0.f;
+}
+void RealisticCamera::CalibrateThickLens(float tolerance) {
+	// Compare thick lens and exact rays on a grid of rear plane points for
+	// several film radii in each exit pupil bin
+	const int nFilm = 4, nGrid = 32;
+	const LensIris &iris = prescription.iris;
+	float pixelSize = filmWidth / film->xResolution;
+	int nBins = int(exitPupilBounds.size()), nThick = 0, nCentral = 0;
+	vector<char> passed(nFilm * nGrid * nGrid);
+	vector<Ray> exact(nFilm * nGrid * nGrid);
+	thickRegions.resize(nBins);
+	for (int bin = 0; bin < nBins; ++bin) {
+		ThickLensRegion &region = thickRegions[bin];
+		region.useThick = false;
+		region.centerScale = region.pupilRadius = 0.f;
+		region.maxError = INFINITY;
+		const BBox &bounds = exitPupilBounds[bin];
+		if (bounds.pMin.x > bounds.pMax.x) continue;
+		float cellX = (bounds.pMax.x - bounds.pMin.x) / nGrid;
+		float cellY = (bounds.pMax.y - bounds.pMin.y) / nGrid;
+		// Trace exactly and fit a disk, or the iris shape, to the rays
+		// that pass; with blades, film points spread over a blade sector
+		float filmR[nFilm], cosTheta[nFilm], sinTheta[nFilm];
+		float centerSum = 0.f, filmRSum = 0.f, radiusSum = 0.f;
+		bool blocked = false;
+		for (int f = 0; f < nFilm; ++f) {
+			filmR[f] = (bin + (f + .5f) / nFilm) / nBins * filmRadius;
+			float theta = iris.IsPolygon() ?
+				(f + .5f) / nFilm * 2.f * M_PI / iris.blades : 0.f;
+			cosTheta[f] = cosf(theta);
+			sinTheta[f] = sinf(theta);
+			Point pFilm(cosTheta[f] * filmR[f], sinTheta[f] * filmR[f],
+				filmZ);
+			int nPassed = 0;
+			float xSum = 0.f;
+			for (int j = 0; j < nGrid; ++j)
+				for (int i = 0; i < nGrid; ++i) {
+					int index = (f * nGrid + j) * nGrid + i;
+					float px = bounds.pMin.x + (i + .5f) * cellX;
+					Point pRear = RotateToFilmAngle(px,
+						bounds.pMin.y + (j + .5f) * cellY,
+						cosTheta[f], sinTheta[f]);
+					Ray rFilm(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY);
+					passed[index] = TraceLensesFromFilm(rFilm, &exact[index]);
+					if (!passed[index]) continue;
+					++nPassed;
+					xSum += px;
+				}
+			if (nPassed == 0) {
+				blocked = true;
+				break;
+			}
+			centerSum += xSum / nPassed;
+			filmRSum += filmR[f];
+			radiusSum += sqrtf(nPassed * cellX * cellY / iris.area);
+		}
+		if (blocked) continue;
+		region.centerScale = centerSum / filmRSum;
+		region.pupilRadius = radiusSum / nFilm;
+		// Count vignetting mismatches away from the disk rim, where the
+		// grid cannot resolve the boundary, and measure ray errors
+		float band = .5f * sqrtf(cellX * cellX + cellY * cellY);
+		int nPassed = 0, nMismatch = 0;
+		float maxError = 0.f;
+		for (int f = 0; f < nFilm; ++f) {
+			Point pFilm(cosTheta[f] * filmR[f], sinTheta[f] * filmR[f],
+				filmZ);
+			float cx = region.centerScale * pFilm.x;
+			float cy = region.centerScale * pFilm.y;
+			for (int j = 0; j < nGrid; ++j)
+				for (int i = 0; i < nGrid; ++i) {
+					int index = (f * nGrid + j) * nGrid + i;
+					Point pRear = RotateToFilmAngle(
+						bounds.pMin.x + (i + .5f) * cellX,
+						bounds.pMin.y + (j + .5f) * cellY,
+						cosTheta[f], sinTheta[f]);
+					float dist = iris.Norm(pRear.x - cx, pRear.y - cy);
+					bool inDisk = dist <= region.pupilRadius;
+					if (passed[index]) ++nPassed;
+					if (inDisk != bool(passed[index]) &&
+						fabsf(dist - region.pupilRadius) > band)
+						++nMismatch;
+					if (!inDisk || !passed[index]) continue;
+					Ray rThick;
+					TraceThickLens(pFilm, pRear, &rThick, NULL);
+					maxError = max(maxError,
+						ThickLensError(rThick, exact[index]) / pixelSize);
+				}
+		}
+		region.maxError = maxError;
+		region.useThick = maxError <= tolerance &&
+			nMismatch <= THICK_LENS_MAX_MISMATCH * nPassed;
+		if (region.useThick) {
+			++nThick;
+			if (nCentral == bin) ++nCentral;
+		}
+	}
+	Info("Thick lens approximation within %g pixels for %d of %d film "
+		"radius bins, continuously out to %.0f%% of the film radius",
+		tolerance, nThick, nBins, 100.f * nCentral / nBins);
+	if (nThick == 0) thickRegions.clear();
+}
+void RealisticCamera::TraceThickLens(const Point &pFilm,
+		const Point &pRear, Ray *rOut, LensRayDerivatives *deriv) const {
+	// Carry film ray to the rear principal plane, then leave the front
+	// principal plane at the same height with its slope bent by the
+	// focal length
+	float invDz = 1.f / (pRear.z - pFilm.z);
+	float sx = (pRear.x - pFilm.x) * invDz, sy = (pRear.y - pFilm.y) * invDz;
+	float t = thickRearZ - pFilm.z;
+	float hx = pFilm.x + sx * t, hy = pFilm.y + sy * t;
+	float invF = 1.f / thickFocalLength;
+	float ux = sx - hx * invF, uy = sy - hy * invF;
+	float invLength = 1.f / sqrtf(ux * ux + uy * uy + 1.f);
+	rOut->o = Point(hx, hy, thickFrontZ);
+	rOut->d = Vector(ux * invLength, uy * invLength, invLength);
+	if (!deriv) return;
+	// Differentiate for film offsets _dodx_, _dody_ with the rear plane
+	// point held fixed
+	Vector *dod[2] = { &deriv->dodx, &deriv->dody };
+	Vector *ddd[2] = { &deriv->dddx, &deriv->dddy };
+	for (int k = 0; k < 2; ++k) {
+		float dsx = -dod[k]->x * invDz, dsy = -dod[k]->y * invDz;
+		float dhx = dod[k]->x + dsx * t, dhy = dod[k]->y + dsy * t;
+		Vector du(dsx - dhx * invF, dsy - dhy * invF, 0.f);
+		*ddd[k] = invLength * (du - Dot(rOut->d, du) * rOut->d);
+		*dod[k] = Vector(dhx, dhy, 0.f);
+	}
+}
+float RealisticCamera::ThickLensError(const Ray &rThick,
+		const Ray &rExact) const {
+	// Film distance between the rays' images: their separation on the
+	// plane conjugate to the film, scaled by the magnification, which
+	// becomes their slope difference when that plane is at infinity
+	float si = thickRearZ - filmZ;
+	float invSo = 1.f / thickFocalLength - 1.f / si;
+	float tThick = (thickFrontZ - rThick.o.z) / rThick.d.z;
+	float tExact = (thickFrontZ - rExact.o.z) / rExact.d.z;
+	float dx = (rThick.o.x + tThick * rThick.d.x) -
+		(rExact.o.x + tExact * rExact.d.x);
+	float dy = (rThick.o.y + tThick * rThick.d.y) -
+		(rExact.o.y + tExact * rExact.d.y);
+	float dsx = rThick.d.x / rThick.d.z - rExact.d.x / rExact.d.z;
+	float dsy = rThick.d.y / rThick.d.z - rExact.d.y / rExact.d.z;
+	float ex = dx * invSo + dsx, ey = dy * invSo + dsy;
+	return si * sqrtf(ex * ex + ey * ey);
+}
+// Lens Polynomial Utility Functions
+static void LensPolyTerms(int degree, bool oddInY,
+		vector<LensPolyTerm> *terms) {
+	// Keep only terms with the mirror symmetries of a rotationally
+	// symmetric lens: outputs along $x$ are odd in film radius and pupil
+	// $x$ and even in pupil $y$; outputs along $y$ are the reverse
+	terms->clear();
+	for (int i = 0; i <= degree; ++i)
+		for (int j = 0; i + j <= degree; ++j)
+			for (int k = 0; i + j + k <= degree; ++k) {
+				if ((k & 1) != (oddInY ? 1 : 0)) continue;
+				if (((i + j) & 1) != (oddInY ? 0 : 1)) continue;
+				LensPolyTerm t = { u_char(i), u_char(j), u_char(k) };
+				terms->push_back(t);
+			}
+}
+static void LensPolyMonomials(const LensPolynomial &poly, float a, float b,
+		float c, float m[2][LENS_POLY_MAX_TERMS]) {
+	// Compute monomials of normalized inputs shared by all outputs
+	float pa[LENS_POLY_MAX_DEGREE+1], pb[LENS_POLY_MAX_DEGREE+1];
+	float pc[LENS_POLY_MAX_DEGREE+1];
+	pa[0] = pb[0] = pc[0] = 1.f;
+	for (int d = 1; d <= poly.degree; ++d) {
+		pa[d] = pa[d-1] * a;
+		pb[d] = pb[d-1] * b;
+		pc[d] = pc[d-1] * c;
+	}
+	for (int parity = 0; parity < 2; ++parity) {
+		const vector<LensPolyTerm> &terms = poly.terms[parity];
+		for (u_int t = 0; t < terms.size(); ++t)
+			m[parity][t] = pa[terms[t].i] * pb[terms[t].j] * pc[terms[t].k];
+	}
+}
+static inline float EvaluateLensPolyOutput(const LensPolynomial &poly,
+		int output, const float m[2][LENS_POLY_MAX_TERMS]) {
+	// Accumulate four partial sums to hide floating-point add latency
+	const vector<float> &coeffs = poly.coeffs[output];
+	const float *mp = m[output & 1];
+	int nTerms = int(coeffs.size()), t = 0;
+	float sum0 = 0.f, sum1 = 0.f, sum2 = 0.f, sum3 = 0.f;
+	for (; t + 3 < nTerms; t += 4) {
+		sum0 += coeffs[t] * mp[t];
+		sum1 += coeffs[t+1] * mp[t+1];
+		sum2 += coeffs[t+2] * mp[t+2];
+		sum3 += coeffs[t+3] * mp[t+3];
+	}
+	for (; t < nTerms; ++t)
+		sum0 += coeffs[t] * mp[t];
+	return (sum0 + sum1) + (sum2 + sum3);
+}
+static bool SolveNormalEquations(vector<double> &A, vector<double> &b,
+		int n) {
+	// Gaussian elimination with partial pivoting, in place
+	for (int c = 0; c < n; ++c) {
+		int pivot = c;
+		for (int r = c + 1; r < n; ++r)
+			if (fabs(A[r*n+c]) > fabs(A[pivot*n+c])) pivot = r;
+		if (A[pivot*n+c] == 0.) return false;
+		if (pivot != c) {
+			for (int k = 0; k < n; ++k) swap(A[c*n+k], A[pivot*n+k]);
+			swap(b[c], b[pivot]);
+		}
+		for (int r = c + 1; r < n; ++r) {
+			double f = A[r*n+c] / A[c*n+c];
+			for (int k = c; k < n; ++k) A[r*n+k] -= f * A[c*n+k];
+			b[r] -= f * b[c];
+		}
+	}
+	for (int c = n - 1; c >= 0; --c) {
+		for (int k = c + 1; k < n; ++k) b[c] -= A[c*n+k] * b[k];
+		b[c] /= A[c*n+c];
+	}
+	return true;
+}
+bool RealisticCamera::SamplePupilForFit(int index, float *r, float *px,
+		float *py) const {
+	// Place deterministic low-discrepancy sample inside exit pupil bounds
+	*r = float(RadicalInverse(index, 2)) * filmRadius;
+	int bin = min(Floor2Int(*r / filmRadius * exitPupilBounds.size()),
+		int(exitPupilBounds.size()) - 1);
+	const BBox &pupilBounds = exitPupilBounds[bin];
+	if (pupilBounds.pMin.x > pupilBounds.pMax.x) return false;
+	*px = Lerp(float(RadicalInverse(index, 3)),
+		pupilBounds.pMin.x, pupilBounds.pMax.x);
+	*py = Lerp(float(RadicalInverse(index, 5)),
+		pupilBounds.pMin.y, pupilBounds.pMax.y);
+	return true;
+}
+bool RealisticCamera::ExactLensOutputs(float r, float px, float py,
+		float out[LENS_POLY_RAY_OUTPUTS], Point *pHits) const {
+	// Trace film point on $+x$ axis exactly and record polynomial outputs
+	Point pFilm(r, 0.f, filmZ), pRear(px, py, rearZ);
+	Ray rFilm(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY), rLens;
+	if (!TraceLensesFromFilm(rFilm, &rLens, pHits)) return false;
+	Vector d = Normalize(rLens.d);
+	float t = (frontZ - rLens.o.z) / d.z;
+	out[0] = rLens.o.x + t * d.x;
+	out[1] = rLens.o.y + t * d.y;
+	out[2] = d.x;
+	out[3] = d.y;
+	return true;
+}
+bool RealisticCamera::EvaluateLensPolynomial(const LensPolynomial &poly,
+		float r, float px, float py, float out[LENS_POLY_RAY_OUTPUTS]) const {
+	float m[2][LENS_POLY_MAX_TERMS];
+	LensPolyMonomials(poly, r / filmRadius, px / pupilExtent,
+		py / pupilExtent, m);
+	// Apply vignetting by interface rims before computing exit ray
+	for (u_int c = 0; c < poly.clipInterfaces.size(); ++c) {
+		int o = LENS_POLY_RAY_OUTPUTS + 2 * c;
+		float x = EvaluateLensPolyOutput(poly, o, m);
+		float y = EvaluateLensPolyOutput(poly, o + 1, m);
+		float halfAper = lenses[poly.clipInterfaces[c]].aperture * .5f;
+		if (x * x + y * y > halfAper * halfAper) return false;
+	}
+	for (int o = 0; o < LENS_POLY_RAY_OUTPUTS; ++o)
+		out[o] = EvaluateLensPolyOutput(poly, o, m);
+	return out[2] * out[2] + out[3] * out[3] < 1.f;
+}
+bool RealisticCamera::FitLensPolynomial(int degree,
+		LensPolynomial *poly) const {
+	// Trace training rays through the exact lens system
+	const int nTrain = 32768;
+	int nLenses = int(lenses.size());
+	int nOutputs = LENS_POLY_RAY_OUTPUTS + 2 * nLenses;
+	vector<float> inputs, outputs;
+	vector<char> passed;
+	vector<Point> pHits(nLenses);
+	for (int i = 0; i < nTrain; ++i) {
+		float r, px, py, out[LENS_POLY_RAY_OUTPUTS];
+		if (!SamplePupilForFit(i, &r, &px, &py)) continue;
+		inputs.push_back(r / filmRadius);
+		inputs.push_back(px / pupilExtent);
+		inputs.push_back(py / pupilExtent);
+		passed.push_back(ExactLensOutputs(r, px, py, out, &pHits[0]));
+		outputs.insert(outputs.end(), out, out + LENS_POLY_RAY_OUTPUTS);
+		for (int l = 0; l < nLenses; ++l) {
+			outputs.push_back(pHits[l].x);
+			outputs.push_back(pHits[l].y);
+		}
+	}
+	int nSamples = int(passed.size());
+	LensPolynomial full;
+	full.degree = degree;
+	full.coeffs.resize(nOutputs);
+	for (int parity = 0; parity < 2; ++parity)
+		LensPolyTerms(degree, parity == 1, &full.terms[parity]);
+	// Accumulate normal equations shared by outputs of each parity
+	int nRays = 0;
+	vector<double> AtA[2], Atb[2];
+	for (int parity = 0; parity < 2; ++parity) {
+		int n = int(full.terms[parity].size());
+		AtA[parity].assign(n * n, 0.);
+		Atb[parity].assign(nOutputs / 2 * n, 0.);
+	}
+	for (int s = 0; s < nSamples; ++s) {
+		if (!passed[s]) continue;
+		++nRays;
+		float m[2][LENS_POLY_MAX_TERMS];
+		LensPolyMonomials(full, inputs[3*s], inputs[3*s+1], inputs[3*s+2], m);
+		for (int parity = 0; parity < 2; ++parity) {
+			int n = int(full.terms[parity].size());
+			const float *mp = m[parity];
+			const float *out = &outputs[nOutputs * s + parity];
+			for (int r = 0; r < n; ++r) {
+				double *row = &AtA[parity][r*n];
+				for (int c = r; c < n; ++c)
+					row[c] += double(mp[r]) * double(mp[c]);
+				for (int o = 0; o < nOutputs / 2; ++o)
+					Atb[parity][o*n+r] += double(mp[r]) * double(out[2*o]);
+			}
+		}
+	}
+	// Solve for the coefficients of each output
+	for (int parity = 0; parity < 2; ++parity) {
+		int n = int(full.terms[parity].size());
+		if (nRays < 4 * n) return false;
+		for (int r = 0; r < n; ++r)
+			for (int c = 0; c < r; ++c)
+				AtA[parity][r*n+c] = AtA[parity][c*n+r];
+		for (int o = 0; o < nOutputs / 2; ++o) {
+			vector<double> A = AtA[parity];
+			vector<double> b(Atb[parity].begin() + o * n,
+				Atb[parity].begin() + (o + 1) * n);
+			if (!SolveNormalEquations(A, b, n)) return false;
+			vector<float> &coeffs = full.coeffs[2 * o + parity];
+			coeffs.resize(n);
+			for (int t = 0; t < n; ++t)
+				coeffs[t] = float(b[t]);
+		}
+	}
+	// Find which interface rims vignette each training sample
+	vector<char> clips(nSamples * nLenses);
+	vector<int> nClipping(nSamples, 0), nClipped(nLenses, 0);
+	for (int s = 0; s < nSamples; ++s) {
+		float m[2][LENS_POLY_MAX_TERMS];
+		LensPolyMonomials(full, inputs[3*s], inputs[3*s+1], inputs[3*s+2], m);
+		for (int l = 0; l < nLenses; ++l) {
+			int o = LENS_POLY_RAY_OUTPUTS + 2 * l;
+			float x = EvaluateLensPolyOutput(full, o, m);
+			float y = EvaluateLensPolyOutput(full, o + 1, m);
+			float halfAper = lenses[l].aperture * .5f;
+			clips[s*nLenses+l] = (x * x + y * y > halfAper * halfAper);
+			nClipping[s] += clips[s*nLenses+l];
+			nClipped[l] += clips[s*nLenses+l];
+		}
+	}
+	// Drop rims whose vignetting is always covered by another rim
+	vector<std::pair<int, int> > order;
+	for (int l = 0; l < nLenses; ++l)
+		order.push_back(std::make_pair(nClipped[l], l));
+	sort(order.begin(), order.end());
+	vector<char> keep(nLenses, 1);
+	for (int i = 0; i < nLenses; ++i) {
+		int l = order[i].second;
+		bool redundant = true;
+		for (int s = 0; s < nSamples && redundant; ++s)
+			if (clips[s*nLenses+l] && nClipping[s] == 1) redundant = false;
+		if (!redundant) continue;
+		keep[l] = 0;
+		for (int s = 0; s < nSamples; ++s)
+			nClipping[s] -= clips[s*nLenses+l];
+	}
+	// Copy exit ray and kept rim outputs into _poly_
+	poly->degree = degree;
+	poly->terms[0] = full.terms[0];
+	poly->terms[1] = full.terms[1];
+	poly->clipInterfaces.clear();
+	poly->coeffs.assign(full.coeffs.begin(),
+		full.coeffs.begin() + LENS_POLY_RAY_OUTPUTS);
+	for (int l = 0; l < nLenses; ++l) {
+		if (!keep[l]) continue;
+		int o = LENS_POLY_RAY_OUTPUTS + 2 * l;
+		poly->clipInterfaces.push_back(l);
+		poly->coeffs.push_back(full.coeffs[o]);
+		poly->coeffs.push_back(full.coeffs[o + 1]);
+	}
+	return true;
+}
+bool RealisticCamera::ValidateLensPolynomial(const LensPolynomial &poly,
+		float tolerance, float *posError, float *dirError,
+		float *mismatch) const {
+	// Compare polynomial against exact tracer on held-out rays
+	const int nValidate = 4096, firstIndex = 65536;
+	double pos2 = 0., dir2 = 0.;
+	int nTotal = 0, nBoth = 0, nMismatch = 0;
+	for (int i = 0; i < nValidate; ++i) {
+		float r, px, py;
+		float exact[LENS_POLY_RAY_OUTPUTS], approx[LENS_POLY_RAY_OUTPUTS];
+		if (!SamplePupilForFit(firstIndex + i, &r, &px, &py)) continue;
+		++nTotal;
+		bool exactHit = ExactLensOutputs(r, px, py, exact);
+		bool approxHit = EvaluateLensPolynomial(poly, r, px, py, approx);
+		if (exactHit != approxHit) ++nMismatch;
+		if (!exactHit || !approxHit) continue;
+		++nBoth;
+		pos2 += (exact[0] - approx[0]) * (exact[0] - approx[0]) +
+		        (exact[1] - approx[1]) * (exact[1] - approx[1]);
+		dir2 += (exact[2] - approx[2]) * (exact[2] - approx[2]) +
+		        (exact[3] - approx[3]) * (exact[3] - approx[3]);
+	}
+	if (nBoth == 0) return false;
+	*posError = float(sqrt(pos2 / nBoth));
+	*dirError = float(sqrt(dir2 / nBoth));
+	*mismatch = float(nMismatch) / float(nTotal);
+	return *posError <= tolerance && *dirError <= tolerance &&
+		*mismatch <= LENS_POLY_MAX_MISMATCH;
+}
+bool RealisticCamera::ReadLensPolynomial(const string &filename,
+		LensPolynomial *poly) const {
+	FILE *f = fopen(filename.c_str(), "r");
+	if (!f) return false;
+	// Check that polynomial was fit for this lens configuration
+	int version, nLenses, nClip;
+	float fz, fr, pe;
+	bool ok = (fscanf(f, "lenspolynomial %d %d %f %f %f %d %d", &version,
+		&nLenses, &fz, &fr, &pe, &poly->degree, &nClip) == 7) &&
+		version == 1 && nLenses == int(lenses.size()) &&
+		fabsf(fz - filmZ) < 1e-4f && fabsf(fr - filmRadius) < 1e-4f &&
+		fabsf(pe - pupilExtent) < 1e-4f &&
+		poly->degree >= 1 && poly->degree <= LENS_POLY_MAX_DEGREE &&
+		nClip >= 0 && nClip <= nLenses;
+	poly->clipInterfaces.resize(ok ? nClip : 0);
+	for (int c = 0; ok && c < nClip; ++c)
+		ok = fscanf(f, "%d", &poly->clipInterfaces[c]) == 1 &&
+			poly->clipInterfaces[c] >= 0 && poly->clipInterfaces[c] < nLenses;
+	for (int parity = 0; ok && parity < 2; ++parity) {
+		int nTerms;
+		ok = fscanf(f, "%d", &nTerms) == 1 && nTerms > 0 &&
+			nTerms <= LENS_POLY_MAX_TERMS;
+		poly->terms[parity].resize(ok ? nTerms : 0);
+		for (int t = 0; ok && t < nTerms; ++t) {
+			int i, j, k;
+			ok = fscanf(f, "%d %d %d", &i, &j, &k) == 3 &&
+				min(i, min(j, k)) >= 0 && i + j + k <= poly->degree;
+			LensPolyTerm term = { u_char(i), u_char(j), u_char(k) };
+			poly->terms[parity][t] = term;
+		}
+	}
+	int nOutputs = ok ? LENS_POLY_RAY_OUTPUTS + 2 * nClip : 0;
+	poly->coeffs.resize(nOutputs);
+	for (int o = 0; ok && o < nOutputs; ++o) {
+		poly->coeffs[o].resize(poly->terms[o & 1].size());
+		for (u_int t = 0; ok && t < poly->coeffs[o].size(); ++t)
+			ok = fscanf(f, "%f", &poly->coeffs[o][t]) == 1;
+	}
+	fclose(f);
+	if (!ok)
+		Info("Lens polynomial \"%s\" does not match camera; refitting",
+			filename.c_str());
+	return ok;
+}
+void RealisticCamera::WriteLensPolynomial(const string &filename,
+		const LensPolynomial &poly) const {
+	FILE *f = fopen(filename.c_str(), "w");
+	if (!f) {
+		Error("Unable to write lens polynomial \"%s\"", filename.c_str());
+		return;
+	}
+	fprintf(f, "lenspolynomial 1 %d %.9g %.9g %.9g %d %d\n",
+		int(lenses.size()), filmZ, filmRadius, pupilExtent, poly.degree,
+		int(poly.clipInterfaces.size()));
+	for (u_int c = 0; c < poly.clipInterfaces.size(); ++c)
+		fprintf(f, "%d ", poly.clipInterfaces[c]);
+	fprintf(f, "\n");
+	for (int parity = 0; parity < 2; ++parity) {
+		fprintf(f, "%d\n", int(poly.terms[parity].size()));
+		for (u_int t = 0; t < poly.terms[parity].size(); ++t)
+			fprintf(f, "%d %d %d\n", poly.terms[parity][t].i,
+				poly.terms[parity][t].j, poly.terms[parity][t].k);
+	}
+	for (u_int o = 0; o < poly.coeffs.size(); ++o) {
+		for (u_int t = 0; t < poly.coeffs[o].size(); ++t)
+			fprintf(f, "%.9g ", poly.coeffs[o][t]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+bool RealisticCamera::TraceLensPolynomial(float filmX, float filmY,
+		float px, float py, Ray *rOut) const {
+	// Evaluate polynomial for film point rotated onto $+x$ axis
+	float rFilm = sqrtf(filmX * filmX + filmY * filmY);
+	float out[LENS_POLY_RAY_OUTPUTS];
+	if (!EvaluateLensPolynomial(lensPoly, rFilm, px, py, out))
+		return false;
+	RotateLensRay(filmX, filmY, out, rOut);
+	return true;
+}
+void RealisticCamera::RotateLensRay(float filmX, float filmY,
+		const float out[LENS_POLY_RAY_OUTPUTS], Ray *rOut) const {
+	// Rotate outgoing ray back to film point's angle
+	float rFilm = sqrtf(filmX * filmX + filmY * filmY);
+	float sinTheta = (rFilm != 0.f) ? filmY / rFilm : 0.f;
+	float cosTheta = (rFilm != 0.f) ? filmX / rFilm : 1.f;
+	float dz = sqrtf(1.f - out[2] * out[2] - out[3] * out[3]);
+	rOut->o = Point(cosTheta * out[0] - sinTheta * out[1],
+	                sinTheta * out[0] + cosTheta * out[1], frontZ);
+	rOut->d = Vector(cosTheta * out[2] - sinTheta * out[3],
+	                 sinTheta * out[2] + cosTheta * out[3], dz);
+}
+// MappedFile Method Definitions
+MappedFile::MappedFile() {
+#ifdef WIN32
+	file = mapping = NULL;
+#endif
+	data = NULL;
+	size = 0;
+}
+MappedFile::~MappedFile() {
+#ifdef WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file && file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+	if (data) munmap(data, size);
+#endif
+}
+bool MappedFile::Map(const string &filename) {
+#ifdef WIN32
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	size = GetFileSize(file, NULL);
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) return false;
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	return data != NULL;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return false;
+	data = ptr;
+	size = st.st_size;
+	return true;
+#endif
+}
+u_int RealisticCamera::HashLensSystem() const {
+	// Hash the placed lens prescription
+	u_int hash = 2166136261u;
+	for (u_int i = 0; i < lenses.size(); ++i) {
+		float data[5] = { lenses[i].radius, lenses[i].zpos, lenses[i].eta,
+			lenses[i].aperture, lenses[i].isStop ? 1.f : 0.f };
+		hash = HashBytes(data, sizeof(data), hash);
+		if (lenses[i].aspheric) {
+			hash = HashBytes(&lenses[i].conic, sizeof(float), hash);
+			hash = HashBytes(lenses[i].asphere, sizeof(lenses[i].asphere),
+				hash);
+		}
+	}
+	return hash;
+}
+void RealisticCamera::InitLensFieldHeader(int res,
+		LensFieldHeader *header) const {
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, "PBRTLF1", 8);
+	// Hash lens prescription, focus state and table resolution
+	u_int hash = HashLensSystem();
+	float focus[2] = { filmZ, filmRadius };
+	hash = HashBytes(focus, sizeof(focus), hash);
+	hash = HashBytes(&res, sizeof(res), hash);
+	header->lensHash = hash;
+	header->nLenses = int(lenses.size());
+	header->nr = header->nx = header->ny = res;
+	header->filmZ = filmZ;
+	header->filmRadius = filmRadius;
+	// Cover the union of the exit pupil bounds
+	BBox pupilDomain;
+	for (u_int i = 0; i < exitPupilBounds.size(); ++i)
+		if (exitPupilBounds[i].pMin.x <= exitPupilBounds[i].pMax.x)
+			pupilDomain = Union(pupilDomain, exitPupilBounds[i]);
+	if (pupilDomain.pMin.x > pupilDomain.pMax.x)
+		pupilDomain = BBox(Point(-rearRadius, -rearRadius, rearZ),
+			Point(rearRadius, rearRadius, rearZ));
+	header->pupilMinX = pupilDomain.pMin.x;
+	header->pupilMinY = pupilDomain.pMin.y;
+	header->pupilMaxX = pupilDomain.pMax.x;
+	header->pupilMaxY = pupilDomain.pMax.y;
+}
+void RealisticCamera::BuildLensField(const LensFieldHeader &header,
+		vector<LensFieldEntry> *entries) const {
+	int nEntries = header.nr * header.ny * header.nx;
+	entries->resize(nEntries);
+	// Trace table rays in packets through the exact lens system
+	for (int base = 0; base < nEntries; base += LENS_PACKET_SIZE) {
+		LensRayPacket rIn, rOut;
+		int activeMask = 0;
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			int index = min(base + lane, nEntries - 1);
+			int ix = index % header.nx, iy = (index / header.nx) % header.ny;
+			int ir = index / (header.nx * header.ny);
+			Point pFilm(float(ir) / (header.nr - 1) * header.filmRadius,
+				0.f, filmZ);
+			Point pRear(Lerp(float(ix) / (header.nx - 1),
+			                 header.pupilMinX, header.pupilMaxX),
+			            Lerp(float(iy) / (header.ny - 1),
+			                 header.pupilMinY, header.pupilMaxY), rearZ);
+			Vector d = Normalize(pRear - pFilm);
+			rIn.ox[lane] = pFilm.x; rIn.oy[lane] = pFilm.y;
+			rIn.oz[lane] = pFilm.z;
+			rIn.dx[lane] = d.x; rIn.dy[lane] = d.y; rIn.dz[lane] = d.z;
+			if (base + lane < nEntries) activeMask |= (1 << lane);
+		}
+		int passMask = TraceLensesFromFilm(rIn, &rOut, activeMask);
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			if (!(activeMask & (1 << lane))) continue;
+			LensFieldEntry &e = (*entries)[base + lane];
+			if (!(passMask & (1 << lane))) {
+				e.ox = e.oy = e.dy = 0.f;
+				e.dx = LENS_FIELD_BLOCKED;
+				continue;
+			}
+			// Record exit ray where it crosses the front vertex plane
+			Vector d = Normalize(Vector(rOut.dx[lane], rOut.dy[lane],
+				rOut.dz[lane]));
+			float t = (frontZ - rOut.oz[lane]) / d.z;
+			e.ox = rOut.ox[lane] + t * d.x;
+			e.oy = rOut.oy[lane] + t * d.y;
+			e.dx = d.x;
+			e.dy = d.y;
+		}
+	}
+}
+bool RealisticCamera::MapLensField(const string &filename,
+		const LensFieldHeader &header) {
+	// Map cache file and check that it matches this camera
+	MappedFile *mapped = new MappedFile;
+	size_t nEntries = size_t(header.nr) * header.ny * header.nx;
+	if (!mapped->Map(filename) || mapped->Size() !=
+			sizeof(LensFieldHeader) + nEntries * sizeof(LensFieldEntry) ||
+			memcmp(mapped->Data(), &header, sizeof(LensFieldHeader)) != 0) {
+		delete mapped;
+		return false;
+	}
+	lensFieldFile = mapped;
+	lensField = (const LensFieldEntry *)((const char *)mapped->Data() +
+		sizeof(LensFieldHeader));
+	return true;
+}
+void RealisticCamera::InitLensField(const string &cachedir, int res) {
+	InitLensFieldHeader(res, &lensFieldHeader);
+	char name[64];
+	sprintf(name, "lensfield-%08x.bin", lensFieldHeader.lensHash);
+	string filename = cachedir + "/" + name;
+	if (MapLensField(filename, lensFieldHeader)) {
+		Info("Mapped lens light field \"%s\"", filename.c_str());
+		return;
+	}
+	// Build light field and publish it with an atomic rename
+	BuildLensField(lensFieldHeader, &lensFieldStorage);
+	lensField = &lensFieldStorage[0];
+	if (WriteCacheFile(filename, &lensFieldHeader, sizeof(LensFieldHeader),
+			&lensFieldStorage[0],
+			lensFieldStorage.size() * sizeof(LensFieldEntry)))
+		Info("Wrote lens light field \"%s\"", filename.c_str());
+	else {
+		Warning("Unable to write lens light field \"%s\"; using it for "
+			"this render only", filename.c_str());
+	}
+}
+bool RealisticCamera::TraceLensField(float filmX, float filmY,
+		float px, float py, const Ray &rFilm, Ray *rOut) const {
+	// Find light field cell for film point rotated onto $+x$ axis
+	const LensFieldHeader &h = lensFieldHeader;
+	float r = sqrtf(filmX * filmX + filmY * filmY);
+	float fr = r / h.filmRadius * (h.nr - 1);
+	float fx = (px - h.pupilMinX) / (h.pupilMaxX - h.pupilMinX) * (h.nx - 1);
+	float fy = (py - h.pupilMinY) / (h.pupilMaxY - h.pupilMinY) * (h.ny - 1);
+	int ir = Clamp(Floor2Int(fr), 0, h.nr - 2);
+	int ix = Clamp(Floor2Int(fx), 0, h.nx - 2);
+	int iy = Clamp(Floor2Int(fy), 0, h.ny - 2);
+	float dr = Clamp(fr - ir, 0.f, 1.f), dx = Clamp(fx - ix, 0.f, 1.f);
+	float dy = Clamp(fy - iy, 0.f, 1.f);
+	// Interpolate corner rays if none are blocked
+	float out[LENS_POLY_RAY_OUTPUTS] = { 0.f, 0.f, 0.f, 0.f };
+	int nBlocked = 0;
+	for (int corner = 0; corner < 8; ++corner) {
+		int cr = corner & 1, cy = (corner >> 1) & 1, cx = corner >> 2;
+		const LensFieldEntry &e =
+			lensField[((ir + cr) * h.ny + iy + cy) * h.nx + ix + cx];
+		if (e.dx == LENS_FIELD_BLOCKED) {
+			++nBlocked;
+			continue;
+		}
+		float w = (cr ? dr : 1.f - dr) * (cy ? dy : 1.f - dy) *
+		          (cx ? dx : 1.f - dx);
+		out[0] += w * e.ox;
+		out[1] += w * e.oy;
+		out[2] += w * e.dx;
+		out[3] += w * e.dy;
+	}
+	if (nBlocked == 8) return false;
+	// Trace exactly in cells straddling the vignetting boundary
+	if (nBlocked > 0) return TraceLensesFromFilm(rFilm, rOut);
+	if (out[2] * out[2] + out[3] * out[3] >= 1.f) return false;
+	RotateLensRay(filmX, filmY, out, rOut);
+	return true;
+}
+u_int RealisticCamera::HashRayCache() const {
+	// Hash everything besides the camera sample that shapes lens rays
+	u_int hash = HashLensSystem();
+	float filmData[7] = { filmZ, filmWidth, filmHeight, filmRadius,
+		float(film->xResolution), float(film->yResolution),
+		simpleWeighting ? 1.f : 0.f };
+	hash = HashBytes(filmData, sizeof(filmData), hash);
+	for (u_int i = 0; i < exitPupilBounds.size(); ++i)
+		hash = HashBytes(&exitPupilBounds[i], sizeof(BBox), hash);
+	const LensIris &iris = prescription.iris;
+	if (iris.IsPolygon()) {
+		float shape[3] = { iris.curvature, iris.vx[0], iris.vy[0] };
+		hash = HashBytes(&iris.blades, sizeof(int), hash);
+		hash = HashBytes(shape, sizeof(shape), hash);
+		for (u_int i = 0; i < irisBounds.size(); ++i)
+			hash = HashBytes(&irisBounds[i], sizeof(IrisPupilBound), hash);
+	}
+	for (u_int i = 0; i < thickRegions.size(); ++i) {
+		const ThickLensRegion &region = thickRegions[i];
+		float data[3] = { region.useThick ? 1.f : 0.f, region.centerScale,
+			region.pupilRadius };
+		hash = HashBytes(data, sizeof(data), hash);
+	}
+	return hash;
+}
+static inline u_short PackRayDerivative(float f) {
+	// Round to the upper 16 bits of the float
+	u_int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return u_short((bits + 0x8000u) >> 16);
+}
+static inline float UnpackRayDerivative(u_short h) {
+	u_int bits = u_int(h) << 16;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+static u_int HashCameraSample(const Sample &sample) {
+	float s[4] = { sample.imageX, sample.imageY, sample.lensU, sample.lensV };
+	return HashBytes(s, sizeof(s), 2166136261u);
+}
+bool RealisticCamera::MapRayCache(const string &filename) {
+	// Fill in the header this camera expects
+	LensRayCacheHeader &h = rayCacheHeader;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "PBRTRC2", 8);
+	h.lensHash = HashRayCache();
+	film->GetSampleExtent(&h.xStart, &h.xEnd, &h.yStart, &h.yEnd);
+	int nPixels = (h.xEnd - h.xStart) * (h.yEnd - h.yStart);
+	// Map cache file and check that it matches this camera and film
+	MappedFile *mapped = new MappedFile;
+	if (!mapped->Map(filename) ||
+			mapped->Size() < sizeof(LensRayCacheHeader)) {
+		delete mapped;
+		return false;
+	}
+	const LensRayCacheHeader *fileHeader =
+		(const LensRayCacheHeader *)mapped->Data();
+	if (memcmp(fileHeader, &h, offsetof(LensRayCacheHeader, nEntries)) != 0 ||
+			fileHeader->nEntries < 0 || mapped->Size() !=
+			sizeof(LensRayCacheHeader) + (nPixels + 1) * sizeof(u_int) +
+			size_t(fileHeader->nEntries) * sizeof(LensRayCacheEntry)) {
+		delete mapped;
+		return false;
+	}
+	h.nEntries = fileHeader->nEntries;
+	rayCacheFileMapping = mapped;
+	rayCachePixels = (const u_int *)(fileHeader + 1);
+	rayCache = (const LensRayCacheEntry *)(rayCachePixels + nPixels + 1);
+	return true;
+}
+void RealisticCamera::RecordLensRay(int pixel,
+		const LensRayCacheEntry &e) const {
+	// Buffer the ray in its block, spilling the block once it is full
+	int xRes = rayCacheHeader.xEnd - rayCacheHeader.xStart;
+	int band = pixel / xRes / RAY_CACHE_BLOCK;
+	LensRayCacheBlock *block = rayCacheBlocks[band * rayCacheBlocksX +
+		pixel % xRes / RAY_CACHE_BLOCK];
+	MutexLock lock(block->mutex);
+	LensRayCacheRecord r;
+	r.pixel = pixel;
+	r.entry = e;
+	block->records.push_back(r);
+	++rayCacheCounts[pixel];
+	if (block->records.size() >= RAY_CACHE_SPILL)
+		SpillRayCacheBlock(band, block);
+}
+void RealisticCamera::SpillRayCacheBlock(int band,
+		LensRayCacheBlock *block) const {
+	// Append the block's rays to its row's temporary file
+	if (block->records.empty()) return;
+	MutexLock lock(rayCacheBandMutex);
+	FILE *&f = rayCacheBands[band];
+	if (!f && !rayCacheFailed) {
+		f = fopen(RayCacheBandName(band).c_str(), "w+b");
+		if (!f) {
+			Warning("Unable to open temporary file for lens ray cache "
+				"\"%s\"", rayCacheFile.c_str());
+			rayCacheFailed = true;
+		}
+	}
+	if (f && fwrite(&block->records[0], sizeof(LensRayCacheRecord),
+			block->records.size(), f) != block->records.size())
+		rayCacheFailed = true;
+	block->records.clear();
+}
+string RealisticCamera::RayCacheBandName(int band) const {
+	char name[32];
+	sprintf(name, ".band%d", band);
+	return TempCacheName(rayCacheFile + name);
+}
+static bool SampleHashLess(const LensRayCacheEntry &a,
+		const LensRayCacheEntry &b) {
+	return a.sampleHash < b.sampleHash;
+}
+void RealisticCamera::WriteRayCache(const string &filename) const {
+	// Spill the rays the blocks still hold
+	int nBands = int(rayCacheBands.size());
+	for (u_int i = 0; i < rayCacheBlocks.size(); ++i)
+		SpillRayCacheBlock(i / rayCacheBlocksX, rayCacheBlocks[i]);
+	// Find where each pixel's run of entries starts
+	LensRayCacheHeader h = rayCacheHeader;
+	int xRes = h.xEnd - h.xStart, yRes = h.yEnd - h.yStart;
+	int nPixels = xRes * yRes;
+	vector<u_int> offsets(nPixels + 1, 0);
+	for (int p = 0; p < nPixels; ++p)
+		offsets[p + 1] = offsets[p] + rayCacheCounts[p];
+	h.nEntries = int(offsets[nPixels]);
+	// Assemble the cache one row of blocks at a time
+	string tmpname = TempCacheName(filename);
+	FILE *f = NULL;
+	bool written = !rayCacheFailed && h.nEntries > 0 &&
+		(f = fopen(tmpname.c_str(), "wb")) != NULL &&
+		fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(&offsets[0], sizeof(u_int), nPixels + 1, f) ==
+			u_int(nPixels + 1);
+	vector<LensRayCacheEntry> entries;
+	vector<LensRayCacheRecord> records(RAY_CACHE_SPILL);
+	for (int band = 0; band < nBands; ++band) {
+		FILE *bandFile = rayCacheBands[band];
+		int p0 = band * RAY_CACHE_BLOCK * xRes;
+		int p1 = min(p0 + RAY_CACHE_BLOCK * xRes, nPixels);
+		if (written && bandFile) {
+			// Place the row's rays by pixel, then sort each pixel's run
+			// by sample hash for lookup
+			entries.resize(offsets[p1] - offsets[p0]);
+			vector<u_int> next(offsets.begin() + p0, offsets.begin() + p1);
+			rewind(bandFile);
+			size_t n;
+			while ((n = fread(&records[0], sizeof(LensRayCacheRecord),
+					RAY_CACHE_SPILL, bandFile)) > 0)
+				for (size_t i = 0; i < n; ++i)
+					entries[next[records[i].pixel - p0]++ - offsets[p0]] =
+						records[i].entry;
+			for (int p = p0; p < p1; ++p)
+				sort(entries.begin() + (offsets[p] - offsets[p0]),
+					entries.begin() + (offsets[p + 1] - offsets[p0]),
+					SampleHashLess);
+			written = entries.empty() || fwrite(&entries[0],
+				sizeof(LensRayCacheEntry), entries.size(), f) ==
+				entries.size();
+		}
+		if (bandFile) {
+			fclose(bandFile);
+			remove(RayCacheBandName(band).c_str());
+			rayCacheBands[band] = NULL;
+		}
+	}
+	if (f) written = (fclose(f) == 0) && written;
+	if (h.nEntries == 0) return;
+	if (PublishCacheFile(tmpname, filename, written))
+		Info("Wrote %d lens rays to ray cache \"%s\"", h.nEntries,
+			filename.c_str());
+	else
+		Warning("Unable to write lens ray cache \"%s\"", filename.c_str());
+}
+float RealisticCamera::CachedLensRay(const Sample &sample, Ray *ray,
+		LensRayDerivatives *deriv) const {
+	static StatsPercentage reused("Camera",
+		"Lens rays reused from ray cache"); // NOBOOK
+	// Look for the sample among the entries recorded for its pixel
+	u_int sampleHash = HashCameraSample(sample);
+	int pixel = RayCachePixel(sample.imageX, sample.imageY);
+	float *v = &deriv->dodx.x;
+	if (rayCache) {
+		const LensRayCacheEntry *first = rayCache + rayCachePixels[pixel];
+		const LensRayCacheEntry *last = rayCache + rayCachePixels[pixel + 1];
+		LensRayCacheEntry key;
+		key.sampleHash = sampleHash;
+		const LensRayCacheEntry *e =
+			std::lower_bound(first, last, key, SampleHashLess);
+		if (e != last && e->sampleHash == sampleHash) {
+			reused.Add(1, 1); // NOBOOK
+			*ray = Ray(e->o, e->d);
+			for (int k = 0; k < 12; ++k)
+				v[k] = UnpackRayDerivative(e->deriv[k]);
+			return e->weight;
+		}
+	}
+	reused.Add(0, 1); // NOBOOK
+	// Trace the ray, keeping it if this frame records the cache
+	float rayWeight = GenerateLensRay(sample, ray, deriv);
+	if (recordRayCache) {
+		LensRayCacheEntry e;
+		e.sampleHash = sampleHash;
+		e.weight = rayWeight;
+		for (int k = 0; k < 12; ++k) e.deriv[k] = 0;
+		if (rayWeight > 0.f) {
+			// Round derivatives as every later frame will see them
+			e.o = ray->o;
+			e.d = ray->d;
+			for (int k = 0; k < 12; ++k) {
+				e.deriv[k] = PackRayDerivative(v[k]);
+				v[k] = UnpackRayDerivative(e.deriv[k]);
+			}
+		}
+		RecordLensRay(pixel, e);
+	}
+	return rayWeight;
+}
+bool RealisticCamera::TraceLensesFromFilm(const Ray &rCamera,
+		Ray *rOut, Point *pHits) const {
+	return prescription.TraceFromFilm(rCamera, rOut, pHits);
+}
+int RealisticCamera::TraceLensesFromFilm(const LensRayPacket &rCamera,
+		LensRayPacket *rOut, int activeMask, const float *laneEta,
+		LensDerivativePacket *deriv) const {
+	return prescription.TracePacketFromFilm(rCamera, rOut, activeMask,
+		laneEta, deriv);
+}
+float RealisticCamera::GenerateRay(const Sample &sample,
+		Ray *ray) const {
+	float rayWeight;
+	if (rayCacheFile != "") {
+		LensRayDerivatives deriv;
+		rayWeight = CachedLensRay(sample, ray, &deriv);
+	}
+	else
+		rayWeight = GenerateLensRay(sample, ray, NULL);
+	if (rayWeight > 0.f) CameraRayToWorld(sample, ray);
+	return rayWeight;
+}
+float RealisticCamera::GenerateRayDifferential(const Sample &sample,
+		RayDifferential *ray, Spectrum *channelWeights) const {
+	// Shift the image sample for approximated or dispersive lens rays
+	if (lensField || usePolynomial || dispersive)
+		return Camera::GenerateRayDifferential(sample, ray, channelWeights);
+	*channelWeights = Spectrum(1.f);
+	LensRayDerivatives deriv;
+	float rayWeight = (rayCacheFile != "") ?
+		CachedLensRay(sample, ray, &deriv) :
+		GenerateLensRay(sample, ray, &deriv);
+	if (rayWeight == 0.f) return 0.f;
+	CameraRayToWorld(sample, ray);
+	LensRayDifferentials(deriv, ray);
+	return rayWeight;
+}
+void RealisticCamera::GenerateRayDifferentials(const Sample *const *samples,
+		int nSamples, RayDifferential *rays, Spectrum *channelWeights,
+		float *rayWeights) const {
+	if (!TracesPackets()) {
+		Camera::GenerateRayDifferentials(samples, nSamples, rays,
+			channelWeights, rayWeights);
+		return;
+	}
+	static StatsRatio packetRays("Camera",
+		"Lens rays per camera ray packet"); // NOBOOK
+	for (int base = 0; base < nSamples; base += LENS_PACKET_SIZE) {
+		// Start each lane's film ray and derivatives as _GenerateLensRay()_
+		// does; unused lanes hold a harmless axial ray
+		LensRayPacket packet, packetOut;
+		LensDerivativePacket deriv;
+		Ray rFilm[LENS_PACKET_SIZE];
+		float boundsArea[LENS_PACKET_SIZE];
+		int activeMask = 0, nActive = 0;
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			int i = base + lane;
+			LensRayDerivatives d;
+			rFilm[lane] = Ray(Point(0.f, 0.f, filmZ), Vector(0.f, 0.f, 1.f));
+			if (i < nSamples) {
+				rays[i] = RayDifferential();
+				channelWeights[i] = Spectrum(1.f);
+				rayWeights[i] = 0.f;
+				Point pFilm = FilmPoint(*samples[i]);
+				Point pRear = SampleExitPupil(pFilm.x, pFilm.y,
+					samples[i]->lensU, samples[i]->lensV, &boundsArea[lane]);
+				if (boundsArea[lane] > 0.f) {
+					rFilm[lane] = Ray(pFilm, Normalize(pRear - pFilm), 0.f,
+						INFINITY);
+					FilmRayDerivatives(rFilm[lane], pRear, &d);
+					activeMask |= (1 << lane);
+					++nActive;
+				}
+			}
+			packet.ox[lane] = rFilm[lane].o.x;
+			packet.oy[lane] = rFilm[lane].o.y;
+			packet.oz[lane] = rFilm[lane].o.z;
+			packet.dx[lane] = rFilm[lane].d.x;
+			packet.dy[lane] = rFilm[lane].d.y;
+			packet.dz[lane] = rFilm[lane].d.z;
+			const float *v = &d.dodx.x;
+			for (int k = 0; k < 2; ++k)
+				for (int c = 0; c < 3; ++c) {
+					deriv.dod[k][c][lane] = v[6 * k + c];
+					deriv.ddd[k][c][lane] = v[6 * k + 3 + c];
+				}
+		}
+		if (!activeMask) continue;
+		// Trace the packet through the lens system with its derivatives
+		packetRays.Add(nActive, 1); // NOBOOK
+		int hitMask = TraceLensesFromFilm(packet, &packetOut, activeMask,
+			NULL, &deriv);
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			if (!(activeMask & (1 << lane))) continue;
+			CountBlockedLensRay(!(hitMask & (1 << lane)));
+			if (!(hitMask & (1 << lane))) continue;
+			int i = base + lane;
+			RayDifferential *ray = &rays[i];
+			*ray = RayDifferential(Ray(Point(packetOut.ox[lane],
+				packetOut.oy[lane], packetOut.oz[lane]), Vector(
+				packetOut.dx[lane], packetOut.dy[lane], packetOut.dz[lane])));
+			rayWeights[i] = CameraRayWeight(rFilm[lane], boundsArea[lane],
+				ray);
+			CameraRayToWorld(*samples[i], ray);
+			LensRayDerivatives d;
+			float *v = &d.dodx.x;
+			for (int k = 0; k < 2; ++k)
+				for (int c = 0; c < 3; ++c) {
+					v[6 * k + c] = deriv.dod[k][c][lane];
+					v[6 * k + 3 + c] = deriv.ddd[k][c][lane];
+				}
+			LensRayDifferentials(d, ray);
+		}
+	}
+}
+int RealisticCamera::RayBatchSize() const {
+	return TracesPackets() ? LENS_PACKET_SIZE : 1;
+}
+void RealisticCamera::LensRayDifferentials(const LensRayDerivatives &deriv,
+		RayDifferential *ray) const {
+	// Offset world space ray by its derivatives for one pixel steps
+	Vector dddx = CameraToWorld(deriv.dddx), dddy = CameraToWorld(deriv.dddy);
+	ray->rx.o = ray->o + CameraToWorld(deriv.dodx);
+	ray->rx.d = Normalize(ray->d + dddx);
+	ray->ry.o = ray->o + CameraToWorld(deriv.dody);
+	ray->ry.d = Normalize(ray->d + dddy);
+	ray->hasDifferentials = true;
+}
+float RealisticCamera::GenerateLensRay(const Sample &sample, Ray *ray,
+		LensRayDerivatives *deriv) const {
+	Point pFilm = FilmPoint(sample);
+	// Use thick lens approximation where calibration allows it
+	if (!thickRegions.empty()) {
+		static StatsPercentage thickRays("Camera",
+			"Lens rays from thick lens approximation"); // NOBOOK
+		float rFilm = sqrtf(pFilm.x * pFilm.x + pFilm.y * pFilm.y);
+		const ThickLensRegion &region = thickRegions[ExitPupilBin(rFilm)];
+		thickRays.Add(region.useThick ? 1 : 0, 1); // NOBOOK
+		if (region.useThick) {
+			Point pRear;
+			float pupilArea;
+			const LensIris &iris = prescription.iris;
+			if (iris.IsPolygon()) {
+				// Sample the polygon bounding the iris-shaped pupil,
+				// which straight blades fill exactly
+				float dx, dy, cx = region.centerScale * pFilm.x;
+				float cy = region.centerScale * pFilm.y;
+				float bound = region.pupilRadius * iris.boundScale;
+				iris.SamplePolygon(sample.lensU, sample.lensV, &dx, &dy);
+				pRear = Point(cx + bound * dx, cy + bound * dy, rearZ);
+				if (iris.Norm(bound * dx, bound * dy) > region.pupilRadius)
+					return 0.f;
+				pupilArea = bound * bound * iris.PolygonArea();
+			}
+			else {
+				// Sample rear plane disk, rotated to the film point's angle
+				float dx, dy;
+				ConcentricSampleDisk(sample.lensU, sample.lensV, &dx, &dy);
+				float sinTheta = (rFilm != 0.f) ? pFilm.y / rFilm : 0.f;
+				float cosTheta = (rFilm != 0.f) ? pFilm.x / rFilm : 1.f;
+				pRear = RotateToFilmAngle(
+					region.centerScale * rFilm + region.pupilRadius * dx,
+					region.pupilRadius * dy, cosTheta, sinTheta);
+				pupilArea = M_PI * region.pupilRadius * region.pupilRadius;
+			}
+			Ray rFilmRay(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY);
+			if (deriv) {
+				deriv->dodx = Vector(-filmWidth / film->xResolution, 0.f, 0.f);
+				deriv->dody = Vector(0.f, filmHeight / film->yResolution, 0.f);
+			}
+			TraceThickLens(pFilm, pRear, ray, deriv);
+			return CameraRayWeight(rFilmRay, pupilArea, ray);
+		}
+	}
+	// Sample point inside exit pupil bounds
+	float boundsArea, pupilX, pupilY;
+	Point pRear = SampleExitPupil(pFilm.x, pFilm.y,
+		sample.lensU, sample.lensV, &boundsArea, &pupilX, &pupilY);
+	if (boundsArea == 0.f) return 0.f;
+	// Trace ray from film through lens system or its approximation
+	Ray rFilm(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY);
+	bool passed;
+	if (lensField)
+		passed = TraceLensField(pFilm.x, pFilm.y, pupilX, pupilY,
+			rFilm, ray);
+	else if (usePolynomial)
+		passed = TraceLensPolynomial(pFilm.x, pFilm.y, pupilX, pupilY, ray);
+	else if (deriv) {
+		FilmRayDerivatives(rFilm, pRear, deriv);
+		passed = prescription.TraceDifferentialFromFilm(rFilm, ray, deriv);
+	}
+	else
+		passed = TraceLensesFromFilm(rFilm, ray);
+	CountBlockedLensRay(!passed);
+	if (!passed) return 0.f;
+	return CameraRayWeight(rFilm, boundsArea, ray);
+}
+void RealisticCamera::FilmRayDerivatives(const Ray &rFilm,
+		const Point &pRear, LensRayDerivatives *deriv) const {
+	// Differentiate film ray for one pixel steps, holding its rear
+	// plane point fixed
+	float invLength = 1.f / Distance(pRear, rFilm.o);
+	deriv->dodx = Vector(-filmWidth / film->xResolution, 0.f, 0.f);
+	deriv->dody = Vector(0.f, filmHeight / film->yResolution, 0.f);
+	deriv->dddx = invLength *
+		(Dot(rFilm.d, deriv->dodx) * rFilm.d - deriv->dodx);
+	deriv->dddy = invLength *
+		(Dot(rFilm.d, deriv->dody) * rFilm.d - deriv->dody);
+}
+void RealisticCamera::CountBlockedLensRay(bool blocked) const {
+	static StatsPercentage vignetted("Camera",
+		"Lens rays blocked inside exit pupil bounds"); // NOBOOK
+	vignetted.Add(blocked ? 1 : 0, 1); // NOBOOK
+}
+float RealisticCamera::CameraRayWeight(const Ray &rFilm,
+		float boundsArea, Ray *ray) const {
+	ray->d = Normalize(ray->d);
+	// Compute irradiance weight for film point
+	float cosTheta = rFilm.d.z;
+	float cos4Theta = (cosTheta * cosTheta) * (cosTheta * cosTheta);
+	if (simpleWeighting)
+		return cos4Theta * boundsArea / (M_PI * rearRadius * rearRadius);
+	float Z = rearZ - filmZ;
+	return cos4Theta * boundsArea / (Z * Z);
+}
+void RealisticCamera::CameraRayToWorld(const Sample &sample,
+		Ray *ray) const {
+	ray->mint = ClipHither;
+	ray->maxt = ClipYon;
+	// Set ray time value
+	ray->time = Lerp(sample.time, ShutterOpen, ShutterClose);
+	CameraToWorld(*ray, ray);
+}
+float RealisticCamera::GenerateSpectralRay(const Sample &sample,
+		Ray *ray, Spectrum *channelWeights) const {
+	*channelWeights = Spectrum(1.f);
+	if (!dispersive)
+		return GenerateRay(sample, ray);
+	// Compute film point and exit pupil sample as in _GenerateRay_
+	Point pFilm = FilmPoint(sample);
+	float boundsArea;
+	Point pRear = SampleExitPupil(pFilm.x, pFilm.y,
+		sample.lensU, sample.lensV, &boundsArea);
+	if (boundsArea == 0.f) return 0.f;
+	// Trace all color channels together, one wavelength per packet lane
+	static StatsPercentage vignetted("Camera",
+		"Dispersive lens rays blocked inside exit pupil bounds"); // NOBOOK
+	static StatsPercentage coincident("Camera",
+		"Dispersive lens samples with coincident channel rays"); // NOBOOK
+	Ray rFilm(pFilm, Normalize(pRear - pFilm), 0.f, INFINITY);
+	LensRayPacket packet, packetOut;
+	for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+		packet.ox[lane] = rFilm.o.x;
+		packet.oy[lane] = rFilm.o.y;
+		packet.oz[lane] = rFilm.o.z;
+		packet.dx[lane] = rFilm.d.x;
+		packet.dy[lane] = rFilm.d.y;
+		packet.dz[lane] = rFilm.d.z;
+	}
+	int hitMask = TraceLensesFromFilm(packet, &packetOut,
+		(1 << COLOR_SAMPLES) - 1, &spectralEta[0]);
+	// Choose the channel whose exit ray is traced into the scene from a
+	// hash of the image and lens sample, leaving _time_ for the shutter;
+	// the final mix spreads the hash into its high bits
+	u_int h = HashCameraSample(sample);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	int c = int((h >> 8) % COLOR_SAMPLES);
+	if (!(hitMask & (1 << c))) {
+		vignetted.Add(1, 1); // NOBOOK
+		return 0.f;
+	}
+	vignetted.Add(0, 1); // NOBOOK
+	// Share the radiance with channels whose exit rays coincide, dividing
+	// by the probability that any matching channel was chosen
+	float cs[COLOR_SAMPLES];
+	int nShared = 0;
+	for (int k = 0; k < COLOR_SAMPLES; ++k) {
+		cs[k] = 0.f;
+		if (!(hitMask & (1 << k)) || !ChannelRaysMatch(packetOut, c, k))
+			continue;
+		int nMatch = 0;
+		for (int j = 0; j < COLOR_SAMPLES; ++j)
+			if ((hitMask & (1 << j)) && ChannelRaysMatch(packetOut, k, j))
+				++nMatch;
+		cs[k] = float(COLOR_SAMPLES) / float(nMatch);
+		++nShared;
+	}
+	coincident.Add(nShared == COLOR_SAMPLES ? 1 : 0, 1); // NOBOOK
+	*channelWeights = Spectrum(cs);
+	*ray = Ray(Point(packetOut.ox[c], packetOut.oy[c], packetOut.oz[c]),
+		Vector(packetOut.dx[c], packetOut.dy[c], packetOut.dz[c]));
+	float rayWeight = CameraRayWeight(rFilm, boundsArea, ray);
+	CameraRayToWorld(sample, ray);
+	return rayWeight;
+}
+bool RealisticCamera::ChannelRaysMatch(const LensRayPacket &r,
+		int a, int b) const {
+	// Compare exit ray separation, with direction scaled to the film
+	float dox = r.ox[a] - r.ox[b], doy = r.oy[a] - r.oy[b];
+	float doz = r.oz[a] - r.oz[b];
+	float ddx = r.dx[a] - r.dx[b], ddy = r.dy[a] - r.dy[b];
+	float ddz = r.dz[a] - r.dz[b];
+	float separation = sqrtf(dox * dox + doy * doy + doz * doz) +
+		(rearZ - filmZ) * sqrtf(ddx * ddx + ddy * ddy + ddz * ddz);
+	return separation <= dispersionTolerance;
+}
+extern "C" DLLEXPORT Camera *CreateCamera(const ParamSet &params,
+		const Transform &world2cam, Film *film) {
+	// Extract common camera parameters from _ParamSet_
+	float hither = max(1e-4f, params.FindOneFloat("hither", 1e-3f));
+	float yon = min(params.FindOneFloat("yon", 1e30f), 1e30f);
+	float shutteropen = params.FindOneFloat("shutteropen", 0.f);
+	float shutterclose = params.FindOneFloat("shutterclose", 1.f);
+	// Extract realistic camera parameters from _ParamSet_
+	string specfile = params.FindOneString("specfile", "");
+	float filmdistance = params.FindOneFloat("filmdistance", 0.f);
+	float aperdiam = params.FindOneFloat("aperture_diameter", 0.f);
+	float filmdiag = params.FindOneFloat("filmdiag", 35.f);
+	bool simpleweighting = params.FindOneBool("simpleweighting", true);
+	int pupilbins = max(1, params.FindOneInt("exitpupilbins", 64));
+	bool usepolynomial = params.FindOneBool("polynomial", false);
+	int polydegree = Clamp(params.FindOneInt("polydegree", 7), 3,
+		LENS_POLY_MAX_DEGREE);
+	float polytolerance = params.FindOneFloat("polytolerance", 5e-3f);
+	string polyfile = params.FindOneString("polyfile", "");
+	string lightfieldcache = params.FindOneString("lightfieldcache", "");
+	int lightfieldres = max(2, params.FindOneInt("lightfieldres", 64));
+	bool dispersion = params.FindOneBool("dispersion", false);
+	float dispersiontolerance = max(0.f,
+		params.FindOneFloat("dispersiontolerance", .25f));
+	bool thicklens = params.FindOneBool("thicklens", false);
+	float thicktolerance = max(0.f,
+		params.FindOneFloat("thicktolerance", .5f));
+	string statecache = params.FindOneString("statecache", "");
+	int irisblades = params.FindOneInt("irisblades", 0);
+	float irisrotation = params.FindOneFloat("irisrotation", 0.f);
+	float iriscurvature = params.FindOneFloat("iriscurvature", 0.f);
+	string raycache = params.FindOneString("raycache", "");
+	if (specfile == "") {
+		Error("No lens specification file supplied for \"realistic\" camera");
+		return NULL;
+	}
+	vector<LensInterface> lenses;
+	LensStateTable states;
+	if (!LoadLensFile(specfile, &lenses, &states))
+		return NULL;
+	if (filmdistance <= 0.f && lenses.back().spacing.empty()) {
+		Error("\"filmdistance\" must be positive for \"realistic\" camera "
+			"unless the lens file gives the back focal distance");
+		return NULL;
+	}
+	// Default to the first zoom position and the farthest focus state
+	float zoom = params.FindOneFloat("zoom",
+		states.zoom.empty() ? 0.f : states.zoom[0]);
+	float focusdistance = params.FindOneFloat("focusdistance",
+		states.focus.empty() ? INFINITY : states.focus[0]);
+	// Override aperture stop diameter, if requested
+	if (aperdiam > 0.f) {
+		for (u_int i = 0; i < lenses.size(); ++i)
+			if (lenses[i].isStop) {
+				if (aperdiam > lenses[i].aperture)
+					Warning("Specified aperture diameter %f is larger "
+						"than maximum possible %f; clamping",
+						aperdiam, lenses[i].aperture);
+				else
+					lenses[i].aperture = aperdiam;
+			}
+	}
+	// Check that dispersive tracing is possible for this lens
+	if (dispersion) {
+		bool hasData = false;
+		for (u_int i = 0; i < lenses.size(); ++i)
+			hasData |= HasDispersion(lenses[i]);
+		if (!hasData) {
+			Warning("Lens file \"%s\" has no dispersion data; "
+				"tracing a single wavelength", specfile.c_str());
+			dispersion = false;
+		}
+		else if (usepolynomial || lightfieldcache != "") {
+			Warning("Dispersion needs exact lens tracing; ignoring "
+				"\"polynomial\" and \"lightfieldcache\"");
+			usepolynomial = false;
+			lightfieldcache = "";
+		}
+	}
+	// Build the iris; a round stop needs no blades
+	LensIris iris;
+	if (irisblades > LENS_MAX_BLADES)
+		Warning("At most %d iris blades are supported; using %d",
+			LENS_MAX_BLADES, LENS_MAX_BLADES);
+	if (irisblades >= 3)
+		iris = LensIris(irisblades, Radians(irisrotation), iriscurvature);
+	// Blades break the rotational symmetry that the polynomial and light
+	// field tables are built on
+	if (iris.IsPolygon() && (usepolynomial || lightfieldcache != "")) {
+		Warning("Iris blades need exact lens tracing; ignoring "
+			"\"polynomial\" and \"lightfieldcache\"");
+		usepolynomial = false;
+		lightfieldcache = "";
+	}
+	// The thick lens hybrid switches against exact tracing only
+	if (thicklens && (dispersion || usepolynomial || lightfieldcache != "")) {
+		Warning("\"thicklens\" cannot be combined with dispersion, "
+			"\"polynomial\" or \"lightfieldcache\"; ignoring it");
+		thicklens = false;
+	}
+	// Cached rays carry the derivatives that only exact and thick lens
+	// tracing provide
+	if (raycache != "" && (dispersion || usepolynomial ||
+			lightfieldcache != "")) {
+		Warning("\"raycache\" cannot be combined with dispersion, "
+			"\"polynomial\" or \"lightfieldcache\"; ignoring it");
+		raycache = "";
+	}
+	return new RealisticCamera(world2cam, hither, yon,
+		shutteropen, shutterclose, lenses, filmdistance, filmdiag,
+		simpleweighting, pupilbins, usepolynomial, polydegree,
+		polytolerance, polyfile, lightfieldcache, lightfieldres,
+		dispersion, dispersiontolerance, thicklens, thicktolerance,
+		states, zoom, focusdistance, statecache, iris, raycache, film);
+}
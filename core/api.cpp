@@ -137,8 +137,11 @@ if (currentApiState == STATE_OPTIONS_BLOCK) { \
 		"\"%s\" not allowed. Ignoring.", func); \
 	return; \
 } else /* swallow trailing semicolon */
+// Global Options Definition
+COREDLL Options PbrtOptions;
 // API Function Definitions
-COREDLL void pbrtInit() {
+COREDLL void pbrtInit(const Options &opt) {
+	PbrtOptions = opt;
 	// System-wide initialization
 	// Make sure floating point unit's rounding stuff is set
 	// as is expected by the fast FP-conversion routines.  In particular,
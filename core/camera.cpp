@@ -30,6 +30,35 @@
 Camera::~Camera() {
 	delete film;
 }
+float Camera::GenerateSpectralRay(const Sample &sample,
+		Ray *ray, Spectrum *channelWeights) const {
+	// Weight all color channels equally for non-dispersive cameras
+	*channelWeights = Spectrum(1.f);
+	return GenerateRay(sample, ray);
+}
+float Camera::GenerateRayDifferential(const Sample &sample,
+		RayDifferential *ray, Spectrum *channelWeights) const {
+	float rayWeight = GenerateSpectralRay(sample, ray, channelWeights);
+	// Generate ray differentials from camera samples one pixel over
+	float wt1 = GenerateRay(Sample(sample, 1.f, 0.f), &ray->rx);
+	float wt2 = GenerateRay(Sample(sample, 0.f, 1.f), &ray->ry);
+	ray->hasDifferentials = (wt1 > 0 && wt2 > 0);
+	return rayWeight;
+}
+void Camera::GenerateRayDifferentials(const Sample *const *samples,
+		int nSamples, RayDifferential *rays, Spectrum *channelWeights,
+		float *rayWeights) const {
+	// Generate each sample's rays in turn
+	for (int i = 0; i < nSamples; ++i) {
+		rays[i] = RayDifferential();
+		rayWeights[i] = GenerateRayDifferential(*samples[i], &rays[i],
+			&channelWeights[i]);
+	}
+}
+int Camera::RayBatchSize() const {
+	// Most cameras gain nothing from seeing several samples at once
+	return 1;
+}
 Camera::Camera(const Transform &world2cam,
                float hither, float yon,
 		       float sopen, float sclose, Film *f) {
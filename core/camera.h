@@ -35,6 +35,14 @@ public:
 	// Camera Interface
 	virtual float GenerateRay(const Sample &sample,
 		                      Ray *ray) const = 0;
+	virtual float GenerateSpectralRay(const Sample &sample,
+		Ray *ray, Spectrum *channelWeights) const;
+	virtual float GenerateRayDifferential(const Sample &sample,
+		RayDifferential *ray, Spectrum *channelWeights) const;
+	virtual void GenerateRayDifferentials(const Sample *const *samples,
+		int nSamples, RayDifferential *rays, Spectrum *channelWeights,
+		float *rayWeights) const;
+	virtual int RayBatchSize() const;
 	virtual ~Camera();
 	Camera(const Transform &world2cam, float hither, float yon,
 		float sopen, float sclose, Film *film);
@@ -29,6 +29,7 @@
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
 #include <ImfChannelList.h>
+#include <ImfHeader.h>
 #include <ImfFrameBuffer.h>
 #include <ImfRgbaFile.h>
 #include <half.h>
@@ -94,3 +95,49 @@ COREDLL void WriteRGBAImage(const string &name, float *pixels,
             e.what());
     }
 }
+
+COREDLL float *ReadDepthImage(const string &name, int *width, int *height) {
+	try {
+	InputFile file(name.c_str());
+	Box2i dw = file.header().dataWindow();
+	*width  = dw.max.x - dw.min.x + 1;
+	*height = dw.max.y - dw.min.y + 1;
+
+	float *depth = new float[*width * *height];
+	FrameBuffer frameBuffer;
+	frameBuffer.insert("Z", Slice(Imf::FLOAT,
+		(char *)(depth - dw.min.x - dw.min.y * *width),
+		sizeof(float), *width * sizeof(float), 1, 1, INFINITY));
+
+	file.setFrameBuffer(frameBuffer);
+	file.readPixels(dw.min.y, dw.max.y);
+	return depth;
+	} catch (const std::exception &e) {
+		Error("Unable to read depth file \"%s\": %s", name.c_str(),
+			e.what());
+		return NULL;
+	}
+}
+
+COREDLL void WriteDepthImage(const string &name, float *depth,
+		int xRes, int yRes, int totalXRes, int totalYRes,
+		int xOffset, int yOffset) {
+	Box2i displayWindow(V2i(0,0), V2i(totalXRes-1, totalYRes-1));
+	Box2i dataWindow(V2i(xOffset, yOffset), V2i(xOffset + xRes - 1, yOffset + yRes - 1));
+	Header header(displayWindow, dataWindow);
+	header.channels().insert("Z", Channel(Imf::FLOAT));
+
+	try {
+		OutputFile file(name.c_str(), header);
+		FrameBuffer frameBuffer;
+		frameBuffer.insert("Z", Slice(Imf::FLOAT,
+			(char *)(depth - xOffset - yOffset * xRes),
+			sizeof(float), xRes * sizeof(float)));
+		file.setFrameBuffer(frameBuffer);
+		file.writePixels(yRes);
+	}
+	catch (const std::exception &e) {
+		Error("Unable to write depth file \"%s\": %s", name.c_str(),
+			e.what());
+	}
+}
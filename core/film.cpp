@@ -26,6 +26,58 @@
 #include "dynload.h"
 #include "paramset.h"
 #include "tonemap.h"
+#include "sampling.h"
+// BufferedFilmTile Declarations
+class BufferedFilmTile : public FilmTile {
+public:
+	// BufferedFilmTile Public Methods
+	BufferedFilmTile() : sample(NULL) { }
+	~BufferedFilmTile() { delete sample; }
+	void AddSample(const Sample &s, const Ray &ray,
+			const Spectrum &L, float alpha) {
+		if (!sample) sample = s.Duplicate();
+		TileSample ts;
+		ts.imageX = s.imageX;
+		ts.imageY = s.imageY;
+		ts.lensU = s.lensU;
+		ts.lensV = s.lensV;
+		ts.time = s.time;
+		ts.ray = ray;
+		ts.L = L;
+		ts.alpha = alpha;
+		samples.push_back(ts);
+	}
+	void AddToFilm(Film *film) {
+		for (u_int i = 0; i < samples.size(); ++i) {
+			sample->imageX = samples[i].imageX;
+			sample->imageY = samples[i].imageY;
+			sample->lensU = samples[i].lensU;
+			sample->lensV = samples[i].lensV;
+			sample->time = samples[i].time;
+			film->AddSample(*sample, samples[i].ray, samples[i].L,
+				samples[i].alpha);
+		}
+	}
+private:
+	// BufferedFilmTile Private Data
+	struct TileSample {
+		float imageX, imageY, lensU, lensV, time;
+		Ray ray;
+		Spectrum L;
+		float alpha;
+	};
+	vector<TileSample> samples;
+	Sample *sample;
+};
+// Film Method Definitions
+FilmTile *Film::GetFilmTile(int xstart, int xend,
+		int ystart, int yend) {
+	return new BufferedFilmTile;
+}
+void Film::MergeFilmTile(FilmTile *tile) {
+	((BufferedFilmTile *)tile)->AddToFilm(this);
+	delete tile;
+}
 // Image Pipeline Function Definitions
 void ApplyImagingPipeline(float *rgb, int xResolution,
 		int yResolution, float *yWeight,
@@ -25,8 +25,16 @@
 #define PBRT_FILM_H
 // film.h*
 #include "pbrt.h"
+// FilmTile Declarations
+class COREDLL FilmTile {
+public:
+	// FilmTile Interface
+	virtual ~FilmTile() { }
+	virtual void AddSample(const Sample &sample, const Ray &ray,
+		const Spectrum &L, float alpha) = 0;
+};
 // Film Declarations
-class Film {
+class COREDLL Film {
 public:
 	// Film Interface
 	Film(int xres, int yres)
@@ -38,6 +46,20 @@ public:
 	virtual void WriteImage() = 0;
 	virtual void GetSampleExtent(int *xstart,
 		int *xend, int *ystart, int *yend) const = 0;
+	// Tiles collect the samples in $[xstart,xend) \times [ystart,yend)$
+	// without locking; each is merged into the film and deleted by
+	// _MergeFilmTile()_. By default they keep the samples and add them
+	// with _AddSample()_ when merged.
+	virtual FilmTile *GetFilmTile(int xstart, int xend,
+		int ystart, int yend);
+	virtual void MergeFilmTile(FilmTile *tile);
+	// Luminance statistics of the samples that fell inside pixel
+	// $(x,y)$, for samplers that adapt to the image; films that do not
+	// keep them return false
+	virtual bool GetPixelStatistics(int x, int y, int *nSamples,
+			float *mean, float *variance) const {
+		return false;
+	}
 	// Film Public Data
 	const int xResolution, yResolution;
 };
@@ -0,0 +1,833 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef PBRT_LENS_H
+#define PBRT_LENS_H
+// lens.h*
+#include "pbrt.h"
+#include "geometry.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PBRT_LENS_SSE
+#include <emmintrin.h>
+#endif
+// LensRayPacket Declarations
+#define LENS_PACKET_SIZE 4
+struct LensRayPacket {
+	// LensRayPacket Data, one lane per ray in structure-of-arrays form
+	float ox[LENS_PACKET_SIZE], oy[LENS_PACKET_SIZE], oz[LENS_PACKET_SIZE];
+	float dx[LENS_PACKET_SIZE], dy[LENS_PACKET_SIZE], dz[LENS_PACKET_SIZE];
+};
+// Lens Utility Functions
+inline bool Refract(const Vector &wi, const Vector &n, float eta,
+		Vector *wt) {
+	// Compute $\cos \theta_t$ using Snell's law
+	float cosThetaI = Dot(n, wi);
+	float sin2ThetaT = eta * eta * max(0.f, 1.f - cosThetaI * cosThetaI);
+	// Handle total internal reflection
+	if (sin2ThetaT >= 1.f) return false;
+	float cosThetaT = sqrtf(1.f - sin2ThetaT);
+	*wt = eta * -wi + (eta * cosThetaI - cosThetaT) * n;
+	return true;
+}
+// Aspheric Surface Declarations
+// Even asphere terms $A_4 r^4 \ldots A_{14} r^{14}$ kept per surface, and
+// the Newton iteration cap and convergence step (mm) for intersecting them
+#define LENS_ASPHERE_TERMS 6
+#define LENS_NEWTON_ITERATIONS 8
+#define LENS_NEWTON_TOLERANCE 1e-4f
+// Most iris blades supported by _LensIris_
+#define LENS_MAX_BLADES 16
+// LensStateTable Declarations
+class LensStateTable {
+public:
+	// LensStateTable Public Methods
+	int NumZoom() const { return max(1, int(zoom.size())); }
+	int NumFocus() const { return max(1, int(focus.size())); }
+	int NumStates() const { return NumZoom() * NumFocus(); }
+	// Find the up to four states around zoom position _z_ and focus
+	// distance _d_, with bilinear weights summing to one; focus is
+	// interpolated in inverse distance
+	int Bracket(float z, float d, int state[4], float weight[4]) const {
+		int z0, f0;
+		float tz, tf;
+		FindInterval(zoom, z, &z0, &tz);
+		vector<float> invFocus(focus.size());
+		for (u_int i = 0; i < focus.size(); ++i)
+			invFocus[i] = InverseDistance(focus[i]);
+		FindInterval(invFocus, InverseDistance(d), &f0, &tf);
+		// Skip states with negligible weight, such as the nearest focus
+		// state for a very distant but finite focus distance
+		int n = 0;
+		float sum = 0.f;
+		for (int j = 0; j < 4; ++j) {
+			float w = ((j & 1) ? tz : 1.f - tz) * ((j & 2) ? tf : 1.f - tf);
+			if (w < 1e-6f) continue;
+			state[n] = (z0 + (j & 1)) * NumFocus() + f0 + (j >> 1);
+			weight[n++] = w;
+			sum += w;
+		}
+		for (int j = 0; j < n; ++j)
+			weight[j] /= sum;
+		return n;
+	}
+	// Interpolate a per-state _table_ between bracketing states
+	static float Interpolate(const vector<float> &table, const int state[4],
+			const float weight[4], int n) {
+		float v = 0.f;
+		for (int j = 0; j < n; ++j)
+			v += weight[j] * table[state[j]];
+		return v;
+	}
+	// LensStateTable Data: zoom positions in increasing order and focus
+	// distances from far to near; per-state tables list zoom-major with
+	// focus varying fastest
+	vector<float> zoom, focus;
+private:
+	// LensStateTable Private Methods
+	static float InverseDistance(float d) {
+		return (d == INFINITY || d == 0.f) ? 0.f : 1.f / d;
+	}
+	static void FindInterval(const vector<float> &v, float x, int *i0,
+			float *t) {
+		*i0 = 0;
+		*t = 0.f;
+		if (v.size() < 2) return;
+		x = Clamp(x, v.front(), v.back());
+		while (*i0 < int(v.size()) - 2 && x > v[*i0 + 1]) ++*i0;
+		float span = v[*i0 + 1] - v[*i0];
+		*t = (span > 0.f) ? (x - v[*i0]) / span : 0.f;
+	}
+};
+// LensIris Declarations
+class LensIris {
+public:
+	// LensIris Public Methods
+	LensIris() : blades(0), polygonWeight(0.f), curvature(1.f),
+		boundScale(1.f), area(M_PI) { }
+	// Build an iris of _n_ straight or curved blades; _rotation_ is the
+	// angle of the first polygon corner from $+x$ in radians, and
+	// _curv_ blends the blade edges from straight (0) to circular (1)
+	LensIris(int n, float rotation, float curv) {
+		blades = Clamp(n, 3, LENS_MAX_BLADES);
+		curvature = Clamp(curv, 0.f, 1.f);
+		polygonWeight = 1.f - curvature;
+		float cosHalf = cosf(M_PI / blades);
+		for (int k = 0; k <= blades; ++k) {
+			float corner = rotation + 2.f * M_PI * k / blades;
+			vx[k] = cosf(corner);
+			vy[k] = sinf(corner);
+			// Blade normals point between corners, scaled so that
+			// _PolygonNorm()_ measures circumradius
+			nx[k] = cosf(corner + M_PI / blades) / cosHalf;
+			ny[k] = sinf(corner + M_PI / blades) / cosHalf;
+		}
+		// Curved blades bulge outward but stay inside the polygon whose
+		// apothem reaches their midpoints
+		boundScale = 1.f / (polygonWeight + curvature * cosHalf);
+		// Measure the area of the unit iris on a grid over its bound
+		const int nGrid = 256;
+		int inside = 0;
+		for (int j = 0; j < nGrid; ++j)
+			for (int i = 0; i < nGrid; ++i)
+				inside += Norm(boundScale * (2.f * (i + .5f) / nGrid - 1.f),
+					boundScale * (2.f * (j + .5f) / nGrid - 1.f)) <= 1.f;
+		area = (curvature == 0.f) ? PolygonArea() :
+			4.f * boundScale * boundScale * inside / (nGrid * nGrid);
+	}
+	bool IsPolygon() const { return blades > 0; }
+	// Smallest circumradius of a straight-bladed iris containing $(x,y)$
+	float PolygonNorm(float x, float y) const {
+		float s = 0.f;
+		for (int k = 0; k < blades; ++k)
+			s = max(s, x * nx[k] + y * ny[k]);
+		return s;
+	}
+	// Smallest circumradius of this iris containing $(x,y)$, without
+	// the angle lookups a per-blade test would need
+	float Norm(float x, float y) const {
+		return polygonWeight * PolygonNorm(x, y) +
+			curvature * sqrtf(x * x + y * y);
+	}
+	// Uniformly sample the straight-bladed iris of unit circumradius by
+	// choosing a triangle of the fan about its center
+	void SamplePolygon(float u1, float u2, float *x, float *y) const {
+		float uk = u1 * blades;
+		int k = min(int(uk), blades - 1);
+		float su = sqrtf(uk - k);
+		float a = su * (1.f - u2), b = su * u2;
+		*x = a * vx[k] + b * vx[k + 1];
+		*y = a * vy[k] + b * vy[k + 1];
+	}
+	float PolygonArea() const {
+		return .5f * blades * sinf(2.f * M_PI / blades);
+	}
+	// LensIris Data
+	int blades;
+	float polygonWeight, curvature;
+	// Circumradius of the polygon bounding the unit iris, and its area
+	float boundScale, area;
+	float vx[LENS_MAX_BLADES + 1], vy[LENS_MAX_BLADES + 1];
+	float nx[LENS_MAX_BLADES + 1], ny[LENS_MAX_BLADES + 1];
+};
+// LensRayDerivatives Declarations
+struct LensRayDerivatives {
+	// Derivatives of ray origin and unit direction with respect to two
+	// film coordinates $x$ and $y$
+	Vector dodx, dddx, dody, dddy;
+};
+// LensDerivativePacket Declarations
+struct LensDerivativePacket {
+	// LensDerivativePacket Data: origin and direction derivatives for
+	// each lane of a _LensRayPacket_, indexed by film coordinate ($x$ or
+	// $y$), then vector component, then lane
+	float dod[2][3][LENS_PACKET_SIZE], ddd[2][3][LENS_PACKET_SIZE];
+};
+// LensPrescription Declarations
+class LensPrescription {
+public:
+	// LensPrescription Public Methods
+	LensPrescription() { }
+	void Clear() {
+		zpos.clear(); centerZ.clear(); radius.clear(); radius2.clear();
+		invRadius.clear(); aperture2.clear(); etaFromFilm.clear();
+		etaFromScene.clear(); isStop.clear(); etaBehind.clear();
+		conic.clear(); asphere.clear(); isAspheric.clear();
+	}
+	// Append surfaces front to back; _eta_ is the index behind the surface
+	void AddSurface(float rad, float z, float eta, float aperture,
+			bool stop) {
+		float etaFront = etaBehind.empty() ? 1.f : etaBehind.back();
+		zpos.push_back(z);
+		centerZ.push_back(z - rad);
+		radius.push_back(rad);
+		radius2.push_back(rad * rad);
+		invRadius.push_back(rad != 0.f ? 1.f / fabsf(rad) : 0.f);
+		aperture2.push_back(.25f * aperture * aperture);
+		etaFromFilm.push_back(eta / etaFront);
+		etaFromScene.push_back(etaFront / eta);
+		isStop.push_back(stop);
+		etaBehind.push_back(eta);
+		conic.push_back(0.f);
+		asphere.insert(asphere.end(), LENS_ASPHERE_TERMS, 0.f);
+		isAspheric.push_back(false);
+	}
+	// Make surface _i_ a conic with constant _k_ plus the even polynomial
+	// terms _coeffs[0]_ $r^4$, _coeffs[1]_ $r^6$, ...
+	void SetAsphere(int i, float k, const float coeffs[LENS_ASPHERE_TERMS]) {
+		conic[i] = k;
+		bool poly = false;
+		for (int j = 0; j < LENS_ASPHERE_TERMS; ++j) {
+			asphere[i * LENS_ASPHERE_TERMS + j] = coeffs[j];
+			poly |= (coeffs[j] != 0.f);
+		}
+		isAspheric[i] = !isStop[i] && (poly || (k != 0.f && radius[i] != 0.f));
+	}
+	// Compute the sag of surface _i_ toward the film at squared height
+	// $u = r^2$ and its first two derivatives with respect to $u$;
+	// returns false where the height lies beyond the conic's extent
+	bool Sag(int i, float u, float *s, float *ds, float *dds = NULL) const {
+		float c = (radius[i] != 0.f) ? 1.f / radius[i] : 0.f;
+		float q2 = 1.f - (1.f + conic[i]) * c * c * u;
+		if (q2 <= 0.f) return false;
+		float q = sqrtf(q2);
+		*s = c * u / (1.f + q);
+		*ds = c / (2.f * q);
+		if (dds) *dds = (1.f + conic[i]) * c * c * c / (4.f * q * q2);
+		// Add even polynomial terms with Horner's rule
+		const float *a = &asphere[i * LENS_ASPHERE_TERMS];
+		float p = 0.f, dp = 0.f, ddp = 0.f;
+		for (int j = LENS_ASPHERE_TERMS - 1; j >= 0; --j) {
+			p = p * u + a[j];
+			dp = dp * u + (j + 2) * a[j];
+			ddp = ddp * u + (j + 2) * (j + 1) * a[j];
+		}
+		*s += p * u * u;
+		*ds += dp * u;
+		if (dds) *dds += ddp;
+		return true;
+	}
+	// Record Newton intersections of aspheric surfaces for statistics
+	void CountNewton(int nIntersections, int nIterations,
+			int nFailures) const {
+		static StatsRatio iterations("Lens",
+			"Newton iterations per aspheric intersection"); // NOBOOK
+		static StatsPercentage failures("Lens",
+			"Aspheric intersections failing to converge"); // NOBOOK
+		iterations.Add(nIterations, nIntersections); // NOBOOK
+		failures.Add(nFailures, nIntersections); // NOBOOK
+	}
+	int NumSurfaces() const { return int(zpos.size()); }
+	// Trace surfaces back to front, stopping after surface _first_; a
+	// blocked ray reports the surface that stopped it in _blocked_
+	bool TraceFromFilm(const Ray &r, Ray *rOut, Point *pHits = NULL,
+			int first = 0, int *blocked = NULL) const {
+		Ray ray = r;
+		for (int i = NumSurfaces() - 1; i >= first; --i)
+			if (!Interact(i, etaFromFilm[i], &ray, pHits)) {
+				if (blocked) *blocked = i;
+				return false;
+			}
+		*rOut = ray;
+		return true;
+	}
+	// Trace surfaces back to front with caller-supplied refraction ratios,
+	// taking surface _i_'s ratio from _eta[i * etaStride]_
+	bool TraceFromFilmWithEta(const Ray &r, Ray *rOut, const float *eta,
+			int etaStride) const {
+		Ray ray = r;
+		for (int i = NumSurfaces() - 1; i >= 0; --i)
+			if (!Interact(i, eta[i * etaStride], &ray, NULL)) return false;
+		*rOut = ray;
+		return true;
+	}
+	// Trace surfaces back to front, carrying ray derivatives through each
+	// transfer and refraction; the ray direction must be normalized
+	bool TraceDifferentialFromFilm(const Ray &r, Ray *rOut,
+			LensRayDerivatives *deriv) const {
+		Ray ray = r;
+		for (int i = NumSurfaces() - 1; i >= 0; --i)
+			if (!Interact(i, etaFromFilm[i], &ray, NULL, deriv)) return false;
+		*rOut = ray;
+		return true;
+	}
+	// Trace surfaces front to back, starting at surface _first_
+	bool TraceFromScene(const Ray &r, Ray *rOut, Point *pHits = NULL,
+			int first = 0, int *blocked = NULL) const {
+		Ray ray = r;
+		for (int i = first; i < NumSurfaces(); ++i)
+			if (!Interact(i, etaFromScene[i], &ray, pHits)) {
+				if (blocked) *blocked = i;
+				return false;
+			}
+		*rOut = ray;
+		return true;
+	}
+	// Trace a packet of rays back to front, returning the mask of
+	// _activeMask_ lanes that leave the front surface; _laneEta_, if
+	// given, holds each surface's refraction ratio for every lane, and
+	// _deriv_, if given, carries each lane's ray derivatives through the
+	// surfaces as _TraceDifferentialFromFilm()_ does
+	int TracePacketFromFilm(const LensRayPacket &rCamera, LensRayPacket *rOut,
+			int activeMask, const float *laneEta = NULL,
+			LensDerivativePacket *deriv = NULL) const {
+		return TracePacket(rCamera, rOut, activeMask, true, laneEta, deriv);
+	}
+	// Trace a packet of rays front to back, returning the mask of
+	// _activeMask_ lanes that leave the back surface
+	int TracePacketFromScene(const LensRayPacket &rScene, LensRayPacket *rOut,
+			int activeMask) const {
+		return TracePacket(rScene, rOut, activeMask, false, NULL, NULL);
+	}
+	// Trace a packet through the surfaces in film or scene order
+#ifdef PBRT_LENS_SSE
+	int TracePacket(const LensRayPacket &rIn, LensRayPacket *rOut,
+			int activeMask, bool fromFilm, const float *laneEta,
+			LensDerivativePacket *deriv) const {
+		static const int laneCount[16] = {
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+		};
+		// Load ray packet into SSE registers
+		__m128 ox = _mm_loadu_ps(rIn.ox), oy = _mm_loadu_ps(rIn.oy);
+		__m128 oz = _mm_loadu_ps(rIn.oz), dx = _mm_loadu_ps(rIn.dx);
+		__m128 dy = _mm_loadu_ps(rIn.dy), dz = _mm_loadu_ps(rIn.dz);
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+		const __m128 signBit = _mm_set1_ps(-0.f);
+		__m128 active = _mm_castsi128_ps(_mm_set_epi32(
+			(activeMask & 8) ? -1 : 0, (activeMask & 4) ? -1 : 0,
+			(activeMask & 2) ? -1 : 0, (activeMask & 1) ? -1 : 0));
+		__m128 dod[2][3], ddd[2][3];
+		for (int k = 0; k < 2; ++k)
+			for (int c = 0; c < 3; ++c) {
+				dod[k][c] = deriv ? _mm_loadu_ps(deriv->dod[k][c]) : zero;
+				ddd[k][c] = deriv ? _mm_loadu_ps(deriv->ddd[k][c]) : zero;
+			}
+		const LensPrescription &lp = *this;
+		int nSurfaces = lp.NumSurfaces();
+		for (int step = 0; step < nSurfaces; ++step) {
+			int i = fromFilm ? nSurfaces - 1 - step : step;
+			__m128 aper2 = _mm_set1_ps(lp.aperture2[i]);
+			if (lp.isStop[i]) {
+				// Intersect packet with aperture stop plane
+				__m128 t = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(lp.zpos[i]), oz), dz);
+				active = _mm_and_ps(active, _mm_cmpge_ps(t, zero));
+				if (deriv)
+					for (int k = 0; k < 2; ++k)
+						TransferDerivativeSSE(t, zero, zero, one, dx, dy, dz,
+							dod[k], ddd[k]);
+				ox = _mm_add_ps(ox, _mm_mul_ps(t, dx));
+				oy = _mm_add_ps(oy, _mm_mul_ps(t, dy));
+				oz = _mm_set1_ps(lp.zpos[i]);
+				__m128 r2 = _mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy));
+				if (lp.iris.IsPolygon()) {
+					// Measure hits against the iris blades as in _LensIris::Norm()_
+					const LensIris &iris = lp.iris;
+					__m128 s = zero;
+					for (int k = 0; k < iris.blades; ++k)
+						s = _mm_max_ps(s, _mm_add_ps(
+							_mm_mul_ps(ox, _mm_set1_ps(iris.nx[k])),
+							_mm_mul_ps(oy, _mm_set1_ps(iris.ny[k]))));
+					__m128 r = _mm_add_ps(
+						_mm_mul_ps(_mm_set1_ps(iris.polygonWeight), s),
+						_mm_mul_ps(_mm_set1_ps(iris.curvature), _mm_sqrt_ps(r2)));
+					r2 = _mm_mul_ps(r, r);
+				}
+				active = _mm_and_ps(active, _mm_cmple_ps(r2, aper2));
+				if (!_mm_movemask_ps(active)) return 0;
+				continue;
+			}
+			__m128 cz = _mm_set1_ps(lp.centerZ[i]);
+			__m128 A = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+				_mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128 t = zero, hitSphere = zero;
+			if (lp.radius[i] != 0.f) {
+				// Compute quadratic sphere coefficients for packet
+				__m128 ocz = _mm_sub_ps(oz, cz);
+				__m128 B = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ox),
+					_mm_mul_ps(dy, oy)), _mm_mul_ps(dz, ocz));
+				B = _mm_add_ps(B, B);
+				__m128 C = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox),
+					_mm_mul_ps(oy, oy)), _mm_mul_ps(ocz, ocz)),
+					_mm_set1_ps(lp.radius2[i]));
+				__m128 discrim = _mm_sub_ps(_mm_mul_ps(B, B),
+					_mm_mul_ps(_mm_set1_ps(4.f), _mm_mul_ps(A, C)));
+				__m128 rootDiscrim = _mm_sqrt_ps(_mm_max_ps(discrim, zero));
+				// Compute both roots without branching on the sign of _B_
+				__m128 signB = _mm_and_ps(B, signBit);
+				__m128 q = _mm_mul_ps(_mm_set1_ps(-.5f),
+					_mm_add_ps(B, _mm_or_ps(rootDiscrim, signB)));
+				__m128 tq0 = _mm_div_ps(q, A), tq1 = _mm_div_ps(C, q);
+				__m128 t0 = _mm_min_ps(tq0, tq1), t1 = _mm_max_ps(tq0, tq1);
+				__m128 dzPos = _mm_cmpgt_ps(dz, zero);
+				__m128 useCloser = (lp.radius[i] < 0.f) ? dzPos :
+					_mm_andnot_ps(dzPos, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+				t = _mm_or_ps(_mm_and_ps(useCloser, t0),
+				              _mm_andnot_ps(useCloser, t1));
+				hitSphere = _mm_and_ps(_mm_cmpge_ps(discrim, zero),
+					_mm_cmpge_ps(t, zero));
+			}
+			if (lp.isAspheric[i]) {
+				// Seed Newton's method with the base sphere's hit, or the
+				// vertex plane where there is none, and iterate all lanes
+				// until each converges or the iteration cap is reached
+				__m128 z0 = _mm_set1_ps(lp.zpos[i]);
+				__m128 tPlane = _mm_div_ps(_mm_sub_ps(z0, oz), dz);
+				t = _mm_or_ps(_mm_and_ps(hitSphere, t),
+				              _mm_andnot_ps(hitSphere, tPlane));
+				__m128 valid = active, converged = zero, beyond = zero;
+				const __m128 tolerance = _mm_set1_ps(LENS_NEWTON_TOLERANCE);
+				const __m128 clear2 = _mm_set1_ps(4.f * lp.aperture2[i]);
+				int nIterations = 0;
+				for (int iter = 0; iter < LENS_NEWTON_ITERATIONS; ++iter) {
+					__m128 iterating = _mm_andnot_ps(converged, valid);
+					int iterMask = _mm_movemask_ps(iterating);
+					if (!iterMask) break;
+					nIterations += laneCount[iterMask];
+					__m128 px = _mm_add_ps(ox, _mm_mul_ps(t, dx));
+					__m128 py = _mm_add_ps(oy, _mm_mul_ps(t, dy));
+					__m128 pz = _mm_add_ps(oz, _mm_mul_ps(t, dz));
+					__m128 u = _mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py));
+					// Give up on lanes well beyond the clear aperture
+					__m128 outside = _mm_and_ps(iterating, _mm_cmpgt_ps(u, clear2));
+					beyond = _mm_or_ps(beyond, outside);
+					valid = _mm_andnot_ps(outside, valid);
+					__m128 s, ds;
+					AsphereSagSSE(lp, i, u, &s, &ds, &valid);
+					__m128 g = _mm_add_ps(_mm_sub_ps(pz, z0), s);
+					__m128 dg = _mm_add_ps(dz, _mm_mul_ps(_mm_add_ps(ds, ds),
+						_mm_add_ps(_mm_mul_ps(px, dx), _mm_mul_ps(py, dy))));
+					valid = _mm_and_ps(valid, _mm_cmpneq_ps(dg, zero));
+					iterating = _mm_and_ps(iterating, valid);
+					__m128 dt = _mm_and_ps(iterating, _mm_div_ps(g, dg));
+					t = _mm_sub_ps(t, dt);
+					converged = _mm_or_ps(converged, _mm_and_ps(iterating,
+						_mm_cmple_ps(_mm_andnot_ps(signBit, dt), tolerance)));
+				}
+				__m128 hit = _mm_and_ps(_mm_and_ps(valid, converged),
+					_mm_cmpge_ps(t, zero));
+				int tracedMask = _mm_movemask_ps(active);
+				lp.CountNewton(laneCount[tracedMask], nIterations,
+					laneCount[tracedMask & ~_mm_movemask_ps(_mm_or_ps(beyond,
+						_mm_and_ps(valid, converged)))]);
+				active = _mm_and_ps(active, hit);
+			}
+			else if (lp.radius[i] == 0.f) {
+				// Intersect packet with flat surface plane
+				t = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(lp.zpos[i]), oz), dz);
+				active = _mm_and_ps(active, _mm_cmpge_ps(t, zero));
+			}
+			else
+				active = _mm_and_ps(active, hitSphere);
+			// Clip hit points against interface aperture
+			__m128 hx = _mm_add_ps(ox, _mm_mul_ps(t, dx));
+			__m128 hy = _mm_add_ps(oy, _mm_mul_ps(t, dy));
+			__m128 hz = _mm_add_ps(oz, _mm_mul_ps(t, dz));
+			__m128 r2 = _mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hy, hy));
+			active = _mm_and_ps(active, _mm_cmple_ps(r2, aper2));
+			if (!_mm_movemask_ps(active)) return 0;
+			// Compute normal facing the incident direction
+			__m128 nx, ny, nz, ds, dds, invG;
+			if (lp.isAspheric[i]) {
+				// Normalize the gradient of $z - z_0 + s(x^2 + y^2)$
+				__m128 s, valid = active;
+				AsphereSagSSE(lp, i, r2, &s, &ds, &valid,
+					deriv ? &dds : NULL);
+				nx = _mm_mul_ps(_mm_add_ps(ds, ds), hx);
+				ny = _mm_mul_ps(_mm_add_ps(ds, ds), hy);
+				invG = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(one,
+					_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)))));
+				nx = _mm_mul_ps(nx, invG);
+				ny = _mm_mul_ps(ny, invG);
+				nz = invG;
+			}
+			else if (lp.radius[i] == 0.f) {
+				nx = ny = zero;
+				nz = one;
+			}
+			else {
+				__m128 invR = _mm_set1_ps(lp.invRadius[i]);
+				nx = _mm_mul_ps(hx, invR);
+				ny = _mm_mul_ps(hy, invR);
+				nz = _mm_mul_ps(_mm_sub_ps(hz, cz), invR);
+			}
+			__m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(A));
+			__m128 wx = _mm_xor_ps(_mm_mul_ps(dx, invLen), signBit);
+			__m128 wy = _mm_xor_ps(_mm_mul_ps(dy, invLen), signBit);
+			__m128 wz = _mm_xor_ps(_mm_mul_ps(dz, invLen), signBit);
+			__m128 cosThetaI = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, wx),
+				_mm_mul_ps(ny, wy)), _mm_mul_ps(nz, wz));
+			__m128 flip = _mm_and_ps(cosThetaI, signBit);
+			nx = _mm_xor_ps(nx, flip);
+			ny = _mm_xor_ps(ny, flip);
+			nz = _mm_xor_ps(nz, flip);
+			cosThetaI = _mm_xor_ps(cosThetaI, flip);
+			// Refract packet with Snell's law, masking total internal reflection
+			__m128 eta = laneEta ? _mm_loadu_ps(laneEta + i * LENS_PACKET_SIZE) :
+				_mm_set1_ps(fromFilm ? lp.etaFromFilm[i] : lp.etaFromScene[i]);
+			__m128 sin2ThetaT = _mm_mul_ps(_mm_mul_ps(eta, eta),
+				_mm_max_ps(zero, _mm_sub_ps(one,
+					_mm_mul_ps(cosThetaI, cosThetaI))));
+			active = _mm_and_ps(active, _mm_cmplt_ps(sin2ThetaT, one));
+			__m128 cosThetaT = _mm_sqrt_ps(_mm_max_ps(zero,
+				_mm_sub_ps(one, sin2ThetaT)));
+			__m128 k = _mm_sub_ps(_mm_mul_ps(eta, cosThetaI), cosThetaT);
+			if (deriv)
+				for (int axis = 0; axis < 2; ++axis) {
+					// Differentiate the transfer to the surface and Snell's
+					// law, as _Differentiate()_ does
+					__m128 *dp = dod[axis], *dd = ddd[axis];
+					TransferDerivativeSSE(t, nx, ny, nz, dx, dy, dz, dp, dd);
+					__m128 dn[3] = { zero, zero, zero };
+					if (lp.isAspheric[i]) {
+						__m128 du = _mm_add_ps(_mm_mul_ps(hx, dp[0]),
+							_mm_mul_ps(hy, dp[1]));
+						du = _mm_mul_ps(_mm_add_ps(du, du), dds);
+						__m128 dgx = _mm_add_ps(_mm_mul_ps(ds, dp[0]),
+							_mm_mul_ps(du, hx));
+						__m128 dgy = _mm_add_ps(_mm_mul_ps(ds, dp[1]),
+							_mm_mul_ps(du, hy));
+						dgx = _mm_add_ps(dgx, dgx);
+						dgy = _mm_add_ps(dgy, dgy);
+						__m128 ndg = _mm_add_ps(_mm_mul_ps(nx, dgx),
+							_mm_mul_ps(ny, dgy));
+						__m128 scale = _mm_xor_ps(invG, flip);
+						dn[0] = _mm_mul_ps(scale,
+							_mm_sub_ps(dgx, _mm_mul_ps(ndg, nx)));
+						dn[1] = _mm_mul_ps(scale,
+							_mm_sub_ps(dgy, _mm_mul_ps(ndg, ny)));
+						dn[2] = _mm_mul_ps(scale,
+							_mm_xor_ps(_mm_mul_ps(ndg, nz), signBit));
+					}
+					else if (lp.radius[i] != 0.f) {
+						__m128 invR = _mm_xor_ps(_mm_set1_ps(lp.invRadius[i]),
+							flip);
+						for (int c = 0; c < 3; ++c)
+							dn[c] = _mm_mul_ps(invR, dp[c]);
+					}
+					__m128 dCosThetaI = _mm_sub_ps(
+						_mm_add_ps(_mm_add_ps(_mm_mul_ps(dn[0], wx),
+							_mm_mul_ps(dn[1], wy)), _mm_mul_ps(dn[2], wz)),
+						_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dd[0]),
+							_mm_mul_ps(ny, dd[1])), _mm_mul_ps(nz, dd[2])));
+					__m128 dCosThetaT = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(eta, eta),
+						_mm_mul_ps(cosThetaI, dCosThetaI)), cosThetaT);
+					__m128 dk = _mm_sub_ps(_mm_mul_ps(eta, dCosThetaI),
+						dCosThetaT);
+					__m128 n[3] = { nx, ny, nz };
+					for (int c = 0; c < 3; ++c)
+						dd[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(eta, dd[c]),
+							_mm_mul_ps(dk, n[c])), _mm_mul_ps(k, dn[c]));
+				}
+			dx = _mm_sub_ps(_mm_mul_ps(k, nx), _mm_mul_ps(eta, wx));
+			dy = _mm_sub_ps(_mm_mul_ps(k, ny), _mm_mul_ps(eta, wy));
+			dz = _mm_sub_ps(_mm_mul_ps(k, nz), _mm_mul_ps(eta, wz));
+			ox = hx; oy = hy; oz = hz;
+		}
+		_mm_storeu_ps(rOut->ox, ox); _mm_storeu_ps(rOut->oy, oy);
+		_mm_storeu_ps(rOut->oz, oz); _mm_storeu_ps(rOut->dx, dx);
+		_mm_storeu_ps(rOut->dy, dy); _mm_storeu_ps(rOut->dz, dz);
+		if (deriv)
+			for (int k = 0; k < 2; ++k)
+				for (int c = 0; c < 3; ++c) {
+					_mm_storeu_ps(deriv->dod[k][c], dod[k][c]);
+					_mm_storeu_ps(deriv->ddd[k][c], ddd[k][c]);
+				}
+		return _mm_movemask_ps(active);
+	}
+#else
+	int TracePacket(const LensRayPacket &rIn, LensRayPacket *rOut,
+			int activeMask, bool fromFilm, const float *laneEta,
+			LensDerivativePacket *deriv) const {
+		// Trace packet lanes one at a time without SSE; derivatives are
+		// carried with the prescription's own refraction ratios
+		int hitMask = 0;
+		for (int lane = 0; lane < LENS_PACKET_SIZE; ++lane) {
+			if (!(activeMask & (1 << lane))) continue;
+			Ray r(Point(rIn.ox[lane], rIn.oy[lane], rIn.oz[lane]),
+			      Vector(rIn.dx[lane], rIn.dy[lane], rIn.dz[lane]),
+			      0.f, INFINITY), rLens;
+			bool passed;
+			if (!fromFilm)
+				passed = TraceFromScene(r, &rLens);
+			else if (deriv) {
+				LensRayDerivatives d;
+				float *v = &d.dodx.x;
+				for (int k = 0; k < 2; ++k)
+					for (int c = 0; c < 3; ++c) {
+						v[6 * k + c] = deriv->dod[k][c][lane];
+						v[6 * k + 3 + c] = deriv->ddd[k][c][lane];
+					}
+				passed = TraceDifferentialFromFilm(r, &rLens, &d);
+				for (int k = 0; k < 2; ++k)
+					for (int c = 0; c < 3; ++c) {
+						deriv->dod[k][c][lane] = v[6 * k + c];
+						deriv->ddd[k][c][lane] = v[6 * k + 3 + c];
+					}
+			}
+			else
+				passed = laneEta ? TraceFromFilmWithEta(r, &rLens,
+					laneEta + lane, LENS_PACKET_SIZE) : TraceFromFilm(r, &rLens);
+			if (!passed) continue;
+			rOut->ox[lane] = rLens.o.x; rOut->oy[lane] = rLens.o.y;
+			rOut->oz[lane] = rLens.o.z; rOut->dx[lane] = rLens.d.x;
+			rOut->dy[lane] = rLens.d.y; rOut->dz[lane] = rLens.d.z;
+			hitMask |= (1 << lane);
+		}
+		return hitMask;
+	}
+#endif // PBRT_LENS_SSE
+	// LensPrescription Data, one entry per surface from front to back
+	vector<float> zpos, centerZ, radius, radius2, invRadius, aperture2;
+	vector<float> etaFromFilm, etaFromScene;
+	vector<char> isStop;
+	vector<float> conic, asphere;
+	vector<char> isAspheric;
+	// Blade shape of the aperture stop, whose corners lie on its circle
+	LensIris iris;
+private:
+	// LensPrescription Private Methods
+#ifdef PBRT_LENS_SSE
+	static void AsphereSagSSE(const LensPrescription &lp, int i,
+			__m128 u, __m128 *s, __m128 *ds, __m128 *valid,
+			__m128 *dds = NULL) {
+		// Evaluate conic sag and its derivatives in $u = r^2$, clearing
+		// lanes beyond the conic's extent
+		float c = (lp.radius[i] != 0.f) ? 1.f / lp.radius[i] : 0.f;
+		__m128 cv = _mm_set1_ps(c), one = _mm_set1_ps(1.f);
+		__m128 q2 = _mm_sub_ps(one,
+			_mm_mul_ps(_mm_set1_ps((1.f + lp.conic[i]) * c * c), u));
+		*valid = _mm_and_ps(*valid, _mm_cmpgt_ps(q2, _mm_setzero_ps()));
+		__m128 q = _mm_sqrt_ps(_mm_max_ps(q2, _mm_set1_ps(1e-12f)));
+		*s = _mm_div_ps(_mm_mul_ps(cv, u), _mm_add_ps(one, q));
+		*ds = _mm_div_ps(_mm_set1_ps(.5f * c), q);
+		// Add even polynomial terms with Horner's rule
+		const float *a = &lp.asphere[i * LENS_ASPHERE_TERMS];
+		__m128 p = _mm_setzero_ps(), dp = _mm_setzero_ps();
+		__m128 ddp = _mm_setzero_ps();
+		for (int j = LENS_ASPHERE_TERMS - 1; j >= 0; --j) {
+			p = _mm_add_ps(_mm_mul_ps(p, u), _mm_set1_ps(a[j]));
+			dp = _mm_add_ps(_mm_mul_ps(dp, u), _mm_set1_ps((j + 2) * a[j]));
+			ddp = _mm_add_ps(_mm_mul_ps(ddp, u),
+				_mm_set1_ps((j + 2) * (j + 1) * a[j]));
+		}
+		*s = _mm_add_ps(*s, _mm_mul_ps(p, _mm_mul_ps(u, u)));
+		*ds = _mm_add_ps(*ds, _mm_mul_ps(dp, u));
+		if (dds)
+			*dds = _mm_add_ps(ddp, _mm_div_ps(
+				_mm_set1_ps(.25f * (1.f + lp.conic[i]) * c * c * c),
+				_mm_mul_ps(q, _mm_max_ps(q2, _mm_set1_ps(1e-12f)))));
+	}
+	static void TransferDerivativeSSE(__m128 t, __m128 nx, __m128 ny,
+			__m128 nz, __m128 dx, __m128 dy, __m128 dz, __m128 dod[3],
+			const __m128 ddd[3]) {
+		// Move origin derivatives to the hit point, staying in the surface's
+		// tangent plane; the normal's sign cancels
+		__m128 px = _mm_add_ps(dod[0], _mm_mul_ps(t, ddd[0]));
+		__m128 py = _mm_add_ps(dod[1], _mm_mul_ps(t, ddd[1]));
+		__m128 pz = _mm_add_ps(dod[2], _mm_mul_ps(t, ddd[2]));
+		__m128 f = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px),
+			_mm_mul_ps(ny, py)), _mm_mul_ps(nz, pz)),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)),
+				_mm_mul_ps(nz, dz)));
+		dod[0] = _mm_sub_ps(px, _mm_mul_ps(f, dx));
+		dod[1] = _mm_sub_ps(py, _mm_mul_ps(f, dy));
+		dod[2] = _mm_sub_ps(pz, _mm_mul_ps(f, dz));
+	}
+#endif // PBRT_LENS_SSE
+	bool Interact(int i, float eta, Ray *ray, Point *pHits,
+			LensRayDerivatives *deriv = NULL) const {
+		const Point &o = ray->o;
+		const Vector &d = ray->d;
+		float t;
+		if (isAspheric[i]) {
+			if (!IntersectAsphere(i, *ray, &t)) return false;
+		}
+		else if (radius[i] == 0.f) {
+			// Intersect ray with aperture stop or flat surface plane
+			if (d.z == 0.f) return false;
+			t = (zpos[i] - o.z) / d.z;
+		}
+		else {
+			// Intersect ray with spherical surface, picking the root on
+			// the side of the sphere that faces the ray
+			float ocz = o.z - centerZ[i];
+			float A = d.x * d.x + d.y * d.y + d.z * d.z;
+			float B = 2.f * (d.x * o.x + d.y * o.y + d.z * ocz);
+			float C = o.x * o.x + o.y * o.y + ocz * ocz - radius2[i];
+			float t0, t1;
+			if (!Quadratic(A, B, C, &t0, &t1)) return false;
+			t = ((d.z > 0.f) == (radius[i] < 0.f)) ? t0 : t1;
+		}
+		if (t < 0.f) return false;
+		Point pHit = (*ray)(t);
+		// Test the hit against the surface's circle or the iris blades
+		float r2 = pHit.x * pHit.x + pHit.y * pHit.y;
+		if (isStop[i] && iris.IsPolygon()) {
+			float r = iris.Norm(pHit.x, pHit.y);
+			r2 = r * r;
+		}
+		if (r2 > aperture2[i]) return false;
+		if (pHits) pHits[i] = pHit;
+		if (!isStop[i] || deriv) {
+			// Refract ray at the surface
+			Vector n = isAspheric[i] ? AsphereNormal(i, pHit) :
+				(radius[i] == 0.f) ? Vector(0.f, 0.f, 1.f) :
+				invRadius[i] * Vector(pHit.x, pHit.y, pHit.z - centerZ[i]);
+			Vector wi = -Normalize(d), wt = -wi;
+			float nSign = 1.f;
+			if (Dot(n, wi) < 0.f) { n = -n; nSign = -1.f; }
+			if (!isStop[i] && !Refract(wi, n, eta, &wt)) return false;
+			if (deriv) {
+				Differentiate(i, eta, wi, wt, n, nSign, t, pHit,
+					&deriv->dodx, &deriv->dddx);
+				Differentiate(i, eta, wi, wt, n, nSign, t, pHit,
+					&deriv->dody, &deriv->dddy);
+			}
+			ray->d = wt;
+		}
+		ray->o = pHit;
+		return true;
+	}
+	bool IntersectAsphere(int i, const Ray &ray, float *tHit) const {
+		// Seed Newton's method with the base sphere's hit, or with the
+		// vertex plane where there is none
+		const Point &o = ray.o;
+		const Vector &d = ray.d;
+		float t = -1.f;
+		if (radius[i] != 0.f) {
+			float ocz = o.z - centerZ[i];
+			float A = d.x * d.x + d.y * d.y + d.z * d.z;
+			float B = 2.f * (d.x * o.x + d.y * o.y + d.z * ocz);
+			float C = o.x * o.x + o.y * o.y + ocz * ocz - radius2[i];
+			float t0, t1;
+			if (Quadratic(A, B, C, &t0, &t1))
+				t = ((d.z > 0.f) == (radius[i] < 0.f)) ? t0 : t1;
+		}
+		if (t < 0.f) {
+			if (d.z == 0.f) return false;
+			t = (zpos[i] - o.z) / d.z;
+		}
+		// Solve $z(t) - z_0 + s(x(t)^2 + y(t)^2) = 0$ for the surface hit,
+		// giving up on rays that wander well beyond the clear aperture,
+		// where the polynomial terms need not describe a real surface
+		for (int iter = 1; iter <= LENS_NEWTON_ITERATIONS; ++iter) {
+			Point p = ray(t);
+			float u = p.x * p.x + p.y * p.y, s, ds;
+			if (u > 4.f * aperture2[i]) {
+				CountNewton(1, iter, 0);
+				return false;
+			}
+			if (!Sag(i, u, &s, &ds)) break;
+			float g = p.z - zpos[i] + s;
+			float dg = d.z + 2.f * ds * (p.x * d.x + p.y * d.y);
+			if (dg == 0.f) break;
+			float dt = g / dg;
+			t -= dt;
+			if (fabsf(dt) <= LENS_NEWTON_TOLERANCE) {
+				CountNewton(1, iter, 0);
+				*tHit = t;
+				return true;
+			}
+		}
+		CountNewton(1, LENS_NEWTON_ITERATIONS, 1);
+		return false;
+	}
+	Vector AsphereNormal(int i, const Point &p) const {
+		// Normalize the gradient of $z - z_0 + s(x^2 + y^2)$
+		float s, ds = 0.f;
+		Sag(i, p.x * p.x + p.y * p.y, &s, &ds);
+		return Normalize(Vector(2.f * ds * p.x, 2.f * ds * p.y, 1.f));
+	}
+	void Differentiate(int i, float eta, const Vector &wi,
+			const Vector &wt, const Vector &n, float nSign, float t,
+			const Point &pHit, Vector *dod, Vector *ddd) const {
+		// Transfer origin derivative to the hit point on the surface
+		Vector dp = *dod + t * *ddd;
+		dp -= (Dot(n, dp) / Dot(n, wi)) * wi;
+		*dod = dp;
+		if (isStop[i]) return;
+		// Differentiate Snell's law for the refracted direction
+		Vector dn = (radius[i] == 0.f) ? Vector(0.f, 0.f, 0.f) :
+			(nSign * invRadius[i]) * dp;
+		if (isAspheric[i]) {
+			// Differentiate the normalized sag gradient along the surface
+			float s, ds = 0.f, dds = 0.f;
+			Sag(i, pHit.x * pHit.x + pHit.y * pHit.y, &s, &ds, &dds);
+			float du = 2.f * (pHit.x * dp.x + pHit.y * dp.y);
+			Vector g(2.f * ds * pHit.x, 2.f * ds * pHit.y, 1.f);
+			Vector dg(2.f * (ds * dp.x + dds * du * pHit.x),
+			          2.f * (ds * dp.y + dds * du * pHit.y), 0.f);
+			Vector n0 = nSign * n;
+			dn = (nSign / g.Length()) * (dg - Dot(n0, dg) * n0);
+		}
+		Vector dwi = -*ddd;
+		float cosThetaI = Dot(n, wi), cosThetaT = -Dot(n, wt);
+		float dCosThetaI = Dot(dn, wi) + Dot(n, dwi);
+		float dCosThetaT = eta * eta * cosThetaI * dCosThetaI / cosThetaT;
+		float mu = eta * cosThetaI - cosThetaT;
+		float dmu = eta * dCosThetaI - dCosThetaT;
+		*ddd = -eta * dwi + dmu * n + mu * dn;
+	}
+	// LensPrescription Private Data
+	vector<float> etaBehind;
+};
+#endif // PBRT_LENS_H
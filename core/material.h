@@ -34,7 +34,8 @@ class COREDLL Material : public ReferenceCounted {
 public:
 	// Material Interface
 	virtual BSDF *GetBSDF(const DifferentialGeometry &dgGeom,
-		const DifferentialGeometry &dgShading) const = 0;
+		const DifferentialGeometry &dgShading,
+		MemoryArena &arena) const = 0;
 	virtual ~Material();
 	static void Bump(Reference<Texture<float> > d, const DifferentialGeometry &dgGeom,
 		const DifferentialGeometry &dgShading, DifferentialGeometry *dgBump);
@@ -0,0 +1,152 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+// parallel.cpp*
+#include "parallel.h"
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
+// Mutex Method Definitions
+Mutex::Mutex() {
+#if defined(WIN32)
+	InitializeCriticalSection(&criticalSection);
+#else
+	pthread_mutex_init(&mutex, NULL);
+#endif
+}
+Mutex::~Mutex() {
+#if defined(WIN32)
+	DeleteCriticalSection(&criticalSection);
+#else
+	pthread_mutex_destroy(&mutex);
+#endif
+}
+void Mutex::Lock() {
+#if defined(WIN32)
+	EnterCriticalSection(&criticalSection);
+#else
+	pthread_mutex_lock(&mutex);
+#endif
+}
+void Mutex::Unlock() {
+#if defined(WIN32)
+	LeaveCriticalSection(&criticalSection);
+#else
+	pthread_mutex_unlock(&mutex);
+#endif
+}
+// WorkStealingQueue Method Definitions
+WorkStealingQueue::WorkStealingQueue(int nItems, int nWorkers)
+	: queues(nWorkers) {
+	// Deal items to workers in turn, so that each works through the
+	// items in increasing order
+	for (int i = 0; i < nItems; ++i)
+		queues[i % nWorkers].push_back(i);
+	for (int w = 0; w < nWorkers; ++w)
+		mutexes.push_back(new Mutex);
+}
+WorkStealingQueue::~WorkStealingQueue() {
+	for (u_int w = 0; w < mutexes.size(); ++w)
+		delete mutexes[w];
+}
+bool WorkStealingQueue::Next(int worker, int *item) {
+	// Take the next item from the worker's own queue
+	{
+		MutexLock lock(*mutexes[worker]);
+		if (!queues[worker].empty()) {
+			*item = queues[worker].front();
+			queues[worker].pop_front();
+			return true;
+		}
+	}
+	// Steal the last item of another worker's queue
+	int nWorkers = int(queues.size());
+	for (int i = 1; i < nWorkers; ++i) {
+		int victim = (worker + i) % nWorkers;
+		MutexLock lock(*mutexes[victim]);
+		if (!queues[victim].empty()) {
+			*item = queues[victim].back();
+			queues[victim].pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+// Parallel Function Definitions
+COREDLL int NumSystemCores() {
+#if defined(WIN32)
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	return max(1, int(sysinfo.dwNumberOfProcessors));
+#else
+	return max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+#endif
+}
+struct ThreadArgs {
+	void (*func)(int thread, void *data);
+	void *data;
+	int thread;
+};
+#if defined(WIN32)
+static DWORD WINAPI ThreadEntry(LPVOID arg) {
+#else
+static void *ThreadEntry(void *arg) {
+#endif
+	ThreadArgs *args = (ThreadArgs *)arg;
+	args->func(args->thread, args->data);
+	return 0;
+}
+COREDLL void RunThreads(int nThreads,
+		void (*func)(int thread, void *data), void *data) {
+	// Start threads $1 \ldots n-1$ and run thread 0 on the caller
+	vector<ThreadArgs> args(nThreads);
+	for (int i = 0; i < nThreads; ++i) {
+		args[i].func = func;
+		args[i].data = data;
+		args[i].thread = i;
+	}
+#if defined(WIN32)
+	vector<HANDLE> threads(nThreads, (HANDLE)NULL);
+	for (int i = 1; i < nThreads; ++i) {
+		threads[i] = CreateThread(NULL, 0, ThreadEntry, &args[i], 0, NULL);
+		if (!threads[i]) Severe("Unable to create rendering thread");
+	}
+	func(0, data);
+	for (int i = 1; i < nThreads; ++i) {
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+#else
+	// Give threads the main thread's usual stack size for deep ray trees
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);
+	vector<pthread_t> threads(nThreads);
+	for (int i = 1; i < nThreads; ++i)
+		if (pthread_create(&threads[i], &attr, ThreadEntry, &args[i]) != 0)
+			Severe("Unable to create rendering thread");
+	pthread_attr_destroy(&attr);
+	func(0, data);
+	for (int i = 1; i < nThreads; ++i)
+		pthread_join(threads[i], NULL);
+#endif
+}
@@ -0,0 +1,78 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef PBRT_PARALLEL_H
+#define PBRT_PARALLEL_H
+// parallel.h*
+#include "pbrt.h"
+#if !defined(WIN32)
+#include <pthread.h>
+#endif
+#include <deque>
+// Parallel Declarations
+// Width and height in pixels of the image tiles that rendering threads
+// take from the work queue
+#define TILE_SIZE 16
+class COREDLL Mutex {
+public:
+	// Mutex Public Methods
+	Mutex();
+	~Mutex();
+	void Lock();
+	void Unlock();
+private:
+	// Mutex Private Data
+#if defined(WIN32)
+	CRITICAL_SECTION criticalSection;
+#else
+	pthread_mutex_t mutex;
+#endif
+	Mutex(const Mutex &);
+	Mutex &operator=(const Mutex &);
+};
+class MutexLock {
+public:
+	// MutexLock Public Methods
+	MutexLock(Mutex &m) : mutex(m) { mutex.Lock(); }
+	~MutexLock() { mutex.Unlock(); }
+private:
+	// MutexLock Private Data
+	Mutex &mutex;
+	MutexLock(const MutexLock &);
+	MutexLock &operator=(const MutexLock &);
+};
+class COREDLL WorkStealingQueue {
+public:
+	// WorkStealingQueue Public Methods
+	WorkStealingQueue(int nItems, int nWorkers);
+	~WorkStealingQueue();
+	bool Next(int worker, int *item);
+private:
+	// WorkStealingQueue Private Data
+	vector<std::deque<int> > queues;
+	vector<Mutex *> mutexes;
+};
+// Parallel Function Declarations
+COREDLL int NumSystemCores();
+COREDLL void RunThreads(int nThreads,
+	void (*func)(int thread, void *data), void *data);
+#endif // PBRT_PARALLEL_H
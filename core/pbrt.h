@@ -112,6 +112,11 @@ extern "C" {
 #define DLLEXPORT
 #endif
 #ifdef WIN32
+#define PBRT_THREAD_LOCAL __declspec(thread)
+#else
+#define PBRT_THREAD_LOCAL __thread
+#endif
+#ifdef WIN32
 #define PBRT_PATH_SEP ";"
 #else
 #define PBRT_PATH_SEP ":"
@@ -210,6 +215,15 @@ class VolumeIntegrator;
 #define PBRT_VERSION 1.05
 #define RAY_EPSILON 1e-3f
 #define COLOR_SAMPLES 3
+// Global Options
+struct Options {
+	Options() { nCores = 0; seed = 0; timeBudget = 0.f; }
+	int nCores;     // Rendering threads; zero starts one per core
+	u_long seed;    // Seed of the per-tile random number streams
+	float timeBudget; // Seconds after which no new sampler pass starts;
+	                  // zero renders every pass
+};
+extern COREDLL Options PbrtOptions;
 // Global Function Declarations
 // Setup printf format
 #ifdef __GNUG__
@@ -231,12 +245,18 @@ COREDLL bool SolveLinearSystem2x2(const float A[2][2], const float B[2],
 COREDLL unsigned long genrand_int32(void);
 COREDLL extern float genrand_real1(void);
 COREDLL extern float genrand_real2(void);
+COREDLL void SeedRandom(u_long seed);
 COREDLL Spectrum *ReadImage(const string &name, int *xSize,
 	int *ySize);
 COREDLL void WriteRGBAImage(const string &name,
 	float *pixels, float *alpha, int XRes, int YRes,
 	int totalXRes, int totalYRes, int xOffset, int yOffset);
-COREDLL void pbrtInit();
+COREDLL float *ReadDepthImage(const string &name, int *xSize,
+	int *ySize);
+COREDLL void WriteDepthImage(const string &name,
+	float *depth, int XRes, int YRes,
+	int totalXRes, int totalYRes, int xOffset, int yOffset);
+COREDLL void pbrtInit(const Options &opt = Options());
 COREDLL void pbrtCleanup();
 COREDLL Transform Translate(const Vector &delta);
 COREDLL Transform Scale(float x, float y, float z);
@@ -294,6 +314,7 @@ public:
 	StatsCounter(const string &category, const string &name);
 	void operator++() { ++num; }
 	void operator++(int) { ++num; }
+	void operator+=(int n) { num += n; }
 	void Max(StatsCounterType val) { num = max(val, num); }
 	void Min(StatsCounterType val) { num = min(val, num); }
 	operator double() const { return (double)num; }
@@ -319,10 +340,38 @@ private:
 	// StatsPercentage Private Data
 	StatsCounterType na, nb;
 };
+// Atomic Operations
+inline int AtomicAdd(volatile int *v, int delta) {
+#if defined(WIN32)
+	return InterlockedExchangeAdd((volatile LONG *)v, delta) + delta;
+#else
+	return __sync_add_and_fetch(v, delta);
+#endif
+}
+// Flags written by one thread and read without a lock by others; the
+// release store orders earlier writes before the flag, and the acquire
+// load orders later reads after it
+inline int AtomicLoadAcquire(volatile int *v) {
+#if defined(WIN32)
+	// Visual C++ gives volatile reads acquire semantics
+	return *v;
+#else
+	return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+#endif
+}
+inline void AtomicStoreRelease(volatile int *v, int value) {
+#if defined(WIN32)
+	// Visual C++ gives volatile writes release semantics
+	*v = value;
+#else
+	__atomic_store_n(v, value, __ATOMIC_RELEASE);
+#endif
+}
 class COREDLL ReferenceCounted {
 public:
 	ReferenceCounted() { nReferences = 0; }
-	int nReferences;
+	// Shared objects are referenced from several rendering threads
+	volatile int nReferences;
 private:
 	ReferenceCounted(const ReferenceCounted &);
 	ReferenceCounted &operator=(const ReferenceCounted &);
@@ -332,26 +381,26 @@ public:
 	// Reference Public Methods
 	Reference(T *p = NULL) {
 		ptr = p;
-		if (ptr) ++ptr->nReferences;
+		if (ptr) AtomicAdd(&ptr->nReferences, 1);
 	}
 	Reference(const Reference<T> &r) {
 		ptr = r.ptr;
-		if (ptr) ++ptr->nReferences;
+		if (ptr) AtomicAdd(&ptr->nReferences, 1);
 	}
 	Reference &operator=(const Reference<T> &r) {
-		if (r.ptr) r.ptr->nReferences++;
-		if (ptr && --ptr->nReferences == 0) delete ptr;
+		if (r.ptr) AtomicAdd(&r.ptr->nReferences, 1);
+		if (ptr && AtomicAdd(&ptr->nReferences, -1) == 0) delete ptr;
 		ptr = r.ptr;
 		return *this;
 	}
 	Reference &operator=(T *p) {
-		if (p) p->nReferences++;
-		if (ptr && --ptr->nReferences == 0) delete ptr;
+		if (p) AtomicAdd(&p->nReferences, 1);
+		if (ptr && AtomicAdd(&ptr->nReferences, -1) == 0) delete ptr;
 		ptr = p;
 		return *this;
 	}
 	~Reference() {
-		if (ptr && --ptr->nReferences == 0)
+		if (ptr && AtomicAdd(&ptr->nReferences, -1) == 0)
 			delete ptr;
 	}
 	T *operator->() { return ptr; }
@@ -401,7 +450,7 @@ public:
 	// MemoryArena Public Methods
 	MemoryArena(u_int bs = 32768) {
 		blockSize = bs;
-		curBlockPos = 0;
+		curBlockPos = usedBlockBytes = 0;
 		currentBlock = (char *)AllocAligned(blockSize);
 	}
 	~MemoryArena() {
@@ -417,6 +466,7 @@ public:
 		if (curBlockPos + sz > blockSize) {
 			// Get new block of memory for _MemoryArena_
 			usedBlocks.push_back(currentBlock);
+			usedBlockBytes += curBlockPos;
 			if (availableBlocks.size() && sz <= blockSize) {
 				currentBlock = availableBlocks.back();
 				availableBlocks.pop_back();
@@ -429,8 +479,12 @@ public:
 		curBlockPos += sz;
 		return ret;
 	}
+	u_int BytesAllocated() const {
+		return usedBlockBytes + curBlockPos;
+	}
+	u_int BlockSize() const { return blockSize; }
 	void FreeAll() {
-		curBlockPos = 0;
+		curBlockPos = usedBlockBytes = 0;
 		while (usedBlocks.size()) {
 			availableBlocks.push_back(usedBlocks.back());
 			usedBlocks.pop_back();
@@ -438,7 +492,7 @@ public:
 	}
 private:
 	// MemoryArena Private Data
-	u_int curBlockPos, blockSize;
+	u_int curBlockPos, blockSize, usedBlockBytes;
 	char *currentBlock;
 	vector<char *> usedBlocks, availableBlocks;
 };
@@ -57,7 +57,7 @@ const AreaLight *Aggregate::GetAreaLight() const {
 	return NULL;
 }
 BSDF *Aggregate::GetBSDF(const DifferentialGeometry &,
-		const Transform &) const {
+		const Transform &, MemoryArena &) const {
 	Severe("Aggregate::GetBSDF() method"
 	    "called; should have gone to GeometricPrimitive");
 	return NULL;
@@ -125,19 +125,19 @@ const AreaLight *GeometricPrimitive::GetAreaLight() const {
 }
 BSDF *
 GeometricPrimitive::GetBSDF(const DifferentialGeometry &dg,
-		const Transform &WorldToObject) const {
+		const Transform &WorldToObject, MemoryArena &arena) const {
 	DifferentialGeometry dgs;
 	shape->GetShadingGeometry(WorldToObject.GetInverse(),
 		dg, &dgs);
-	return material->GetBSDF(dg, dgs);
+	return material->GetBSDF(dg, dgs, arena);
 }
 // Intersection Method Definitions
-BSDF *Intersection::GetBSDF(const RayDifferential &ray)
-		const {
+BSDF *Intersection::GetBSDF(const RayDifferential &ray,
+		MemoryArena &arena) const {
 	static StatsCounter pointsShaded("Shading", "Number of points shaded"); // NOBOOK
 	++pointsShaded; // NOBOOK
 	dg.ComputeDifferentials(ray);
-	return primitive->GetBSDF(dg, WorldToObject);
+	return primitive->GetBSDF(dg, WorldToObject, arena);
 }
 Spectrum Intersection::Le(const Vector &w) const {
 	const AreaLight *area = primitive->GetAreaLight();
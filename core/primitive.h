@@ -43,12 +43,12 @@ public:
 	const;
 	virtual const AreaLight *GetAreaLight() const = 0;
 	virtual BSDF *GetBSDF(const DifferentialGeometry &dg,
-		const Transform &WorldToObject) const = 0;
+		const Transform &WorldToObject, MemoryArena &arena) const = 0;
 };
 struct COREDLL Intersection {
 	// Intersection Public Methods
 	Intersection() { primitive = NULL; }
-	BSDF *GetBSDF(const RayDifferential &ray) const;
+	BSDF *GetBSDF(const RayDifferential &ray, MemoryArena &arena) const;
 	Spectrum Le(const Vector &wo) const;
 	DifferentialGeometry dg;
 	const Primitive *primitive;
@@ -68,7 +68,8 @@ public:
 	                   AreaLight *a);
 	const AreaLight *GetAreaLight() const;
 	BSDF *GetBSDF(const DifferentialGeometry &dg,
-	              const Transform &WorldToObject) const;
+	              const Transform &WorldToObject,
+	              MemoryArena &arena) const;
 private:
 	// GeometricPrimitive Private Data
 	Reference<Shape> shape;
@@ -88,7 +89,8 @@ public:
 	bool IntersectP(const Ray &r) const;
 	const AreaLight *GetAreaLight() const { return NULL; }
 	BSDF *GetBSDF(const DifferentialGeometry &dg,
-	              const Transform &WorldToObject) const {
+	              const Transform &WorldToObject,
+	              MemoryArena &arena) const {
 		return NULL;
 	}
 	BBox WorldBound() const {
@@ -104,6 +106,6 @@ public:
 	// Aggregate Public Methods
 	const AreaLight *GetAreaLight() const;
 	BSDF *GetBSDF(const DifferentialGeometry &dg,
-	              const Transform &) const;
+	              const Transform &, MemoryArena &) const;
 };
 #endif // PBRT_PRIMITIVE_H
@@ -506,4 +506,3 @@ Spectrum BSDF::rho(const Vector &wo, BxDFType flags) const {
 			ret += bxdfs[i]->rho(wo);
 	return ret;
 }
-MemoryArena BSDF::arena;
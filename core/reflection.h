@@ -100,8 +100,6 @@ public:
 	Spectrum rho(BxDFType flags = BSDF_ALL) const;
 	Spectrum rho(const Vector &wo,
 	             BxDFType flags = BSDF_ALL) const;
-	static void *Alloc(u_int sz) { return arena.Alloc(sz); }
-	static void FreeAll() { arena.FreeAll(); }
 	// BSDF Public Data
 	const DifferentialGeometry dgShading;
 	const float eta;
@@ -115,9 +113,8 @@ private:
 	int nBxDFs;
 	#define MAX_BxDFS 8
 	BxDF * bxdfs[MAX_BxDFS];
-	static MemoryArena arena;
 };
-#define BSDF_ALLOC(T)  new (BSDF::Alloc(sizeof(T))) T
+#define BSDF_ALLOC(arena, T)  new ((arena).Alloc(sizeof(T))) T
 // BxDF Declarations
 class COREDLL BxDF {
 public:
@@ -42,6 +42,19 @@ Sample::Sample(SurfaceIntegrator *surf,
 		VolumeIntegrator *vol, const Scene *scene) {
 	surf->RequestSamples(this, scene);
 	vol->RequestSamples(this, scene);
+	AllocateSampleMemory();
+	arena = NULL;
+}
+Sample *Sample::Duplicate() const {
+	// Copy the integrators' sample layout without requesting it again
+	Sample *s = new Sample;
+	s->n1D = n1D;
+	s->n2D = n2D;
+	s->AllocateSampleMemory();
+	s->arena = NULL;
+	return s;
+}
+void Sample::AllocateSampleMemory() {
 	// Allocate storage for sample pointers
 	int nPtrs = n1D.size() + n2D.size();
 	if (!nPtrs) {
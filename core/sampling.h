@@ -41,6 +41,18 @@ public:
 			(yPixelEnd - yPixelStart);
 	}
 	virtual int RoundSize(int size) const = 0;
+	// Return a new sampler of the same kind for a sub-rectangle of
+	// pixels, or _NULL_ if the sampler cannot be split
+	virtual Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+		return NULL;
+	}
+	// Samplers that cover the image in several passes return true once
+	// the film holds the previous pass; _GetNextSample()_ and new
+	// sub-samplers then generate the next one
+	virtual bool NextPass(const Film *film) {
+		return false;
+	}
 	// Sampler Public Data
 	int xPixelStart, xPixelEnd, yPixelStart, yPixelEnd;
 	int samplesPerPixel;
@@ -57,6 +69,13 @@ struct Sample {
 		n2D.push_back(num);
 		return n2D.size()-1;
 	}
+	Sample(const Sample &sample, float dx, float dy)
+		: imageX(sample.imageX + dx), imageY(sample.imageY + dy),
+		  lensU(sample.lensU), lensV(sample.lensV), time(sample.time),
+		  oneD(NULL), twoD(NULL), arena(NULL) {
+		// Copy only the camera sample, offset on the image plane
+	}
+	Sample *Duplicate() const;
 	~Sample() {
 		if (oneD != NULL) {
 			FreeAligned(oneD[0]);
@@ -70,6 +89,13 @@ struct Sample {
 	// Integrator _Sample_ Data
 	vector<u_int> n1D, n2D;
 	float **oneD, **twoD;
+	// Memory for the BSDFs created while computing this sample's value;
+	// each rendering thread has its own
+	MemoryArena *arena;
+private:
+	// Sample Private Methods
+	Sample() { }
+	void AllocateSampleMemory();
 };
 COREDLL void StratifiedSample1D(float *samples,
 					            int nsamples,
@@ -172,4 +198,38 @@ inline void LDShuffleScrambled2D(int nSamples,
 		Shuffle(samples + 2 * i * nSamples, nSamples, 2);
 	Shuffle(samples, nPixel, 2 * nSamples);
 }
+// Multi-pass samplers draw every sample dimension of a pixel from its own
+// scrambled sequence, continuing at sample _start_ where the previous
+// pass stopped, so that the samples of all passes together stay well
+// stratified
+inline u_int LDPixelScramble(int x, int y, int dim) {
+	u_int h = (u_int(x) * 73856093u) ^ (u_int(y) * 19349663u) ^
+		(u_int(dim) * 83492791u) ^ u_int(PbrtOptions.seed);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+inline void LDPixelSamples1D(int x, int y, int dim, int start,
+		int nPixel, int nSamples, float *samples) {
+	u_int scramble = LDPixelScramble(x, y, dim);
+	for (int i = 0; i < nSamples * nPixel; ++i)
+		samples[i] = VanDerCorput(nSamples * start + i, scramble);
+	// Decorrelate dimensions by shuffling within this pass's samples
+	for (int i = 0; i < nPixel; ++i)
+		Shuffle(samples + i * nSamples, nSamples, 1);
+	Shuffle(samples, nPixel, nSamples);
+}
+inline void LDPixelSamples2D(int x, int y, int dim, int start,
+		int nPixel, int nSamples, float *samples) {
+	u_int scramble[2] = { LDPixelScramble(x, y, 2 * dim),
+		LDPixelScramble(x, y, 2 * dim + 1) };
+	for (int i = 0; i < nSamples * nPixel; ++i)
+		Sample02(nSamples * start + i, scramble, &samples[2*i]);
+	for (int i = 0; i < nPixel; ++i)
+		Shuffle(samples + 2 * i * nSamples, nSamples, 2);
+	Shuffle(samples, nPixel, 2 * nSamples);
+}
 #endif // PBRT_SAMPLING_H
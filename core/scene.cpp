@@ -28,8 +28,153 @@
 #include "sampling.h"
 #include "dynload.h"
 #include "volume.h"
+#include "parallel.h"
+#include "timer.h"
+// Tile Rendering Declarations
+// BSDFs for one camera sample take a few hundred bytes (direct lighting)
+// to about ten kilobytes (path tracing and final gathering), so a block
+// holds from a handful to a couple of hundred samples
+#define BSDF_ARENA_BLOCK_SIZE 65536
+struct TileRenderer {
+	// TileRenderer Public Methods
+	void CommitTile(int tile, FilmTile *filmTile, int nSamples);
+	void FlushTiles();
+	// TileRenderer Data
+	Scene *scene;
+	vector<int> tileBounds;
+	vector<Sample *> samples;
+	int batchSize;
+	WorkStealingQueue *queue;
+	ProgressReporter *progress;
+	StatsCounter *cameraRaysTraced;
+	// Finished tiles wait here until every earlier tile is on the film,
+	// so that overlapping filter footprints always sum in the same order
+	Mutex commitMutex;
+	vector<FilmTile *> finished;
+	vector<int> finishedSamples;
+	int nextTile;
+	// Index of the sampler pass being rendered
+	int pass;
+	// Set once the time budget runs out; threads then start no new tiles
+	Timer *timer;
+	volatile bool outOfTime;
+};
+// Tile Rendering Functions
+static bool OutOfTime(Timer &timer) {
+	return PbrtOptions.timeBudget > 0.f &&
+		timer.Time() > PbrtOptions.timeBudget;
+}
+static Spectrum CameraSampleLi(const Scene *scene, const Sample *sample,
+		const RayDifferential &ray, float rayWeight,
+		const Spectrum &channelWeights, float *alpha) {
+	// Evaluate radiance along camera ray; rays the camera blocks are
+	// opaque black
+	*alpha = 1.f;
+	Spectrum Ls = 0.f;
+	if (rayWeight > 0.f)
+		Ls = rayWeight * channelWeights * scene->Li(ray, sample, alpha);
+	// Issue warning if unexpected radiance value returned
+	if (Ls.IsNaN()) {
+		Error("Not-a-number radiance value returned "
+	          "for image sample.  Setting to black.");
+		Ls = Spectrum(0.f);
+	}
+	else if (Ls.y() < -1e-5) {
+		Error("Negative luminance value, %g, returned "
+	          "for image sample.  Setting to black.", Ls.y());
+		Ls = Spectrum(0.f);
+	}
+	else if (isinf(Ls.y())) {
+		Error("Infinite luminance value returned "
+	          "for image sample.  Setting to black.");
+		Ls = Spectrum(0.f);
+	}
+	return Ls;
+}
+static void RenderTiles(int thread, void *data) {
+	TileRenderer *tr = (TileRenderer *)data;
+	Scene *scene = tr->scene;
+	// Give the camera its preferred number of samples at a time
+	int batch = tr->batchSize;
+	Sample **samples = &tr->samples[thread * batch];
+	vector<RayDifferential> rays(batch);
+	vector<Spectrum> channelWeights(batch);
+	vector<float> rayWeights(batch);
+	MemoryArena arena(BSDF_ARENA_BLOCK_SIZE);
+	for (int i = 0; i < batch; ++i)
+		samples[i]->arena = &arena;
+	u_int sampleBytes = 0;
+	int tile, nTiles = int(tr->finished.size());
+	while (!tr->outOfTime && tr->queue->Next(thread, &tile)) {
+		// Seed random numbers by tile and pass, so that the image does
+		// not depend on which thread renders it
+		SeedRandom(tile + nTiles * (PbrtOptions.seed + 65536 * tr->pass));
+		const int *b = &tr->tileBounds[4 * tile];
+		Sampler *sampler =
+			scene->sampler->GetSubSampler(b[0], b[1], b[2], b[3]);
+		FilmTile *filmTile =
+			scene->camera->film->GetFilmTile(b[0], b[1], b[2], b[3]);
+		int nSamples = 0, n = batch;
+		while (n == batch) {
+			// Find camera rays for the next batch of samples together; a
+			// short batch means the sampler is done
+			n = 0;
+			while (n < batch && sampler->GetNextSample(samples[n]))
+				++n;
+			if (n == 0) break;
+			scene->camera->GenerateRayDifferentials(samples, n, &rays[0],
+				&channelWeights[0], &rayWeights[0]);
+			for (int i = 0; i < n; ++i) {
+				float alpha;
+				u_int arenaBytes = arena.BytesAllocated();
+				Spectrum Ls = CameraSampleLi(scene, samples[i], rays[i],
+					rayWeights[i], channelWeights[i], &alpha);
+				filmTile->AddSample(*samples[i], rays[i], Ls, alpha);
+				// Free BSDF memory once the block could not hold the
+				// largest sample seen so far
+				sampleBytes = max(sampleBytes,
+					arena.BytesAllocated() - arenaBytes);
+				if (arena.BytesAllocated() + sampleBytes > arena.BlockSize())
+					arena.FreeAll();
+			}
+			nSamples += n;
+		}
+		arena.FreeAll();
+		delete sampler;
+		tr->CommitTile(tile, filmTile, nSamples);
+	}
+}
+void TileRenderer::CommitTile(int tile, FilmTile *filmTile,
+		int nSamples) {
+	MutexLock lock(commitMutex);
+	finished[tile] = filmTile;
+	finishedSamples[tile] = nSamples;
+	// Merge finished tiles into the film in tile order
+	while (nextTile < int(finished.size()) && finished[nextTile]) {
+		scene->camera->film->MergeFilmTile(finished[nextTile]);
+		*cameraRaysTraced += finishedSamples[nextTile];
+		progress->Update(finishedSamples[nextTile]);
+		finished[nextTile++] = NULL;
+	}
+	// Every pixel gets the first pass; later ones may stop part way
+	if (pass > 0 && OutOfTime(*timer))
+		outOfTime = true;
+}
+void TileRenderer::FlushTiles() {
+	// Merge the tiles finished after one that was never started
+	for (; nextTile < int(finished.size()); ++nextTile)
+		if (finished[nextTile]) {
+			scene->camera->film->MergeFilmTile(finished[nextTile]);
+			*cameraRaysTraced += finishedSamples[nextTile];
+			progress->Update(finishedSamples[nextTile]);
+			finished[nextTile] = NULL;
+		}
+}
 // Scene Methods
 void Scene::Render() {
+	// The time budget covers preprocessing as well as rendering
+	Timer timer;
+	timer.Start();
 	// Allocate and initialize _sample_
 	Sample *sample = new Sample(surfaceIntegrator,
 	                            volumeIntegrator,
@@ -37,49 +182,88 @@ void Scene::Render() {
 	// Allow integrators to do pre-processing for the scene
 	surfaceIntegrator->Preprocess(this);
 	volumeIntegrator->Preprocess(this);
-	// Trace rays: The main loop
+	// Choose the number of rendering threads
+	int nThreads = PbrtOptions.nCores > 0 ? PbrtOptions.nCores :
+		NumSystemCores();
+	if (nThreads > 1 && (!surfaceIntegrator->ThreadSafe() ||
+	                     !volumeIntegrator->ThreadSafe())) {
+		Warning("Integrators cannot run in parallel; "
+			"rendering with one thread.");
+		nThreads = 1;
+	}
 	ProgressReporter progress(sampler->TotalSamples(), "Rendering");
-	while (sampler->GetNextSample(sample)) {
-		// Find camera ray for _sample_
-		RayDifferential ray;
-		float rayWeight = camera->GenerateRay(*sample, &ray);
-		// Generate ray differentials for camera ray
-		++(sample->imageX);
-		float wt1 = camera->GenerateRay(*sample, &ray.rx);
-		--(sample->imageX);
-		++(sample->imageY);
-		float wt2 = camera->GenerateRay(*sample, &ray.ry);
-		if (wt1 > 0 && wt2 > 0) ray.hasDifferentials = true;
-		--(sample->imageY);
-		// Evaluate radiance along camera ray
-		float alpha;
-		Spectrum Ls = 0.f;
-		if (rayWeight > 0.f)
-			Ls = rayWeight * Li(ray, sample, &alpha);
-		// Issue warning if unexpected radiance value returned
-		if (Ls.IsNaN()) {
-			Error("Not-a-number radiance value returned "
-		          "for image sample.  Setting to black.");
-			Ls = Spectrum(0.f);
-		}
-		else if (Ls.y() < -1e-5) {
-			Error("Negative luminance value, %g, returned "
-		          "for image sample.  Setting to black.", Ls.y());
-			Ls = Spectrum(0.f);
+	static StatsCounter cameraRaysTraced("Camera", "Camera Rays Traced");
+	int xstart, xend, ystart, yend;
+	camera->film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
+	Sampler *tileSampler = sampler->GetSubSampler(xstart, xend,
+		ystart, yend);
+	if (tileSampler) {
+		// Split the image into tiles and render them in parallel
+		delete tileSampler;
+		TileRenderer tr;
+		tr.scene = this;
+		for (int y = ystart; y < yend; y += TILE_SIZE)
+			for (int x = xstart; x < xend; x += TILE_SIZE) {
+				tr.tileBounds.push_back(x);
+				tr.tileBounds.push_back(min(x + TILE_SIZE, xend));
+				tr.tileBounds.push_back(y);
+				tr.tileBounds.push_back(min(y + TILE_SIZE, yend));
+			}
+		int nTiles = int(tr.tileBounds.size()) / 4;
+		nThreads = max(1, min(nThreads, nTiles));
+		tr.batchSize = max(1, camera->RayBatchSize());
+		for (int i = 0; i < nThreads * tr.batchSize; ++i)
+			tr.samples.push_back(sample->Duplicate());
+		tr.progress = &progress;
+		tr.cameraRaysTraced = &cameraRaysTraced;
+		tr.finished.resize(nTiles, NULL);
+		tr.finishedSamples.resize(nTiles, 0);
+		tr.pass = 0;
+		tr.timer = &timer;
+		tr.outOfTime = false;
+		while (true) {
+			// Render every tile of the sampler's current pass
+			tr.queue = new WorkStealingQueue(nTiles, nThreads);
+			tr.nextTile = 0;
+			RunThreads(nThreads, RenderTiles, &tr);
+			tr.FlushTiles();
+			delete tr.queue;
+			++tr.pass;
+			if (tr.outOfTime || OutOfTime(timer) ||
+			    !sampler->NextPass(camera->film))
+				break;
+			// Store the image of the passes so far
+			camera->film->WriteImage();
 		}
-		else if (isinf(Ls.y())) {
-			Error("Infinite luminance value returned "
-		          "for image sample.  Setting to black.");
-			Ls = Spectrum(0.f);
+		for (u_int i = 0; i < tr.samples.size(); ++i)
+			delete tr.samples[i];
+	}
+	else {
+		// Trace rays: The main loop
+		MemoryArena arena(BSDF_ARENA_BLOCK_SIZE);
+		sample->arena = &arena;
+		for (int pass = 0; ; ++pass) {
+			while (!(pass > 0 && OutOfTime(timer)) &&
+			       sampler->GetNextSample(sample)) {
+				RayDifferential ray;
+				Spectrum channelWeights;
+				float rayWeight = camera->GenerateRayDifferential(*sample,
+					&ray, &channelWeights);
+				float alpha;
+				Spectrum Ls = CameraSampleLi(this, sample, ray, rayWeight,
+					channelWeights, &alpha);
+				// Add sample contribution to image
+				camera->film->AddSample(*sample, ray, Ls, alpha);
+				// Free BSDF memory from computing image sample value
+				arena.FreeAll();
+				// Report rendering progress
+				++cameraRaysTraced;
+				progress.Update();
+			}
+			if (OutOfTime(timer) || !sampler->NextPass(camera->film))
+				break;
+			camera->film->WriteImage();
 		}
-		// Add sample contribution to image
-		camera->film->AddSample(*sample, ray, Ls, alpha);
-		// Free BSDF memory from computing image sample value
-		BSDF::FreeAll();
-		// Report rendering progress
-		static StatsCounter cameraRaysTraced("Camera", "Camera Rays Traced");
-		++cameraRaysTraced;
-		progress.Update();
 	}
 	// Clean up after rendering and store final image
 	delete sample;
@@ -45,6 +45,9 @@ public:
 	virtual void RequestSamples(Sample *sample,
 	                            const Scene *scene) {
 	}
+	// Whether _Li()_ may be called from several threads at once, with
+	// results that do not depend on the order of the calls
+	virtual bool ThreadSafe() const { return false; }
 };
 class SurfaceIntegrator : public Integrator {
 };
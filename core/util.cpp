@@ -321,8 +321,9 @@ void StatsCleanup() {
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+// Each thread draws from its own generator state
+static PBRT_THREAD_LOCAL unsigned long mt[N]; /* the array for the state vector  */
+static PBRT_THREAD_LOCAL int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
 // Random Number Functions
 static void init_genrand(u_long seed) {
 	mt[0]= seed & 0xffffffffUL;
@@ -337,6 +338,9 @@ static void init_genrand(u_long seed) {
 		/* for >32 bit machines */
 	}
 }
+COREDLL void SeedRandom(u_long seed) {
+	init_genrand(seed);
+}
 COREDLL unsigned long genrand_int32(void)
 {
 	unsigned long y;
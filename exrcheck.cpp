@@ -3,6 +3,8 @@
 #include <ImfChannelList.h>
 #include <ImfFrameBuffer.h>
 #include <half.h>
+#include <stdio.h>
+#include <exception>
 
 using namespace Imf;
 using namespace Imath;
@@ -29,7 +31,52 @@ ReadImage(const char *name, int *width, int *height)
     file.readPixels(dw.min.y, dw.max.y);
 }
 
+// Write a FLOAT "Z" channel with an offset data window and read it back,
+// as pbrt's depth image I/O does
+bool
+DepthRoundTrip(const char *name)
+{
+    const int width = 3, height = 2, xOffset = 1, yOffset = 2;
+    float *depth = new float[width * height];
+    float *back = new float[width * height];
+    for (int i = 0; i < width * height; ++i)
+        depth[i] = 1.5f * i + .25f;
+    bool ok = true;
+    try {
+        Header header(Box2i(V2i(0, 0), V2i(7, 7)),
+                      Box2i(V2i(xOffset, yOffset),
+                            V2i(xOffset + width - 1, yOffset + height - 1)));
+        header.channels().insert("Z", Channel(FLOAT));
+        {
+            OutputFile file(name, header);
+            FrameBuffer frameBuffer;
+            frameBuffer.insert("Z", Slice(FLOAT,
+                (char *)(depth - xOffset - yOffset * width),
+                sizeof(float), width * sizeof(float)));
+            file.setFrameBuffer(frameBuffer);
+            file.writePixels(height);
+        }
+        InputFile file(name);
+        Box2i dw = file.header().dataWindow();
+        FrameBuffer frameBuffer;
+        frameBuffer.insert("Z", Slice(FLOAT,
+            (char *)(back - dw.min.x - dw.min.y * width),
+            sizeof(float), width * sizeof(float), 1, 1, 0.0));
+        file.setFrameBuffer(frameBuffer);
+        file.readPixels(dw.min.y, dw.max.y);
+    } catch (const std::exception &) {
+        ok = false;
+    }
+    remove(name);
+    for (int i = 0; ok && i < width * height; ++i)
+        if (back[i] != depth[i])
+            ok = false;
+    delete[] depth;
+    delete[] back;
+    return ok;
+}
+
 
 int main() {
-    return 0;
+    return DepthRoundTrip("exrcheck.exr") ? 0 : 1;
 }
@@ -35,7 +35,7 @@ public:
 	ImageFilm(int xres, int yres,
 	                     Filter *filt, const float crop[4],
 		             const string &filename, bool premult,
-		             int wf);
+		             int wf, const string &depthFilename);
 	~ImageFilm() {
 		delete pixels;
 		delete filter;
@@ -45,12 +45,18 @@ public:
 	               const Spectrum &L, float alpha);
 	void GetSampleExtent(int *xstart, int *xend,
 	                     int *ystart, int *yend) const;
+	FilmTile *GetFilmTile(int xstart, int xend,
+	                      int ystart, int yend);
+	void MergeFilmTile(FilmTile *tile);
+	bool GetPixelStatistics(int x, int y, int *nSamples,
+	                        float *mean, float *variance) const;
 	void WriteImage();
 private:
+	friend class ImageFilmTile;
 	// ImageFilm Private Data
 	Filter *filter;
 	int writeFrequency, sampleCount;
-	string filename;
+	string filename, depthFilename;
 	bool premultiplyAlpha;
 	float cropWindow[4];
 	int xPixelStart, yPixelStart, xPixelCount, yPixelCount;
@@ -58,21 +64,56 @@ private:
 		Pixel() : L(0.f) {
 			alpha = 0.f;
 			weightSum = 0.f;
+			depth = depthDist2 = INFINITY;
+			nSamples = 0;
+			yMean = yM2 = 0.f;
 		}
 		Spectrum L;
 		float alpha, weightSum;
+		float depth, depthDist2;
+		// Running mean and sum of squared deviations of the luminance
+		// of the samples inside the pixel
+		int nSamples;
+		float yMean, yM2;
 	};
 	BlockedArray<Pixel> *pixels;
 	float *filterTable;
+	// ImageFilm Private Methods
+	void AddSample(BlockedArray<Pixel> &pix, int x0Pix, int y0Pix,
+		int nxPix, int nyPix, const Sample &sample, const Ray &ray,
+		const Spectrum &L, float alpha) const;
+};
+// ImageFilmTile Declarations
+class ImageFilmTile : public FilmTile {
+public:
+	// ImageFilmTile Public Methods
+	ImageFilmTile(const ImageFilm *f, int x0, int y0, int nx, int ny)
+		: film(f), xPixelStart(x0), yPixelStart(y0),
+		  xPixelCount(nx), yPixelCount(ny), pixels(nx, ny) {
+		sampleCount = 0;
+	}
+	void AddSample(const Sample &sample, const Ray &ray,
+			const Spectrum &L, float alpha) {
+		film->AddSample(pixels, xPixelStart, yPixelStart,
+			xPixelCount, yPixelCount, sample, ray, L, alpha);
+		++sampleCount;
+	}
+	// ImageFilmTile Data
+	const ImageFilm *film;
+	int xPixelStart, yPixelStart, xPixelCount, yPixelCount;
+	BlockedArray<ImageFilm::Pixel> pixels;
+	int sampleCount;
 };
 // ImageFilm Method Definitions
 ImageFilm::ImageFilm(int xres, int yres,
                      Filter *filt, const float crop[4],
-		             const string &fn, bool premult, int wf)
+		             const string &fn, bool premult, int wf,
+		             const string &depthfn)
 	: Film(xres, yres) {
 	filter = filt;
 	memcpy(cropWindow, crop, 4 * sizeof(float));
 	filename = fn;
+	depthFilename = depthfn;
 	premultiplyAlpha = premult;
 	writeFrequency = sampleCount = wf;
 	// Compute film image extent
@@ -102,6 +143,37 @@ ImageFilm::ImageFilm(int xres, int yres,
 }
 void ImageFilm::AddSample(const Sample &sample,
 		const Ray &ray, const Spectrum &L, float alpha) {
+	AddSample(*pixels, xPixelStart, yPixelStart, xPixelCount,
+		yPixelCount, sample, ray, L, alpha);
+	// Possibly write out in-progress image
+	if (--sampleCount == 0) {
+		WriteImage();
+		sampleCount = writeFrequency;
+	}
+}
+void ImageFilm::AddSample(BlockedArray<Pixel> &pix, int x0Pix,
+		int y0Pix, int nxPix, int nyPix, const Sample &sample,
+		const Ray &ray, const Spectrum &L, float alpha) const {
+	int px = Floor2Int(sample.imageX), py = Floor2Int(sample.imageY);
+	if (px >= x0Pix && px < x0Pix + nxPix &&
+		py >= y0Pix && py < y0Pix + nyPix) {
+		Pixel &pixel = pix(px - x0Pix, py - y0Pix);
+		// Update luminance statistics of the pixel holding the sample
+		float y = L.y();
+		++pixel.nSamples;
+		float delta = y - pixel.yMean;
+		pixel.yMean += delta / pixel.nSamples;
+		pixel.yM2 += delta * (y - pixel.yMean);
+		// Keep the hit distance of the sample nearest each pixel center
+		if (depthFilename != "") {
+			float dx = sample.imageX - (px + .5f);
+			float dy = sample.imageY - (py + .5f);
+			if (dx * dx + dy * dy < pixel.depthDist2) {
+				pixel.depthDist2 = dx * dx + dy * dy;
+				pixel.depth = ray.maxt * ray.d.Length();
+			}
+		}
+	}
 	// Compute sample's raster extent
 	float dImageX = sample.imageX - 0.5f;
 	float dImageY = sample.imageY - 0.5f;
@@ -109,10 +181,10 @@ void ImageFilm::AddSample(const Sample &sample,
 	int x1 = Floor2Int(dImageX + filter->xWidth);
 	int y0 = Ceil2Int (dImageY - filter->yWidth);
 	int y1 = Floor2Int(dImageY + filter->yWidth);
-	x0 = max(x0, xPixelStart);
-	x1 = min(x1, xPixelStart + xPixelCount - 1);
-	y0 = max(y0, yPixelStart);
-	y1 = min(y1, yPixelStart + yPixelCount - 1);
+	x0 = max(x0, x0Pix);
+	x1 = min(x1, x0Pix + nxPix - 1);
+	y0 = max(y0, y0Pix);
+	y1 = min(y1, y0Pix + nyPix - 1);
 	if ((x1-x0) < 0 || (y1-y0) < 0) return;
 	// Loop over filter support and add sample to pixel arrays
 	// Precompute $x$ and $y$ filter table offsets
@@ -134,16 +206,11 @@ void ImageFilm::AddSample(const Sample &sample,
 			int offset = ify[y-y0]*FILTER_TABLE_SIZE + ifx[x-x0];
 			float filterWt = filterTable[offset];
 			// Update pixel values with filtered sample contribution
-			Pixel &pixel = (*pixels)(x - xPixelStart, y - yPixelStart);
+			Pixel &pixel = pix(x - x0Pix, y - y0Pix);
 			pixel.L.AddWeighted(filterWt, L);
 			pixel.alpha += alpha * filterWt;
 			pixel.weightSum += filterWt;
 		}
-	// Possibly write out in-progress image
-	if (--sampleCount == 0) {
-		WriteImage();
-		sampleCount = writeFrequency;
-	}
 }
 void ImageFilm::GetSampleExtent(int *xstart,
 		int *xend, int *ystart, int *yend) const {
@@ -154,6 +221,62 @@ void ImageFilm::GetSampleExtent(int *xstart,
 	*yend   = Floor2Int(yPixelStart + .5f + yPixelCount +
 		filter->yWidth);
 }
+FilmTile *ImageFilm::GetFilmTile(int xstart, int xend,
+		int ystart, int yend) {
+	// Cover the pixels within filter reach of the tile's samples
+	int x0 = max(Ceil2Int(xstart - .5f - filter->xWidth), xPixelStart);
+	int x1 = min(Floor2Int(xend - .5f + filter->xWidth),
+		xPixelStart + xPixelCount - 1);
+	int y0 = max(Ceil2Int(ystart - .5f - filter->yWidth), yPixelStart);
+	int y1 = min(Floor2Int(yend - .5f + filter->yWidth),
+		yPixelStart + yPixelCount - 1);
+	return new ImageFilmTile(this, x0, y0, max(0, x1 - x0 + 1),
+		max(0, y1 - y0 + 1));
+}
+void ImageFilm::MergeFilmTile(FilmTile *ft) {
+	ImageFilmTile *tile = (ImageFilmTile *)ft;
+	for (int y = 0; y < tile->yPixelCount; ++y)
+		for (int x = 0; x < tile->xPixelCount; ++x) {
+			const Pixel &tp = tile->pixels(x, y);
+			Pixel &pixel = (*pixels)(x + tile->xPixelStart - xPixelStart,
+				y + tile->yPixelStart - yPixelStart);
+			pixel.L += tp.L;
+			pixel.alpha += tp.alpha;
+			pixel.weightSum += tp.weightSum;
+			if (tp.depthDist2 < pixel.depthDist2) {
+				pixel.depthDist2 = tp.depthDist2;
+				pixel.depth = tp.depth;
+			}
+			// Combine the luminance statistics of both sample sets
+			if (tp.nSamples > 0) {
+				int n = pixel.nSamples + tp.nSamples;
+				float delta = tp.yMean - pixel.yMean;
+				pixel.yM2 += tp.yM2 + delta * delta *
+					pixel.nSamples * tp.nSamples / n;
+				pixel.yMean += delta * tp.nSamples / n;
+				pixel.nSamples = n;
+			}
+		}
+	// Possibly write out in-progress image
+	if (writeFrequency > 0 &&
+		(sampleCount -= tile->sampleCount) <= 0) {
+		WriteImage();
+		sampleCount = writeFrequency;
+	}
+	delete tile;
+}
+bool ImageFilm::GetPixelStatistics(int x, int y, int *nSamples,
+		float *mean, float *variance) const {
+	if (x < xPixelStart || x >= xPixelStart + xPixelCount ||
+		y < yPixelStart || y >= yPixelStart + yPixelCount)
+		return false;
+	const Pixel &pixel = (*pixels)(x - xPixelStart, y - yPixelStart);
+	*nSamples = pixel.nSamples;
+	*mean = pixel.yMean;
+	*variance = pixel.nSamples > 1 ?
+		pixel.yM2 / (pixel.nSamples - 1) : 0.f;
+	return true;
+}
 void ImageFilm::WriteImage() {
 	// Convert image to RGB and compute final pixel values
 	int nPix = xPixelCount * yPixelCount;
@@ -206,6 +329,17 @@ void ImageFilm::WriteImage() {
 		xPixelCount, yPixelCount,
 		xResolution, yResolution,
 		xPixelStart, yPixelStart);
+	// Write depth AOV
+	if (depthFilename != "") {
+		float *depth = rgb;
+		for (int y = 0, offset = 0; y < yPixelCount; ++y)
+			for (int x = 0; x < xPixelCount; ++x)
+				depth[offset++] = (*pixels)(x, y).depth;
+		WriteDepthImage(depthFilename, depth,
+			xPixelCount, yPixelCount,
+			xResolution, yResolution,
+			xPixelStart, yPixelStart);
+	}
 	// Release temporary image memory
 	delete[] alpha;
 	delete[] rgb;
@@ -227,7 +361,8 @@ extern "C" DLLEXPORT Film *CreateFilm(const ParamSet &params, Filter *filter)
 		crop[3] = Clamp(max(cr[2], cr[3]), 0., 1.);
 	}
 	int writeFrequency = params.FindOneInt("writefrequency", -1);
+	string depthFilename = params.FindOneString("depthfilename", "");
 
 	return new ImageFilm(xres, yres, filter, crop,
-		filename, premultiplyAlpha, writeFrequency);
+		filename, premultiplyAlpha, writeFrequency, depthFilename);
 }
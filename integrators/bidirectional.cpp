@@ -33,6 +33,7 @@ public:
 	// BidirIntegrator Public Methods
 	Spectrum Li(const Scene *scene, const RayDifferential &ray, const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
+	bool ThreadSafe() const { return true; }
 private:
 	// BidirIntegrator Private Methods
 	int generatePath(const Scene *scene, const Ray &r, const Sample *sample,
@@ -141,7 +142,7 @@ int BidirIntegrator::generatePath(const Scene *scene, const Ray &r,
 		if (!scene->Intersect(ray, &isect))
 			break;
 		BidirVertex &v = vertices[nVerts];
-		v.bsdf = isect.GetBSDF(ray); // do before Ns is set!
+		v.bsdf = isect.GetBSDF(ray, *sample->arena); // do before Ns is set!
 		v.p = isect.dg.p;
 		v.ng = isect.dg.nn;
 		v.ns = v.bsdf->dgShading.nn;
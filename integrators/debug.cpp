@@ -54,6 +54,7 @@ public:
 		debug_variable[1] = v[1];
 		debug_variable[2] = v[2];
 	}
+	bool ThreadSafe() const { return true; }
 private:
 	DebugVariable debug_variable[3];
 };
@@ -70,7 +71,7 @@ Spectrum DebugIntegrator::Li(const Scene *scene,
 
 	hitSomething = scene->Intersect(ray, &isect);
 	if (hitSomething) {
-		bsdf = isect.GetBSDF(ray);
+		bsdf = isect.GetBSDF(ray, *sample->arena);
 	}
 
 	float color[3] = {0,0,0};
@@ -36,6 +36,10 @@ public:
 	~DirectLighting();
 	Spectrum Li(const Scene *scene, const RayDifferential &ray, const Sample *sample,
 		float *alpha) const;
+	bool ThreadSafe() const {
+		// The weighted strategy learns from the samples taken so far
+		return strategy != SAMPLE_ONE_WEIGHTED;
+	}
 	void RequestSamples(Sample *sample, const Scene *scene) {
 		if (strategy == SAMPLE_ALL_UNIFORM) {
 			// Allocate and request samples for sampling all lights
@@ -67,7 +71,7 @@ public:
 private:
 	// DirectLighting Private Data
 	LightStrategy strategy;
-	mutable int rayDepth; // NOBOOK
+	static PBRT_THREAD_LOCAL int rayDepth; // NOBOOK
 	int maxDepth; // NOBOOK
 	// Declare sample parameters for light source sampling
 	int *lightSampleOffset, lightNumOffset;
@@ -75,6 +79,7 @@ private:
 	mutable float *avgY, *avgYsample, *cdf;
 	mutable float overallAvgY;
 };
+PBRT_THREAD_LOCAL int DirectLighting::rayDepth = 0; // NOBOOK
 // DirectLighting Method Definitions
 DirectLighting::~DirectLighting() {
 	delete[] avgY;
@@ -83,7 +88,6 @@ DirectLighting::~DirectLighting() {
 }
 DirectLighting::DirectLighting(LightStrategy st, int md) {
 	maxDepth = md;
-	rayDepth = 0;
 	strategy = st;
 	avgY = avgYsample = cdf = NULL;
 	overallAvgY = 0.;
@@ -96,7 +100,7 @@ Spectrum DirectLighting::Li(const Scene *scene,
 	if (scene->Intersect(ray, &isect)) {
 		if (alpha) *alpha = 1.;
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		Vector wo = -ray.d;
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
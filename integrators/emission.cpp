@@ -30,6 +30,7 @@ class EmissionIntegrator : public VolumeIntegrator {
 public:
 	// EmissionIntegrator Public Methods
 	EmissionIntegrator(float ss) { stepSize = ss; }
+	bool ThreadSafe() const { return true; }
 	void RequestSamples(Sample *sample, const Scene *scene);
 	Spectrum Transmittance(const Scene *, const Ray &ray, const Sample *sample, float *alpha) const;
 	Spectrum Li(const Scene *, const RayDifferential &ray, const Sample *sample, float *alpha) const;
@@ -115,6 +115,7 @@ public:
 		const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
 	void Preprocess(const Scene *);
+	bool ThreadSafe() const { return true; }
 private:
 	static inline bool unsuccessful(int needed, int found, int shot) {
 		return (found < needed &&
@@ -131,7 +132,7 @@ private:
 	int gatherSampleOffset[2], gatherComponentOffset[2];
         u_int nCausticPhotons, nIndirectPhotons;
 	u_int nLookup;
-	mutable int specularDepth;
+	static PBRT_THREAD_LOCAL int specularDepth;
 	int maxSpecularDepth;
 	float maxDistSquared, rrTreshold;
         bool finalGather;
@@ -145,6 +146,7 @@ private:
 	mutable KdTree<Photon, PhotonProcess> *indirectMap;
 	mutable KdTree<RadiancePhoton, RadiancePhotonProcess> *radianceMap;
 };
+PBRT_THREAD_LOCAL int ExPhotonIntegrator::specularDepth = 0;
 
 // ExPhotonIntegrator Method Definitions
 Spectrum ExPhotonIntegrator::estimateE(
@@ -257,7 +259,6 @@ ExPhotonIntegrator::ExPhotonIntegrator(int ncaus, int nind,
 	maxSpecularDepth = mdepth;
 	causticMap = indirectMap = NULL;
 	radianceMap = NULL;
-	specularDepth = 0;
 	finalGather = fg;
 	gatherSamples = gs;
 	rrTreshold = rrt;
@@ -299,6 +300,7 @@ void ExPhotonIntegrator::Preprocess(const Scene *scene) {
 	if (scene->lights.size() == 0) return;
 	ProgressReporter progress(nCausticPhotons+ // NOBOOK
 		nIndirectPhotons, "Shooting photons"); // NOBOOK
+	MemoryArena arena;
 	vector<Photon> causticPhotons;
 	vector<Photon> indirectPhotons;
 	vector<Photon> directPhotons;
@@ -368,7 +370,7 @@ void ExPhotonIntegrator::Preprocess(const Scene *scene) {
 				// Handle photon/surface intersection
 				alpha *= scene->Transmittance(photonRay);
 				Vector wo = -photonRay.d;
-				BSDF *photonBSDF = photonIsect.GetBSDF(photonRay);
+				BSDF *photonBSDF = photonIsect.GetBSDF(photonRay, arena);
 				BxDFType specularType = BxDFType(BSDF_REFLECTION |
 					BSDF_TRANSMISSION | BSDF_SPECULAR);
 				bool hasNonSpecular = (photonBSDF->NumComponents() >
@@ -453,7 +455,7 @@ void ExPhotonIntegrator::Preprocess(const Scene *scene) {
 				photonRay = RayDifferential(photonIsect.dg.p, wi);
 			}
 		}
-		BSDF::FreeAll();
+		arena.FreeAll();
 	}
 
 	progress.Done(); // NOBOOK
@@ -503,7 +505,7 @@ Spectrum ExPhotonIntegrator::Li(const Scene *scene,
 		// Compute emitted light if ray hit an area light source
 		L += isect.Le(wo);
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
 		L += UniformSampleAllLights(scene, p, n,
@@ -46,12 +46,13 @@ public:
 		const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
 	void Preprocess(const Scene *);
+	bool ThreadSafe() const { return true; }
 
 private:
 	// IGI Private Data
 	u_int nLightPaths, nLightSets;
 	vector<VirtualLight> *virtualLights;
-	mutable int specularDepth;
+	static PBRT_THREAD_LOCAL int specularDepth;
 	int maxSpecularDepth;
 	float minDist2, rrThreshold, indirectScale;
 	int vlSetOffset;
@@ -59,6 +60,7 @@ private:
 	int *lightSampleOffset, lightNumOffset;
 	int *bsdfSampleOffset, *bsdfComponentOffset;
 };
+PBRT_THREAD_LOCAL int IGIIntegrator::specularDepth = 0;
 
 // IGIIntegrator Implementation
 IGIIntegrator::IGIIntegrator(int nl, int ns, float md,
@@ -69,7 +71,6 @@ IGIIntegrator::IGIIntegrator(int nl, int ns, float md,
 	rrThreshold = rrt;
 	indirectScale = is;
 	maxSpecularDepth = 5;
-	specularDepth = 0;
 	virtualLights = new vector<VirtualLight>[nLightSets];
 }
 void IGIIntegrator::RequestSamples(Sample *sample,
@@ -93,6 +94,7 @@ void IGIIntegrator::RequestSamples(Sample *sample,
 void IGIIntegrator::Preprocess(const Scene *scene) {
 	if (scene->lights.size() == 0) return;
 	// Compute samples for emitted rays from lights
+	MemoryArena arena;
 	float *lightNum = new float[nLightPaths * nLightSets];
 	float *lightSamp0 = new float[2 * nLightPaths *	nLightSets];
 	float *lightSamp1 = new float[2 * nLightPaths * nLightSets];
@@ -135,7 +137,7 @@ void IGIIntegrator::Preprocess(const Scene *scene) {
 				++nIntersections;
 				alpha *= scene->Transmittance(ray);
 				Vector wo = -ray.d;
-				BSDF *bsdf = isect.GetBSDF(ray);
+				BSDF *bsdf = isect.GetBSDF(ray, arena);
 				// Create virtual light at ray intersection point
 				static StatsCounter vls("IGI Integrator", "Virtual Lights Created"); //NOBOOK
 				++vls; //NOBOOK
@@ -160,7 +162,7 @@ void IGIIntegrator::Preprocess(const Scene *scene) {
 //				fprintf(stderr, "\tnew alpha %f\n", alpha.y());
 				ray = RayDifferential(isect.dg.p, wi);
 			}
-			BSDF::FreeAll();
+			arena.FreeAll();
 		}
 	}
 	delete[] lightNum; // NOBOOK
@@ -178,7 +180,7 @@ Spectrum IGIIntegrator::Li(const Scene *scene,
 		// Compute emitted light if ray hit an area light source
 		L += isect.Le(wo);
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
 		L += UniformSampleAllLights(scene, p, n,
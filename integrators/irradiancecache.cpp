@@ -39,12 +39,16 @@ public:
 	Spectrum Li(const Scene *scene, const RayDifferential &ray, const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
 	void Preprocess(const Scene *);
+	bool ThreadSafe() const {
+		// Cached irradiance depends on the order pixels are rendered in
+		return false;
+	}
 private:
 	// IrradianceCache Data
 	float maxError;
 	int nSamples;
 	int maxSpecularDepth, maxIndirectDepth;
-	mutable int specularDepth;
+	static PBRT_THREAD_LOCAL int specularDepth;
 	// Declare sample parameters for light source sampling
 	int *lightSampleOffset, lightNumOffset;
 	int *bsdfSampleOffset, *bsdfComponentOffset;
@@ -56,6 +60,7 @@ private:
 	bool InterpolateIrradiance(const Scene *scene,
 			const Point &p, const Normal &n, Spectrum *E) const;
 };
+PBRT_THREAD_LOCAL int IrradianceCache::specularDepth = 0;
 struct IrradianceSample {
 	// IrradianceSample Constructor
 	IrradianceSample() { }
@@ -95,7 +100,6 @@ IrradianceCache::IrradianceCache(int maxspec, int maxind,
 	nSamples = ns;
 	maxSpecularDepth = maxspec;
 	maxIndirectDepth = maxind;
-	specularDepth = 0;
 }
 void IrradianceCache::RequestSamples(Sample *sample,
 		const Scene *scene) {
@@ -121,7 +125,7 @@ Spectrum IrradianceCache::Li(const Scene *scene, const RayDifferential &ray,
 	if (scene->Intersect(ray, &isect)) {
 		if (alpha) *alpha = 1.;
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		Vector wo = -ray.d;
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
@@ -251,7 +255,7 @@ Spectrum IrradianceCache::IndirectLo(const Point &p,
 				if (specularBounce)
 					L += pathThroughput * isect.Le(-ray.d);
 				// Evaluate BSDF at hit point
-				BSDF *bsdf = isect.GetBSDF(ray);
+				BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 				// Sample illumination from lights to find path contribution
 				const Point &p = bsdf->dgShading.p;
 				const Normal &n = bsdf->dgShading.nn;
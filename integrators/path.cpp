@@ -32,6 +32,7 @@ public:
 	Spectrum Li(const Scene *scene, const RayDifferential &ray, const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
 	PathIntegrator(int md) { maxDepth = md; }
+	bool ThreadSafe() const { return true; }
 private:
 	// PathIntegrator Private Data
 	int maxDepth;
@@ -91,7 +92,7 @@ Spectrum PathIntegrator::Li(const Scene *scene,
 		if (pathLength == 0 || specularBounce)
 			L += pathThroughput * isect.Le(-ray.d);
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		// Sample illumination from lights to find path contribution
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
@@ -43,6 +43,7 @@ public:
 		const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
 	void Preprocess(const Scene *);
+	bool ThreadSafe() const { return true; }
 private:
 	// PhotonIntegrator Private Methods
 	static inline bool unsuccessful(int needed, int found, int shot) {
@@ -55,7 +56,7 @@ private:
 	// PhotonIntegrator Private Data
 	u_int nCausticPhotons, nIndirectPhotons, nDirectPhotons;
 	u_int nLookup;
-	mutable int specularDepth;
+	static PBRT_THREAD_LOCAL int specularDepth;
 	int maxSpecularDepth;
 	float maxDistSquared;
 	bool directWithPhotons, finalGather;
@@ -69,6 +70,7 @@ private:
 	mutable KdTree<Photon, PhotonProcess> *directMap;
 	mutable KdTree<Photon, PhotonProcess> *indirectMap;
 };
+PBRT_THREAD_LOCAL int PhotonIntegrator::specularDepth = 0;
 struct Photon {
 	// Photon Constructor
 	Photon(const Point &pp, const Spectrum &wt, const Vector &w)
@@ -112,7 +114,6 @@ PhotonIntegrator::PhotonIntegrator(int ncaus, int ndir, int nind,
 	maxDistSquared = mdist * mdist;
 	maxSpecularDepth = mdepth;
 	causticMap = directMap = indirectMap = NULL;
-	specularDepth = 0;
 	finalGather = fg;
 	gatherSamples = gs;
 	directWithPhotons = dp;
@@ -148,6 +149,7 @@ void PhotonIntegrator::Preprocess(const Scene *scene) {
 	if (scene->lights.size() == 0) return;
 	ProgressReporter progress(nCausticPhotons+nDirectPhotons+ // NOBOOK
 		nIndirectPhotons, "Shooting photons"); // NOBOOK
+	MemoryArena arena;
 	vector<Photon> causticPhotons;
 	vector<Photon> directPhotons;
 	vector<Photon> indirectPhotons;
@@ -208,7 +210,7 @@ void PhotonIntegrator::Preprocess(const Scene *scene) {
 				// Handle photon/surface intersection
 				alpha *= scene->Transmittance(photonRay);
 				Vector wo = -photonRay.d;
-				BSDF *photonBSDF = photonIsect.GetBSDF(photonRay);
+				BSDF *photonBSDF = photonIsect.GetBSDF(photonRay, arena);
 				BxDFType specularType = BxDFType(BSDF_REFLECTION |
 					BSDF_TRANSMISSION | BSDF_SPECULAR);
 				bool hasNonSpecular = (photonBSDF->NumComponents() >
@@ -292,7 +294,7 @@ void PhotonIntegrator::Preprocess(const Scene *scene) {
 				}
 			}
 		}
-		BSDF::FreeAll();
+		arena.FreeAll();
 	}
 	progress.Done(); // NOBOOK
 }
@@ -308,7 +310,7 @@ Spectrum PhotonIntegrator::Li(const Scene *scene,
 		// Compute emitted light if ray hit an area light source
 		L += isect.Le(wo);
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
 		// Compute direct lighting for photon map integrator
@@ -344,7 +346,8 @@ Spectrum PhotonIntegrator::Li(const Scene *scene,
 				Intersection gatherIsect;
 				if (scene->Intersect(bounceRay, &gatherIsect)) {
 					// Compute exitant radiance at final gather intersection
-					BSDF *gatherBSDF = gatherIsect.GetBSDF(bounceRay);
+					BSDF *gatherBSDF = gatherIsect.GetBSDF(bounceRay,
+						*sample->arena);
 					Vector bounceWo = -bounceRay.d;
 					Spectrum Lindir =
 						LPhoton(directMap, nDirectPaths, nLookup,
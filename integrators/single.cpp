@@ -30,6 +30,7 @@ class SingleScattering : public VolumeIntegrator {
 public:
 	// SingleScattering Public Methods
 	SingleScattering(float ss) { stepSize = ss; }
+	bool ThreadSafe() const { return true; }
 	Spectrum Transmittance(const Scene *, const Ray &ray,
 		const Sample *sample, float *alpha) const;
 	void RequestSamples(Sample *sample, const Scene *scene);
@@ -33,13 +33,15 @@ public:
 			const Sample *sample, float *alpha) const;
 	WhittedIntegrator(int md) {
 		maxDepth = md;
-		rayDepth = 0;
 	}
+	bool ThreadSafe() const { return true; }
 private:
 	// WhittedIntegrator Private Data
 	int maxDepth;
-	mutable int rayDepth;
+	static PBRT_THREAD_LOCAL int rayDepth;
 };
+// Each rendering thread follows its own ray tree
+PBRT_THREAD_LOCAL int WhittedIntegrator::rayDepth = 0;
 // WhittedIntegrator Method Definitions
 Spectrum WhittedIntegrator::Li(const Scene *scene,
 		const RayDifferential &ray, const Sample *sample,
@@ -62,7 +64,7 @@ Spectrum WhittedIntegrator::Li(const Scene *scene,
 		if (alpha) *alpha = 1.;
 		// Compute emitted and reflected light at ray intersection point
 		// Evaluate BSDF at hit point
-		BSDF *bsdf = isect.GetBSDF(ray);
+		BSDF *bsdf = isect.GetBSDF(ray, *sample->arena);
 		// Initialize common variables for Whitted integrator
 		const Point &p = bsdf->dgShading.p;
 		const Normal &n = bsdf->dgShading.nn;
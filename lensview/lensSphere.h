@@ -16,7 +16,7 @@ public:
 	// Sphere Public Methods
 	lensSphere()
 	{
-        lensSphere(1.0, -1.0, 1.0, `2*M_PI, 1.0, Point(0,0,0));
+        lensSphere(1.0, -1.0, 1.0, 2*M_PI, 1.0, Point(0,0,0));
 	}
 
 	lensSphere(float rad, float z0, float z1, float pm, float aper, Point c)
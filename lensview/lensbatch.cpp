@@ -0,0 +1,182 @@
+// Batch characterisation of lens prescriptions without a display:
+// lensbatch loads every .dat file it is given, finds each lens's
+// intrinsics, vignetting and distortion on all cores, and writes one
+// row per lens as CSV or JSON.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "lensquality.h"
+
+using namespace std;
+
+// Per-lens results, in the order of the input files
+struct lensReport {
+	lensReport(void): loaded(false) {}
+	bool loaded;
+	float efl, f1, f2, p1, p2;
+	Point entPupil, pupil;
+	float minFS;
+	vector<float> vignetting;	// Relative illumination at each height
+	vector<float> distortion;	// Percent distortion at each height
+	vector<char> hasDistortion;
+};
+
+// Options shared by all workers
+static int nFields = 5;				// Film heights from the axis to the edge
+static float fieldRadius = LENS_FIELD_RADIUS;	// Image circle radius (mm)
+static int gridSize = 128;			// Rays per side of the vignetting grid
+
+static vector<string> files;
+static vector<lensReport> reports;
+
+static float fieldHeight(int k)
+{
+	return (nFields > 1) ? fieldRadius * k / (nFields - 1) : 0.0f;
+}
+
+static void characterise(const char *file, lensReport *r)
+{
+	lensSystem lsys;
+	if (!lsys.Load(file))
+		return;
+	lsys.findIntrinsics();
+	r->loaded = true;
+	r->efl = lsys.efl;
+	r->f1 = lsys.f1; r->f2 = lsys.f2;
+	r->p1 = lsys.p1; r->p2 = lsys.p2;
+	r->entPupil = lsys.entPupil;
+	r->pupil = lsys.pupil;
+	r->minFS = lsys.minFS;
+	// Vignetting relative to the on-axis transmission
+	float axial = lsys.transmission(0.0f, gridSize);
+	r->vignetting.resize(nFields);
+	r->distortion.resize(nFields);
+	r->hasDistortion.resize(nFields);
+	for (int k = 0; k < nFields; k++)
+	{
+		float h = fieldHeight(k);
+		r->vignetting[k] = (axial > 0.0f) ?
+			min(1.0f, lsys.transmission(h, gridSize) / axial) : 0.0f;
+		r->hasDistortion[k] = lsys.distortion(h, &r->distortion[k]);
+	}
+}
+
+static void characteriseTask(int i, void *)
+{
+	characterise(files[i].c_str(), &reports[i]);
+}
+
+// Append the .dat files in a directory, or the path itself if it is a file
+static void addPath(const char *path)
+{
+	if (!lensListFiles(path, &files))
+		fprintf(stderr, "lensbatch: cannot read directory %s\n", path);
+}
+
+static void writeCSV(FILE *out)
+{
+	fprintf(out, "file,efl,f,fp,p,pp,entrance_pupil_z,entrance_pupil_d,"
+		"exit_pupil_z,exit_pupil_d,min_fstop");
+	for (int k = 0; k < nFields; k++)
+		fprintf(out, ",vignetting_%.4g", fieldHeight(k));
+	for (int k = 0; k < nFields; k++)
+		fprintf(out, ",distortion_%.4g", fieldHeight(k));
+	fprintf(out, "\n");
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		const lensReport &r = reports[i];
+		if (!r.loaded) continue;
+		lensWriteCSVString(out, files[i].c_str());
+		fprintf(out, ",%g,%g,%g,%g,%g,%g,%g,%g,%g,%g",
+			r.efl, r.f1, r.f2, r.p1, r.p2, r.entPupil.z, r.entPupil.y,
+			r.pupil.z, r.pupil.y, r.minFS);
+		for (int k = 0; k < nFields; k++)
+			fprintf(out, ",%g", r.vignetting[k]);
+		for (int k = 0; k < nFields; k++)
+			if (r.hasDistortion[k]) fprintf(out, ",%g", r.distortion[k]);
+			else fprintf(out, ",");
+		fprintf(out, "\n");
+	}
+}
+
+static void writeJSON(FILE *out)
+{
+	fprintf(out, "[");
+	bool first = true;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		const lensReport &r = reports[i];
+		if (!r.loaded) continue;
+		fprintf(out, first ? "\n  {\"file\": " : ",\n  {\"file\": ");
+		first = false;
+		lensWriteJSONString(out, files[i].c_str());
+		fprintf(out, ", \"efl\": %g, \"f\": %g, \"fp\": %g, \"p\": %g, "
+			"\"pp\": %g,\n   \"entrance_pupil\": {\"z\": %g, \"d\": %g}, "
+			"\"exit_pupil\": {\"z\": %g, \"d\": %g}, \"min_fstop\": %g,\n",
+			r.efl, r.f1, r.f2, r.p1, r.p2, r.entPupil.z, r.entPupil.y,
+			r.pupil.z, r.pupil.y, r.minFS);
+		fprintf(out, "   \"field_heights\": [");
+		for (int k = 0; k < nFields; k++)
+			fprintf(out, k ? ", %g" : "%g", fieldHeight(k));
+		fprintf(out, "],\n   \"vignetting\": [");
+		for (int k = 0; k < nFields; k++)
+			fprintf(out, k ? ", %g" : "%g", r.vignetting[k]);
+		fprintf(out, "],\n   \"distortion\": [");
+		for (int k = 0; k < nFields; k++) {
+			if (k) fprintf(out, ", ");
+			if (r.hasDistortion[k]) fprintf(out, "%g", r.distortion[k]);
+			else fprintf(out, "null");
+		}
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n]\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lensbatch [-json] [-threads n] [-fields n] [-radius mm]\n"
+		"                 [-grid n] <lens.dat | directory> ...\n"
+		"  -json        write a JSON array instead of CSV\n"
+		"  -threads n   worker threads (default: one per core)\n"
+		"  -fields n    film heights sampled from the axis to -radius (5)\n"
+		"  -radius mm   image circle radius for vignetting and distortion (21.65)\n"
+		"  -grid n      rays per side of each vignetting grid (128)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bool json = false;
+	int nThreads = lensNumCores();
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-json")) json = true;
+		else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+			nThreads = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-fields") && i + 1 < argc)
+			nFields = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-radius") && i + 1 < argc)
+			fieldRadius = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-grid") && i + 1 < argc)
+			gridSize = max(1, atoi(argv[++i]));
+		else if (argv[i][0] == '-') usage();
+		else addPath(argv[i]);
+	}
+	if (files.empty()) usage();
+	reports.resize(files.size());
+	lensParallelFor(int(files.size()), nThreads, characteriseTask, NULL);
+
+	int failed = 0;
+	for (size_t i = 0; i < files.size(); i++)
+		if (!reports[i].loaded) {
+			fprintf(stderr, "lensbatch: cannot load %s\n", files[i].c_str());
+			failed++;
+		}
+	if (json) writeJSON(stdout);
+	else writeCSV(stdout);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+// Lens tracing throughput without a display: lensbench traces fixed,
+// deterministic ray sets through each lens it is given, with the scalar
+// tracer in both directions and the packet tracer from the film, and
+// writes rays per second, time per surface and where rays were blocked
+// as JSON for regression tracking.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "lensquality.h"
+#include "timer.h"
+
+using namespace std;
+
+// Timing of one tracer over one ray set
+struct benchResult {
+	benchResult(void): seconds(0), passed(0), visits(0) {}
+	double seconds;		// Best time over the repeats
+	int passed;			// Rays that left the last surface
+	double visits;		// Surfaces reached, summed over all rays
+};
+
+// Timings and blocked-ray counts for each input file
+struct lensBench {
+	lensBench(void): loaded(false), surfaces(0) {}
+	bool loaded;
+	int surfaces;
+	benchResult fromFilm, fromScene, packet;
+	vector<int> blockedFromFilm, blockedFromScene;	// Rays stopped per surface
+};
+
+// Options
+static int nRays = 1 << 20;			// Rays in each direction's set
+static int nRepeats = 3;			// Timed passes; the fastest is kept
+static float fieldRadius = LENS_FIELD_RADIUS;	// Image circle radius (mm)
+
+static vector<string> files;
+static vector<lensBench> results;
+
+// Deterministic uniform numbers in [0, 1), identical on every platform
+static float nextRandom(u_int *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Uniform point on a disk of radius r centred on the axis
+static void sampleDisk(u_int *state, float r, float *x, float *y)
+{
+	float rho = r * sqrtf(nextRandom(state));
+	float phi = 2.0f * M_PI * nextRandom(state);
+	*x = rho * cosf(phi);
+	*y = rho * sinf(phi);
+}
+
+// Rays from film points out to the image circle, aimed across the rear
+// element, and collimated bundles from the matching field angles, aimed
+// across the front element
+static void makeRays(const lensSystem &lsys, vector<Ray> *fromFilm,
+                     vector<Ray> *fromScene)
+{
+	const lensElement &front = lsys.lenses[0];
+	const lensElement &rear = lsys.lenses[lsys.numLenses() - 1];
+	u_int state = 1;
+	fromFilm->resize(nRays);
+	fromScene->resize(nRays);
+	for (int k = 0; k < nRays; k++)
+	{
+		float h = fieldRadius * nextRandom(&state), x, y;
+		sampleDisk(&state, 0.5f * rear.aper, &x, &y);
+		Point pFilm(0, h, lsys.f2);
+		(*fromFilm)[k] = Ray(pFilm, Normalize(Point(x, y, rear.zpos) - pFilm));
+
+		sampleDisk(&state, 0.5f * front.aper, &x, &y);
+		Vector d = Normalize(Vector(0, -h / lsys.efl, -1));
+		Point aim(x, y, front.zpos);
+		(*fromScene)[k] = Ray(aim - front.aper * d, d);
+	}
+}
+
+// Trace a ray set repeatedly with the scalar tracer, keeping the best
+// time, and count where rays were blocked on the first pass
+static void benchScalar(const LensPrescription &lp, const vector<Ray> &rays,
+                        bool fromFilm, benchResult *r, vector<int> *blocked)
+{
+	int n = lp.NumSurfaces();
+	blocked->assign(n, 0);
+	for (int pass = 0; pass < nRepeats; pass++)
+	{
+		Timer timer;
+		timer.Start();
+		int passed = 0;
+		Ray out;
+		for (size_t k = 0; k < rays.size(); k++)
+			passed += fromFilm ? lp.TraceFromFilm(rays[k], &out) :
+				lp.TraceFromScene(rays[k], &out);
+		timer.Stop();
+		if (pass == 0 || timer.Time() < r->seconds)
+			r->seconds = timer.Time();
+		r->passed = passed;
+	}
+	// Surfaces reached: all of them, or up to the one that stopped the ray
+	r->visits = 0;
+	for (size_t k = 0; k < rays.size(); k++)
+	{
+		Ray out;
+		int stop;
+		bool ok = fromFilm ? lp.TraceFromFilm(rays[k], &out, NULL, 0, &stop) :
+			lp.TraceFromScene(rays[k], &out, NULL, 0, &stop);
+		if (ok) {
+			r->visits += n;
+			continue;
+		}
+		(*blocked)[stop]++;
+		r->visits += fromFilm ? n - stop : stop + 1;
+	}
+}
+
+// Trace film rays in packets; lanes are charged the scalar tracer's
+// surface visits so that both report time for the same work
+static void benchPacket(const LensPrescription &lp, const vector<Ray> &rays,
+                        double visits, benchResult *r)
+{
+	int nPackets = int(rays.size()) / LENS_PACKET_SIZE;
+	vector<LensRayPacket> packets(nPackets);
+	for (int p = 0; p < nPackets; p++)
+		for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+		{
+			const Ray &ray = rays[p * LENS_PACKET_SIZE + lane];
+			packets[p].ox[lane] = ray.o.x; packets[p].oy[lane] = ray.o.y;
+			packets[p].oz[lane] = ray.o.z; packets[p].dx[lane] = ray.d.x;
+			packets[p].dy[lane] = ray.d.y; packets[p].dz[lane] = ray.d.z;
+		}
+	static const int laneCount[16] = {
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+	};
+	for (int pass = 0; pass < nRepeats; pass++)
+	{
+		Timer timer;
+		timer.Start();
+		int passed = 0;
+		LensRayPacket out;
+		for (int p = 0; p < nPackets; p++)
+			passed += laneCount[lp.TracePacketFromFilm(packets[p], &out, 15)];
+		timer.Stop();
+		if (pass == 0 || timer.Time() < r->seconds)
+			r->seconds = timer.Time();
+		r->passed = passed;
+	}
+	r->visits = visits;
+}
+
+static void bench(const char *file, lensBench *b)
+{
+	lensSystem lsys;
+	if (!lsys.Load(file))
+		return;
+	lsys.findIntrinsics();
+	b->loaded = true;
+	b->surfaces = lsys.numLenses();
+	vector<Ray> fromFilm, fromScene;
+	makeRays(lsys, &fromFilm, &fromScene);
+	benchScalar(lsys.prescription, fromFilm, true, &b->fromFilm,
+		&b->blockedFromFilm);
+	benchScalar(lsys.prescription, fromScene, false, &b->fromScene,
+		&b->blockedFromScene);
+	// Packets hold whole groups of rays; any remainder is left out
+	int nPacked = nRays - nRays % LENS_PACKET_SIZE;
+	vector<Ray> packed(fromFilm.begin(), fromFilm.begin() + nPacked);
+	benchPacket(lsys.prescription, packed,
+		b->fromFilm.visits * nPacked / max(1, nRays), &b->packet);
+}
+
+static void writeResult(FILE *out, const char *name, const benchResult &r,
+                        int rays)
+{
+	fprintf(out, "   \"%s\": {\"rays\": %d, \"seconds\": %g, "
+		"\"rays_per_second\": %g, \"ns_per_surface\": %g, \"passed\": %g}",
+		name, rays, r.seconds, r.seconds > 0 ? rays / r.seconds : 0.0,
+		r.visits > 0 ? 1e9 * r.seconds / r.visits : 0.0,
+		rays ? double(r.passed) / rays : 0.0);
+}
+
+static void writeBlocked(FILE *out, const char *name,
+                         const vector<int> &blocked)
+{
+	fprintf(out, "   \"%s\": [", name);
+	for (size_t i = 0; i < blocked.size(); i++)
+		fprintf(out, i ? ", %g" : "%g", 100.0 * blocked[i] / nRays);
+	fprintf(out, "]");
+}
+
+static void writeJSON(FILE *out)
+{
+#ifdef PBRT_LENS_SSE
+	const char *packetPath = "sse";
+#else
+	const char *packetPath = "scalar";
+#endif
+	fprintf(out, "[");
+	bool first = true;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		const lensBench &b = results[i];
+		if (!b.loaded) continue;
+		fprintf(out, first ? "\n  {\"file\": " : ",\n  {\"file\": ");
+		first = false;
+		lensWriteJSONString(out, files[i].c_str());
+		fprintf(out, ", \"surfaces\": %d, \"field_radius\": %g, "
+			"\"packet_size\": %d, \"packet_path\": \"%s\",\n",
+			b.surfaces, fieldRadius, LENS_PACKET_SIZE, packetPath);
+		writeResult(out, "scalar_from_film", b.fromFilm, nRays);
+		fprintf(out, ",\n");
+		writeResult(out, "scalar_from_scene", b.fromScene, nRays);
+		fprintf(out, ",\n");
+		writeResult(out, "packet_from_film", b.packet,
+			nRays - nRays % LENS_PACKET_SIZE);
+		fprintf(out, ",\n");
+		writeBlocked(out, "blocked_percent_from_film", b.blockedFromFilm);
+		fprintf(out, ",\n");
+		writeBlocked(out, "blocked_percent_from_scene", b.blockedFromScene);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n]\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lensbench [-rays n] [-repeat n] [-radius mm]\n"
+		"                 <lens.dat | directory> ...\n"
+		"  -rays n      rays traced in each direction per lens (1048576)\n"
+		"  -repeat n    timed passes over each ray set, keeping the fastest (3)\n"
+		"  -radius mm   image circle the film rays and field angles cover (21.65)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-rays") && i + 1 < argc)
+			nRays = max(LENS_PACKET_SIZE, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-repeat") && i + 1 < argc)
+			nRepeats = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-radius") && i + 1 < argc)
+			fieldRadius = float(atof(argv[++i]));
+		else if (argv[i][0] == '-') usage();
+		else if (!lensListFiles(argv[i], &files))
+			fprintf(stderr, "lensbench: cannot read directory %s\n", argv[i]);
+	}
+	if (files.empty()) usage();
+	// Lenses run one after another so that timings do not compete
+	results.resize(files.size());
+	int failed = 0;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		bench(files[i].c_str(), &results[i]);
+		if (!results[i].loaded) {
+			fprintf(stderr, "lensbench: cannot load %s\n", files[i].c_str());
+			failed++;
+		}
+	}
+	writeJSON(stdout);
+	return failed ? 1 : 0;
+}
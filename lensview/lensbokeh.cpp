@@ -0,0 +1,192 @@
+// A bank of defocus PSFs for post-process depth of field: kernels traced
+// through a lens system are tabulated against object distance and image
+// radius, then scattered across a pinhole render using its depth AOV
+#include "lensbokeh.h"
+
+#include <math.h>
+#include <algorithm>
+using namespace std;
+
+// Tabulate kernels, uniformly in inverse distance from infinity down to
+// zNear and uniformly in image radius
+bool bokehBank::build(const lensSystem &lsys, float zNear, float _maxRadius,
+                      float _pixel, int _nDepths, int _nFields, int maxKernel,
+                      const psfSettings &settings)
+{
+    if (zNear <= 0.0f || _pixel <= 0.0f || _nDepths < 1 || _nFields < 1 ||
+        lsys.efl == 0.0f)
+        return false;
+    this->pixel = _pixel;
+    this->maxRadius = _maxRadius;
+    this->invDepthMax = 1.0f / zNear;
+    this->nDepths = _nDepths;
+    this->nFields = _nFields;
+    this->kernels.assign(nDepths * nFields, vector<bokehTap>());
+    this->vignetting.assign(nDepths * nFields, 0.0f);
+
+    // Objects can be no nearer than computePSF's launch plane
+    float zMin = lsys.lenses[0].zpos + 1.0f + 1e-3f;
+    psfSettings s = settings;
+    s.pixel = this->pixel;
+    s.maxSpots = 0;
+    for (int d = 0; d < nDepths; d++)
+    {
+        float invZ = nDepths > 1 ? invDepthMax * d / (nDepths - 1) : invDepthMax;
+        s.objectZ = invZ > 0.0f ?
+            max(1.0f / invZ + lsys.entPupil.z, zMin) : INFINITY;
+        float axialArea = 0.0f;
+        for (int f = 0; f < nFields; f++)
+        {
+            float radius = nFields > 1 ? maxRadius * f / (nFields - 1) : 0.0f;
+            float field = Degrees(atanf(radius / lsys.efl));
+            // Size the histogram to the spot from a coarse trace; a spot
+            // that no ray reaches leaves an empty, black kernel
+            psfSettings coarse = s;
+            coarse.nRays = 4096;
+            coarse.bins = 2;
+            lensPSF psf;
+            if (!computePSF(lsys, field, coarse, &psf))
+                continue;
+            psfSettings fine = s;
+            fine.bins = min(maxKernel, 2 * Ceil2Int(psf.geoRadius / pixel) + 3);
+            if (!computePSF(lsys, field, fine, &psf))
+                continue;
+            if (f == 0)
+                axialArea = psf.pupilArea;
+            this->vignetting[d * nFields + f] =
+                axialArea > 0.0f ? psf.pupilArea / axialArea : 1.0f;
+            // The field lies along +y, so its image point and the radial
+            // direction point along -y
+            vector<bokehTap> &k = this->kernels[d * nFields + f];
+            int half = psf.bins / 2;
+            for (int iy = 0; iy < psf.bins; iy++)
+                for (int ix = 0; ix < psf.bins; ix++)
+                {
+                    float w = psf.data[iy * psf.bins + ix];
+                    if (w <= 0.0f)
+                        continue;
+                    bokehTap tap;
+                    tap.t = float(ix - half);
+                    tap.r = float(half - iy);
+                    tap.w = w;
+                    k.push_back(tap);
+                }
+        }
+    }
+    return true;
+}
+
+// Nearest kernel for an object at distance z and image radius (mm); the
+// vignetting is interpolated so that it does not step between columns
+const vector<bokehTap> &bokehBank::kernel(float z, float radius,
+                                          float *vig) const
+{
+    float u = (z > 0.0f && invDepthMax > 0.0f) ?
+        min(1.0f, 1.0f / (z * invDepthMax)) : 1.0f;
+    float v = maxRadius > 0.0f ? min(1.0f, radius / maxRadius) : 0.0f;
+    int d = Round2Int(u * (nDepths - 1));
+    float fv = v * (nFields - 1);
+    int f0 = min(Floor2Int(fv), nFields - 1), f1 = min(f0 + 1, nFields - 1);
+    const float *row = &this->vignetting[d * nFields];
+    *vig = row[f0] + (fv - f0) * (row[f1] - row[f0]);
+    return this->kernels[d * nFields + Round2Int(fv)];
+}
+
+// Each band of rows scatters into its own accumulation buffer, which
+// covers only the band's rows plus the widest kernel's reach either side
+struct bokehScatter {
+    const bokehBank *bank;
+    const float *rgb, *depth;
+    int xRes, yRes, nBands, reach;
+    vector< vector<float> > accum;
+    vector<int> accumY0;
+};
+
+static void scatterBand(int band, void *arg)
+{
+    bokehScatter *job = (bokehScatter *)arg;
+    int xRes = job->xRes, yRes = job->yRes;
+    int y0 = band * yRes / job->nBands, y1 = (band + 1) * yRes / job->nBands;
+    int accY0 = max(0, y0 - job->reach);
+    int accY1 = min(yRes, y1 + job->reach);
+    vector<float> &acc = job->accum[band];
+    acc.assign(3 * xRes * (accY1 - accY0), 0.0f);
+    job->accumY0[band] = accY0;
+    float cx = 0.5f * xRes, cy = 0.5f * yRes;
+    for (int y = y0; y < y1; y++)
+        for (int x = 0; x < xRes; x++)
+        {
+            const float *c = &job->rgb[3 * (y * xRes + x)];
+            if (c[0] == 0.0f && c[1] == 0.0f && c[2] == 0.0f)
+                continue;
+            // Outward radial direction of this pixel on the image
+            float px = x + 0.5f - cx, py = y + 0.5f - cy;
+            float rPix = sqrtf(px*px + py*py);
+            float ux = 0.0f, uy = 1.0f;
+            if (rPix > 0.0f)
+            {
+                ux = px / rPix;
+                uy = py / rPix;
+            }
+            float vig;
+            const vector<bokehTap> &k = job->bank->kernel(
+                job->depth[y * xRes + x], rPix * job->bank->pixel, &vig);
+            float cr = vig * c[0], cg = vig * c[1], cb = vig * c[2];
+            // Splat each rotated tap bilinearly so that no pixels are
+            // skipped or doubled at oblique angles
+            for (size_t i = 0; i < k.size(); i++)
+            {
+                float fx = x + (-k[i].t * uy + k[i].r * ux);
+                float fy = y + (k[i].t * ux + k[i].r * uy);
+                int x0 = Floor2Int(fx), y0 = Floor2Int(fy);
+                float dx = fx - x0, dy = fy - y0;
+                for (int j = 0; j < 4; j++)
+                {
+                    int tx = x0 + (j & 1), ty = y0 + (j >> 1);
+                    if (tx < 0 || ty < accY0 || tx >= xRes || ty >= accY1)
+                        continue;
+                    float w = k[i].w * ((j & 1) ? dx : 1.0f - dx) *
+                        ((j >> 1) ? dy : 1.0f - dy);
+                    float *o = &acc[3 * ((ty - accY0) * xRes + tx)];
+                    o[0] += w * cr;
+                    o[1] += w * cg;
+                    o[2] += w * cb;
+                }
+            }
+        }
+}
+
+// Scatter an RGB image through the bank
+void bokehBank::apply(const float *rgb, const float *depth, int xRes, int yRes,
+                      float *out, int nThreads) const
+{
+    bokehScatter job;
+    job.bank = this;
+    job.rgb = rgb;
+    job.depth = depth;
+    job.xRes = xRes;
+    job.yRes = yRes;
+    job.nBands = max(1, min(nThreads, yRes));
+    // A rotated tap lands within its distance from the pixel, plus one
+    // for the bilinear splat
+    float maxDist2 = 0.0f;
+    for (size_t i = 0; i < kernels.size(); i++)
+        for (size_t j = 0; j < kernels[i].size(); j++)
+            maxDist2 = max(maxDist2, kernels[i][j].t * kernels[i][j].t +
+                                     kernels[i][j].r * kernels[i][j].r);
+    job.reach = Ceil2Int(sqrtf(maxDist2)) + 1;
+    job.accum.resize(job.nBands);
+    job.accumY0.resize(job.nBands);
+    lensParallelFor(job.nBands, nThreads, scatterBand, &job);
+    // Add the bands in order, overlaps included
+    int n = 3 * xRes * yRes;
+    for (int i = 0; i < n; i++)
+        out[i] = 0.0f;
+    for (int b = 0; b < job.nBands; b++)
+    {
+        const vector<float> &acc = job.accum[b];
+        float *o = &out[3 * xRes * job.accumY0[b]];
+        for (size_t i = 0; i < acc.size(); i++)
+            o[i] += acc[i];
+    }
+}
@@ -0,0 +1,43 @@
+// A bank of defocus PSFs for post-process depth of field: kernels traced
+// through a lens system are tabulated against object distance and image
+// radius, then scattered across a pinhole render using its depth AOV
+#ifndef _LENSBOKEH_H_
+#define _LENSBOKEH_H_
+
+#include "lensquality.h"
+
+// One kernel entry, offset in sensor pixels across (t) and out along (r)
+// the radial direction of the image point it belongs to
+struct bokehTap {
+	float t, r, w;
+};
+
+class bokehBank {
+public:
+	bokehBank(void): pixel(0), maxRadius(0), invDepthMax(0),
+		nDepths(0), nFields(0) {}
+	// Tabulate kernels for objects from zNear to infinity, measured from
+	// the entrance pupil, and image radii out to maxRadius (mm) on a
+	// sensor with square pixels of size pixel (mm). Kernels are at most
+	// maxKernel pixels across and their weights sum to one.
+	bool build(const lensSystem &lsys, float zNear, float maxRadius,
+	           float pixel, int nDepths, int nFields, int maxKernel,
+	           const psfSettings &settings);
+	// Nearest kernel for an object at distance z and image radius (mm),
+	// with the vignetting there interpolated between field columns
+	const vector<bokehTap> &kernel(float z, float radius,
+	                               float *vignetting) const;
+	// Scatter an RGB image through the bank. depth holds each pixel's
+	// object distance from the entrance pupil along the lens axis.
+	void apply(const float *rgb, const float *depth, int xRes, int yRes,
+	           float *out, int nThreads) const;
+
+	float pixel;			// Sensor pixel size (mm)
+	float maxRadius;		// Largest tabulated image radius (mm)
+	float invDepthMax;		// Inverse distance of the nearest depth row
+	int nDepths, nFields;
+	vector< vector<bokehTap> > kernels;	// nDepths rows of nFields kernels
+	vector<float> vignetting;	// Transmission relative to the axis
+};
+
+#endif
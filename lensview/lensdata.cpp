@@ -1,6 +1,7 @@
 // A simple set of realistic camera lens classes
 // Nolan Goodnight <ngoodnight@cs.virginia.edu>
 #include <fstream>
+#include <sstream>
 #include "lensdata.h"
 
 #include "../core/geometry.h"
@@ -10,6 +11,7 @@
 using namespace std;
 
 #include <cmath>
+#include <algorithm>
 
 // Method to load a lens specification file and build
 // a vector of lens interfaces. 
@@ -18,70 +20,280 @@ bool lensSystem::Load(const char *file) {
     if (!lensfile) return false;
 
     this->lenses.clear();
+    this->states = LensStateTable();
+    this->stateCache.clear();
     // Iterate over the lens element specs and build
     // the lens system
     float dist = 0.0f, zpos = 0.0f;
     int elem = 0;
-    while (!lensfile.eof()) {
+    string line;
+    while (getline(lensfile, line)) {
         lensElement lens;
+        istringstream fields(line);
         string data;
 
-        lensfile >> data;
         // Remove comments and empty lines
-        if (!data.compare("#") || !data.compare("")) {
-            getline(lensfile, data);
+        if (!(fields >> data) || data[0] == '#')
+            continue;
+        // An asphere line gives the conic constant and even polynomial
+        // terms of the interface before it
+        if (data == "asphere") {
+            float k, coeffs[LENS_ASPHERE_TERMS];
+            if (this->lenses.empty() || this->lenses.back().isStop ||
+                !(fields >> k))
+                return false;
+            for (int j = 0; j < LENS_ASPHERE_TERMS; j++)
+                if (!(fields >> coeffs[j]))
+                    coeffs[j] = 0.0f;
+            this->lenses.back().setAsphere(k, coeffs);
+            continue;
+        }
+        // Zoom positions and focus distances come first; a spacing line
+        // then gives the gap after the interface before it in each state
+        if (data == "zoom" || data == "focus" || data == "spacing") {
+            // Parse with strtod so that a focus distance may be "inf"
+            vector<float> values;
+            string rest;
+            getline(fields, rest);
+            const char *s = rest.c_str();
+            for (char *end; ; s = end) {
+                float v = (float)strtod(s, &end);
+                if (end == s)
+                    break;
+                values.push_back(v);
+            }
+            if (values.empty())
+                return false;
+            if (data == "spacing") {
+                if (this->lenses.empty() || 
+                    int(values.size()) != this->states.NumStates())
+                    return false;
+                this->lenses.back().spacing = values;
+            } else
+                (data == "zoom" ? this->states.zoom : this->states.focus) = values;
             continue;
         }
         float rad  = (float)atof(data.c_str());
-        lensfile >> data;
         float axpos = dist - zpos;
         dist -= zpos;
-        zpos = (float)atof(data.c_str());
-
-        lensfile >> data;
-        float ndr  = (float)atof(data.c_str());
-        lensfile >> data;
-        float aper = (float)atof(data.c_str());
+        // Columns after the aperture hold dispersion data for the
+        // renderer, which the viewer ignores
+        float ndr, aper;
+        if (!(fields >> zpos >> ndr >> aper))
+            return false;
         if (!aper && !rad && !zpos && !ndr)
             return false;
 
         // Initialize the lens interface and store
         lens.Init(rad, axpos, ndr, aper);
+        lens.thickness = zpos;
         lens.elemNum = elem++;
         this->lenses.push_back(lens);
     }
     if (this->numLenses() < 5)
         return false;
-    this->curLens = this->numLenses() - 1;
+    // Locate the aperture stop once, so lookups need not write to it
+    this->stopElement = -1;
+    for (int i = 0; i < this->numLenses() && this->stopElement < 0; i++)
+        if (this->lenses[i].isStop)
+            this->stopElement = i;
+    if (this->stopElement < 0)
+        return false;
+    this->stopAper = this->getAperture()->aper;
+    // Start in the first zoom and focus state
+    this->zoom = this->states.zoom.empty() ? 0.0f : this->states.zoom[0];
+    this->focusDist = this->states.focus.empty() ? INFINITY : this->states.focus[0];
+    int state[4];
+    float weight[4];
+    int n = this->states.Bracket(this->zoom, this->focusDist, state, weight);
+    this->placeElements(state, weight, n);
     return true;
 }
 
+// Position the interfaces from the front vertex back, using each
+// interface's fixed gap or its blend of per-state gaps
+void lensSystem::placeElements(const int state[4], const float weight[4], int n)
+{
+    float z = 0.0f;
+    for (int i = 0; i < this->numLenses(); i++) {
+        this->lenses[i].zpos = z;
+        z -= this->lenses[i].gap(state, weight, n);
+    }
+    this->compile();
+}
+
+// Find the paraxial properties of each state once, with the stop wide
+// open, so that moving between states needs no tracing
+void lensSystem::buildStateCache()
+{
+    this->stateCache.resize(this->states.NumStates());
+    for (int k = 0; k < this->states.NumStates(); k++) {
+        int state[4] = {k};
+        float weight[4] = {1.0f};
+        this->getAperture()->aper = this->stopAper;
+        this->placeElements(state, weight, 1);
+        this->findIntrinsics();
+        lensState &s = this->stateCache[k];
+        s.f1 = this->f1; s.f2 = this->f2; s.f1T = this->f1T; s.f2T = this->f2T;
+        s.p1 = this->p1; s.p2 = this->p2; s.p1T = this->p1T; s.p2T = this->p2T;
+        s.pupil = this->pupil; s.entPupil = this->entPupil;
+        s.efl = this->efl; s.minFS = this->minFS;
+    }
+}
+
+// Move to zoom position z and focus distance d. The cardinal points and
+// pupils are blended from the cached states around (z, d), and the
+// current fstop is kept where the new state allows it.
+void lensSystem::setState(float z, float d)
+{
+    float fstop = this->fstop;
+    if (this->stateCache.empty())
+        this->buildStateCache();
+    int state[4];
+    float weight[4];
+    if (!this->states.zoom.empty())
+        z = Clamp(z, this->states.zoom.front(), this->states.zoom.back());
+    int n = this->states.Bracket(z, d, state, weight);
+    this->zoom = z;
+    this->focusDist = d;
+    this->getAperture()->aper = this->stopAper;
+    this->placeElements(state, weight, n);
+
+    lensState s = lensState();
+    for (int j = 0; j < n; j++) {
+        const lensState &c = this->stateCache[state[j]];
+        float w = weight[j];
+        s.f1 += w * c.f1; s.f2 += w * c.f2; s.f1T += w * c.f1T; s.f2T += w * c.f2T;
+        s.p1 += w * c.p1; s.p2 += w * c.p2; s.p1T += w * c.p1T; s.p2T += w * c.p2T;
+        s.pupil += c.pupil * w; s.entPupil += c.entPupil * w;
+        s.efl += w * c.efl; s.minFS += w * c.minFS;
+    }
+    this->f1 = s.f1; this->f2 = s.f2; this->f1T = s.f1T; this->f2T = s.f2T;
+    this->p1 = s.p1; this->p2 = s.p2; this->p1T = s.p1T; this->p2T = s.p2T;
+    this->efl = s.efl;
+    this->minFS = s.minFS;
+    this->thetaMax = asin(min(1.0f, 1.0f / (2.0f * this->minFS)));
+    this->buildThickMatrices();
+
+    // The cached pupils are for the open stop; scale them to the fstop
+    this->fstop = max(fstop, this->minFS);
+    this->recalAper();
+    float scale = this->getAperture()->aper / this->stopAper;
+    this->pupil = Point(0, s.pupil.y * scale, s.pupil.z);
+    this->entPupil = Point(0, s.entPupil.y * scale, s.entPupil.z);
+    // Image planes of the old state no longer apply
+    this->focus = focusTable();
+}
+
+// Rebuild the flattened prescription from the lens elements; must be
+// called whenever an element's radius, position, index or aperture changes
+void lensSystem::compile()
+{
+    this->prescription.Clear();
+    for (int i = 0; i < this->numLenses(); i++) {
+        const lensElement &lens = this->lenses[i];
+        this->prescription.AddSurface(lens.rad, lens.zpos, this->mediumAfter(i),
+                                      lens.aper, lens.isStop);
+        this->prescription.SetAsphere(i, lens.conic, lens.asphere);
+    }
+}
+
+// Paint the segments of a traced ray between the interfaces it reached,
+// skipping interfaces marked unreached with an infinite hit point
+static void paintPath(lensPainter *paint, const Point &o,
+                      const vector<Point> &hits, int first, int last, int step)
+{
+    Point prev = o;
+    for (int i = first; i != last + step && hits[i].z != INFINITY; i += step) {
+        paint->line(prev.z, prev.y, hits[i].z, hits[i].y);
+        prev = hits[i];
+    }
+}
+
 // Method to intersect two rays
-void intersectRay(Ray r1, Ray r2, float* tHit)
+static void intersectRay(const Ray &r1, const Ray &r2, float* tHit)
 {
     *tHit = -(r2.d.y*r1.o.z - r2.d.z*r1.o.y - r2.d.y*r2.o.z + r2.d.z*r2.o.y)/(r1.d.z*r2.d.y - r1.d.y*r2.d.z);
 }
 
-// Find exit pupil
+// Index of refraction of the medium behind an interface
+float lensSystem::mediumAfter(int i) const
+{
+    if (i < 0 || this->lenses[i].ndr == 0.0f)
+        return 1.0f;
+    return this->lenses[i].ndr;
+}
+
+// Paraxial transfer matrix from the vertex of interface first to the
+// vertex of interface last, for rays travelling towards the image.
+// The sub-system is assumed to sit in air.
+rayTransfer lensSystem::paraxialMatrix(int first, int last) const
+{
+    rayTransfer m;
+    for (int i = first; i <= last; i++)
+    {
+        const lensElement &lens = this->lenses[i];
+        float nBefore = i == first ? 1.0f : this->mediumAfter(i-1);
+        float nAfter = this->mediumAfter(i);
+        // Refraction at the interface
+        if (!lens.isStop && lens.rad != 0.0f)
+            m = rayTransfer(1, 0, -(nAfter - nBefore) / lens.rad, 1) * m;
+        // Transfer to the next vertex
+        if (i < last)
+        {
+            float d = lens.zpos - this->lenses[i+1].zpos;
+            m = rayTransfer(1, d / nAfter, 0, 1) * m;
+        }
+    }
+    return m;
+}
+
+// Paraxial focal points (f, fp) and principal planes (p, pp) of the
+// sub-system [first, last]; returns false for an afocal sub-system
+bool lensSystem::paraxialCardinal(int first, int last, float* f, float* fp,
+                                  float* p, float* pp) const
+{
+    rayTransfer m = this->paraxialMatrix(first, last);
+    if (m.C == 0.0f)
+        return false;
+    float focal = -1.0f / m.C;
+    // Image travels towards -z, so distances behind the last vertex
+    // are subtracted and distances in front of the first are added
+    *fp = this->lenses[last].zpos + m.A / m.C;
+    *pp = *fp + focal;
+    *f = this->lenses[first].zpos - m.D / m.C;
+    *p = *f - focal;
+    return true;
+}
+
+// Find exit pupil: the paraxial image of the stop through the
+// elements behind it
 void lensSystem::findExitPupil()
 {
     lensElement* aperture = this->getAperture();
-    Point e = Point(0, aperture->aper/2, aperture->zpos);
-    Point i;
-    e.z -= this->p1T;
-    this->thickLens(e, &i, this->backThick);
-    i.z += this->p1T;
-
-    //drawPoint(5, e.z+this->p1T, e.y);
-    //glColor3f(1.0, 0.0, 0.0);
-    //drawPoint(5, i.z, i.y);
+    int last = this->numLenses() - 1;
+    rayTransfer m = this->paraxialMatrix(aperture->elemNum, last);
+    if (m.D == 0.0f)
+        return;
+    this->pupil.z = this->lenses[last].zpos + m.B / m.D;
+    this->pupil.y = fabs(aperture->aper / m.D);
+}
 
-    this->pupil.z = i.z;
-    this->pupil.y = i.y*2.0;
+// Find entrance pupil: the paraxial image of the stop through the
+// elements in front of it
+void lensSystem::findEntrancePupil()
+{
+    lensElement* aperture = this->getAperture();
+    rayTransfer m = this->paraxialMatrix(0, aperture->elemNum);
+    if (m.A == 0.0f)
+        return;
+    this->entPupil.z = this->lenses[0].zpos - m.B / m.A;
+    this->entPupil.y = fabs(aperture->aper / m.A);
 }
 
 // Calculates thick lens transformation
-void lensSystem::thickLens(Point &e, Point* et, Reference<Matrix4x4> transform)
+void lensSystem::thickLens(const Point &e, Point* et,
+                           const Reference<Matrix4x4> &transform) const
 {
     Point ef = e;
 
@@ -108,10 +320,7 @@ void lensSystem::refocus(float zPos, int direction)
     //	this->iPlane = this->f2 - min(T0, T1);//-68.1 - min(T0, T1);//
     //	printf("z: %4.2f\n", z);
     //}
-    float avgZ = 0.0;
-    int counter = 0;
-    printf("refocus - 1\n");
-    if ((this->iPlane <= this->f2 - 70.0 || zPos <= 10) && direction == -1)
+    if ((this->iPlane <= this->f2 - FOCUS_TRAVEL || zPos <= 10) && direction == -1)
     {
         this->stopTrans = 0;
     } else if (direction == 1)
@@ -119,46 +328,217 @@ void lensSystem::refocus(float zPos, int direction)
         this->stopTrans = 1;
     }
 
-    printf("refocus - 2\n");
+    // Interpolate from the focus-pull table when it covers zPos
+    float plane;
+    if (this->focus.lookup(zPos, this->getAperture()->aper, &plane) ||
+        this->findImagePlane(zPos, &plane))
+        this->iPlane = plane;
+}
 
+// Trace a fan of rays from an object at zPos (possibly at infinity) and
+// average where they cross the axis behind the lens. Rays start just in
+// front of the lens with unit directions, since distant origins and long
+// directions lose precision in the sphere intersections.
+bool lensSystem::findImagePlane(float zPos, float* plane) const
+{
+    if (this->lenses.empty())
+        return false;
+    float avgZ = 0.0;
+    int counter = 0;
+    float aper = this->getAperture()->aper;
+    // Clear the front surface's sag, which is at most its semi-aperture
+    const lensElement &front = this->lenses[0];
+    float zStart = min(zPos, front.zpos + 0.5f * front.aper);
     for (int i = -8; i <= 8; i++)
     {
-        printf("refocus - 3 - 1\n");
-        Ray focalRay = Ray(Point(0, 0, zPos), Vector(0, this->getAperture()->aper/(i*2), -zPos));
-        printf("refocus - 3 - 2\n");
+        if (i == 0)
+            continue;
+        float h = aper/(i*2);
+        Ray focalRay = zPos == INFINITY ?
+            Ray(Point(0, h, zStart), Vector(0, 0, -1)) :
+            Ray(Point(0, h*(1 - zStart/zPos), zStart), Normalize(Vector(0, h, -zPos)));
         Ray lensRay;
-        printf("refocus - 3 - 3\n");
-        TraceF(focalRay, &lensRay, false);
+        if (!TraceF(focalRay, &lensRay))
+            continue;
         float tHit;
-        printf("refocus - 3 - 4\n");
         intersectRay(lensRay, Ray(Point(0,0,0), Vector(0,0,-1)), &tHit);
-        printf("refocus - 3 - 5\n");
         if (tHit > 0)
         {
-            //printf("%4.2f\n", tHit);
-            //this->iPlane = lensRay(tHit).z;
             avgZ += lensRay(tHit).z;
-            printf("refocus - 3 - 6\n");
             counter++;
-            //if (lensRay(tHit).z <= this->f2-99)
-            //this->stopTrans = 0;
         }
     }
-    printf("refocus - 3 - 7\n");
-    avgZ /= counter;
-    this->iPlane = avgZ;
+    if (counter == 0)
+        return false;
+    *plane = avgZ / counter;
+    return true;
+}
+
+// Area of the region in the rear element's plane through which rays
+// from film height h on the image plane pass through the system. A
+// coarse grid across 1.5 times the rear element bounds the region, as
+// computePSF does for the entrance pupil, and an n x n grid over the
+// bound measures it, so that the rays are not spent where none pass.
+float lensSystem::transmission(float h, int n) const
+{
+    const lensElement &rear = this->lenses.back();
+    Point pFilm(0, h, this->iPlane);
+    float r = 0.75f * rear.aper;
+    const int nCoarse = 64;
+    float cell = 2.0f * r / nCoarse;
+    float xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY;
+    for (int j = 0; j < nCoarse; j++)
+        for (int i = 0; i < nCoarse; i++)
+        {
+            float x = -r + (i + 0.5f) * cell, y = -r + (j + 0.5f) * cell;
+            Ray ray(pFilm, Normalize(Point(x, y, rear.zpos) - pFilm)), res;
+            if (!this->TraceB(ray, &res))
+                continue;
+            xMin = min(xMin, x); xMax = max(xMax, x);
+            yMin = min(yMin, y); yMax = max(yMax, y);
+        }
+    if (xMin > xMax || n <= 0)
+        return 0.0f;
+    // The bound is widened by a coarse cell, where the region's edge
+    // may lie between coarse rays
+    float x0 = xMin - cell, y0 = yMin - cell;
+    float dx = (xMax - xMin + 2.0f * cell) / n;
+    float dy = (yMax - yMin + 2.0f * cell) / n;
+    int passed = 0;
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++)
+        {
+            Point pRear(x0 + (i + 0.5f) * dx, y0 + (j + 0.5f) * dy, rear.zpos);
+            Ray ray(pFilm, Normalize(pRear - pFilm)), res;
+            if (this->TraceB(ray, &res))
+                passed++;
+        }
+    return passed * dx * dy;
+}
+
+// Percent distortion at film height h: the chief ray through the centre
+// of the exit pupil leaves at angle theta, against an ideal image height
+// of efl * tan(theta). The image is inverted, so theta points below the
+// axis for film points above it.
+bool lensSystem::distortion(float h, float* percent) const
+{
+    if (h == 0)
+    {
+        *percent = 0;
+        return true;
+    }
+    Point pFilm(0, h, this->iPlane);
+    Ray chief(pFilm, Normalize(Point(0, 0, this->pupil.z) - pFilm)), res;
+    if (!this->TraceB(chief, &res) || res.d.z == 0)
+        return false;
+    float ideal = -this->efl * res.d.y / res.d.z;
+    if (ideal == 0)
+        return false;
+    *percent = 100.0f * (h - ideal) / ideal;
+    return true;
+}
+
+// Closest object distance reachable within FOCUS_TRAVEL, from Newton's
+// equation x * x' = efl^2 measured from the focal points
+float lensSystem::nearFocus(void) const
+{
+    return max(10.0f, this->f1 + this->efl * this->efl / FOCUS_TRAVEL);
+}
+
+// Tabulate image planes for n object distances spaced uniformly in
+// inverse distance, from infinity down to zNear
+bool lensSystem::buildFocusTable(float zNear, int n)
+{
+    this->focus = focusTable();
+    if (n < 2 || zNear <= 0)
+        return false;
+    this->focus.aper = this->getAperture()->aper;
+    for (int i = 0; i < n; i++)
+    {
+        float invDist = float(i) / float(n - 1) / zNear;
+        float plane;
+        if (!this->findImagePlane(invDist > 0 ? 1.0f / invDist : INFINITY, &plane))
+            continue;
+        // Keep the table monotone: images recede as objects approach
+        if (!this->focus.iPlane.empty() && plane >= this->focus.iPlane.back())
+            continue;
+        this->focus.invDist.push_back(invDist);
+        this->focus.iPlane.push_back(plane);
+    }
+    if (this->focus.invDist.size() < 2)
+    {
+        this->focus = focusTable();
+        return false;
+    }
+    return true;
+}
+
+// Interpolate the image plane for an object at zPos by binary search
+bool focusTable::lookup(float zPos, float _aper, float* plane) const
+{
+    if (this->invDist.size() < 2 || _aper != this->aper || zPos <= 0)
+        return false;
+    float inv = zPos == INFINITY ? 0.0f : 1.0f / zPos;
+    if (inv < this->invDist.front() || inv > this->invDist.back())
+        return false;
+    int i = int(upper_bound(this->invDist.begin(), this->invDist.end(), inv) -
+                this->invDist.begin()) - 1;
+    i = min(max(i, 0), int(this->invDist.size()) - 2);
+    float t = (inv - this->invDist[i]) / (this->invDist[i+1] - this->invDist[i]);
+    *plane = this->iPlane[i] + t * (this->iPlane[i+1] - this->iPlane[i]);
+    return true;
+}
+
+// Write the focus-pull table as text
+bool focusTable::Save(const char *file) const
+{
+    ofstream tablefile(file);
+    if (!tablefile) return false;
+    tablefile.precision(9);
+    tablefile << "focustable " << this->aper << " " << this->invDist.size() << "\n";
+    for (unsigned int i = 0; i < this->invDist.size(); i++)
+        tablefile << this->invDist[i] << " " << this->iPlane[i] << "\n";
+    return bool(tablefile);
+}
+
+// Read a focus-pull table written by Save
+bool focusTable::Load(const char *file)
+{
+    ifstream tablefile(file);
+    string tag;
+    int n = 0;
+    if (!tablefile || !(tablefile >> tag >> this->aper >> n) ||
+        tag != "focustable" || n < 2)
+        return false;
+    this->invDist.resize(n);
+    this->iPlane.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        if (!(tablefile >> this->invDist[i] >> this->iPlane[i]) ||
+            (i > 0 && (this->invDist[i] <= this->invDist[i-1] ||
+                       this->iPlane[i] >= this->iPlane[i-1])))
+        {
+            *this = focusTable();
+            return false;
+        }
+    }
+    return true;
 }
 
 // Find intrinsic lens properties
 void lensSystem::findIntrinsics()
 {
-    printf("findIntrinsics - 1\n");
     this->findFp();
-    printf("findIntrinsics - 2\n");
     this->findF();
-    printf("findIntrinsics - 3\n");
     this->findMinFStop();
-    printf("findIntrinsics - 4\n");
+    this->buildThickMatrices();
+    this->recalAper();
+    this->findExitPupil();
+}
+
+// Thick lens matrices for the principal planes and focal points
+void lensSystem::buildThickMatrices()
+{
     float t = this->p2T - this->p1T;
     float a = 1.0 + t / (this->f2T - this->p2T);
     float b = 1.0 / (this->f2T - this->p2T);
@@ -176,111 +556,41 @@ void lensSystem::findIntrinsics()
                             0.0,	1.0,	0.0,	0.0,
                             0.0,	0.0,	a,		t,
                             0.0,	0.0,	b,		1.0);
-
-    printf("findIntrinsics - 5\n");
-    this->recalAper();
-    printf("findIntrinsics - 6\n");
-    this->findExitPupil();
-    printf("findIntrinsics - 7\n");
 }
 
-// Recalculates aperture
+// Recalculates aperture: the stop diameter whose paraxial entrance
+// pupil gives the current fstop
 void lensSystem::recalAper()
 {
-    float theta = asin(1.0f/(2.0f*this->fstop));
-    Ray r1 = Ray(Point(0.0f, 0.0f, this->f2), Vector(0.0f, (this->lenses[this->lenses.size()-1].zpos - this->f2)*tan(theta), this->lenses[this->lenses.size()-1].zpos - this->f2));
-    drawLine(r1(0).z, r1(0).y, r1(10).z, r1(10).y);
-    Ray r2;
     lensElement* aperture = this->getAperture();
-    aperture->aper += 10;
-    float tHit;
-
-    // Trace ray at max theta through system
-    TraceB(r1, &r2, true, aperture->elemNum);
-    // Find intersection with aperture interface
-    intersectRay(r2, Ray(Point(0, 0, aperture->zpos), Vector(0, 1, 0)), &tHit);
-    // Update aperture size
-    aperture->aper = r2(tHit).y*2;
-    //glColor3f(1.0, 0.0, 0.0);
-    //drawLine(r2(0).z, r2(0).y, r2(10).z, r2(10).y);
+    rayTransfer m = this->paraxialMatrix(0, aperture->elemNum);
+    aperture->aper = fabs(m.A * this->efl / this->fstop);
+    this->compile();
 }
 
 
 
 
-// Find the minimum fstop
+// Find the minimum fstop from the paraxial entrance pupil
 void lensSystem::findMinFStop()
 {
-    printf("findMinFStop - 1\n");
-    lensElement* stop = this->getAperture();
-    printf("findMinFStop - 2\n");
-    float xHit = 0.0;
-    Ray aperRay;
-    for (int i = 0; i < 1000; i++)
-    {
-        float theta = (float) i / 2000.0 * M_PI;
-        float yDir = tan(theta);
-        Ray topAp = Ray(Point(0, stop->aper/2 - .05, stop->zpos), Vector(0,-yDir,-1));
-        Ray botAp = Ray(Point(0, -stop->aper/2 + .05, stop->zpos), Vector(0,yDir,-1));
-        float rayIntersection;
-        printf ("rayIntersection %f \n", rayIntersection);
-
-        Ray topRes;
-        Ray botRes;
-        glColor3f(1.0, 0.5, 0.25);
-        printf("findMinFStop - 3\n");
-        TraceF(topAp, &topRes, false, this->stopElement+1);
-        printf("findMinFStop - 4\n");
-        TraceF(botAp, &botRes, false, this->stopElement+1);
-        printf("findMinFStop - 5\n");
-        intersectRay(topRes, botRes, &rayIntersection);
-        printf("findMinFStop - 6\n");
-
-        printf("rayIntersection %f \n", rayIntersection);
-        if (rayIntersection != rayIntersection )
-        {
-            printf("chamnge the value \n");
-            rayIntersection = 0.0000001f;
-
-        }
-
-
-        printf("rayIntersection %9.9f \n", rayIntersection);
-        if (topRes(rayIntersection).y == 0)
-        {
-            printf("findMinFStop - 7 - 1 \n");
-            float val1 = (topRes(rayIntersection).z - this->f2);
-
-            printf("findMinFStop - 7 - 2\n");
-            float val2 = (xHit - this->f2);
-            //drawLine(topRes(0).x, topRes(0).y, topRes(50).x, topRes(50).y);
-            printf("findMinFStop - 7 - 3\n");
-            if (abs(val1) < abs(val2))
-            {
-                printf("findMinFStop - 7 - 4\n");
-                xHit = topRes(rayIntersection).z;
-                aperRay = topRes;
-            }
-        }
-        printf("findMinFStop - 8 -1 \n");
-    }
-    printf("findMinFStop - 8\n");
-    Vector aperVec = Vector(0, aperRay(0).y, aperRay(0).z-xHit);
-    float theta = acos(Dot(aperVec, Vector(0,0,1)) / aperVec.Length());
-    this->thetaMax = theta;
-    this->minFS = 1.0 / ( 2.0 * sin(theta));
+    this->findEntrancePupil();
+    if (this->entPupil.y == 0.0)
+        return;
+    this->minFS = fabs(this->efl / this->entPupil.y);
+    this->thetaMax = asin(min(1.0f, 1.0f / (2.0f * this->minFS)));
     this->fstop = this->minFS;
 }
 
 // Trace a ray through the system
-bool lensSystem::Trace(Ray &ray, Ray* res)
+bool lensSystem::Trace(const Ray &ray, Ray* res, lensPainter *paint) const
 {
     if (this->M == precise)
     {
         if (ray(0).z - ray(1).z < 0)
-            return TraceB(ray, res, true);
+            return TraceB(ray, res, paint);
         else
-            return TraceF(ray, res, true);
+            return TraceF(ray, res, paint);
     } else
     {
         Ray r1 = ray;
@@ -289,100 +599,78 @@ bool lensSystem::Trace(Ray &ray, Ray* res)
         intersectRay(r1, Ray(Point(0,-this->maxAperture(),pTest), Vector(0,1,0)), &tHit);
         if (tHit < 0)
             return false;
-        drawLine(r1(0).z, r1(0).y, r1(tHit).z, r1(tHit).y);
-        drawLine(r1(tHit).z, r1(tHit).y, max(this->p2, this->p1), r1(tHit).y);
+        float yHit = r1(tHit).y;
+        if (paint)
+        {
+            paint->line(r1(0).z, r1(0).y, r1(tHit).z, yHit);
+            paint->line(r1(tHit).z, yHit, max(this->p2, this->p1), yHit);
+        }
         r1.o.z -= this->p2;
         thickLens(r1.o, &(*res).o, this->thick);
         (*res).o.z += this->p2;
-        drawLine(max(this->p2, this->p1), r1(tHit).y, (*res).o.z, (*res).o.y);
-        drawPoint(5, (*res).o.z, (*res).o.y);
+        if (paint)
+        {
+            paint->line(max(this->p2, this->p1), yHit, (*res).o.z, (*res).o.y);
+            paint->point(5, (*res).o.z, (*res).o.y);
+        }
+        return true;
     }
 }
 
-// Trace rays to find (focal point)'
+// Find (focal point)' and (principal plane)' from the paraxial matrix,
+// refined by a single near-axis trace through the real interfaces
 void lensSystem::findFp()
 {
+    int last = this->numLenses() - 1;
+    int stop = this->getAperture()->elemNum;
+    float f, p;
+    this->paraxialCardinal(0, last, &f, &(this->f2), &p, &(this->p2));
+    this->paraxialCardinal(stop, last, &f, &(this->f2T), &p, &(this->p2T));
+
     Ray focalRay;
-    //Only really need to do this once for the system
-    for (int i = 0; i < 100000; i++)
+    Ray testRay = Ray(Point(0.0, this->minAperture() / 100.0, 1.0), Vector(0.0, 0.0, -1.0));
+    if (TraceF(testRay, &focalRay) && focalRay.d.y != 0.0)
     {
-        Ray testRay = Ray(Point(0.0, this->minAperture() / 8.0 - (float) i/1000.0, 1.0), Vector(0.0, 0.0, -1.0));
-        //glColor3f(0.0, 1.0, 0.0);
-        if (TraceF(testRay, &focalRay, false))
-        {
-            // Compute focal point
-            float fp = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
-            // Compute principal axis'
-            this->findP(focalRay, testRay, &(this->p2));
-            //printf("F': %4.2f\n", fp);
-            this->f2 = fp;
-            this->iPlane = fp; // -68.1
-            break;
-        }
+        this->f2 = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
+        this->findP(focalRay, testRay, &(this->p2));
     }
-    focalRay = Ray();
-    //Find f' and P' for back half
-    for (int i = 0; i < 100000; i++)
+    // Refine f' and P' for back half
+    if (TraceF(testRay, &focalRay, NULL, stop) && focalRay.d.y != 0.0)
     {
-        Ray testRay = Ray(Point(0.0, this->minAperture() / 8.0 - (float) i/1000.0, 1.0), Vector(0.0, 0.0, -1.0));
-        glColor3f(1.0, 0.0, 0.0);
-        if (TraceF(testRay, &focalRay, false, getAperture()->elemNum))
-        {
-            // Compute focal point
-            float fpT = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
-            drawPoint(5, fpT, 0);
-            // Compute principal axis'
-            this->findP(focalRay, testRay, &(this->p2T));
-            //printf("F': %4.2f\n", fp);
-            this->f2T = fpT;
-            break;
-        }
+        this->f2T = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
+        this->findP(focalRay, testRay, &(this->p2T));
     }
+    this->efl = this->p2 - this->f2;
+    this->iPlane = this->f2;
 }
 
-// Trace rays to find focal point
+// Find focal point and principal plane from the paraxial matrix,
+// refined by a single near-axis trace through the real interfaces
 void lensSystem::findF()
 {
+    int last = this->numLenses() - 1;
+    int stop = this->getAperture()->elemNum;
+    float f, p;
+    this->paraxialCardinal(0, last, &(this->f1), &f, &(this->p1), &p);
+    this->paraxialCardinal(stop, last, &(this->f1T), &f, &(this->p1T), &p);
+
     Ray focalRay;
-    //Only really need to do this once for the system
-    for (int i = 0; i < 100000; i++)
+    Ray testRay = Ray(Point(0.0, this->minAperture() / 100.0, this->lenses[last].zpos - 1.0), Vector(0.0, 0.0, 1.0));
+    if (TraceB(testRay, &focalRay) && focalRay.d.y != 0.0)
     {
-        Ray testRay = Ray(Point(0.0, this->minAperture() / 8.0 - (float) i/1000.0, this->lenses[this->lenses.size()-1].zpos - 1.0), Vector(0.0, 0.0, 1.0));
-        //glColor3f(0.0, 1.0, 0.0);
-        if (TraceB(testRay, &focalRay, false))
-        {
-            // Compute focal point
-            float f = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
-            // Compute principal axis
-            this->findP(focalRay, testRay, &(this->p1));
-            //printf("F: %4.2f\n", f);
-            this->f1 = f;
-            break;
-        }
+        this->f1 = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
+        this->findP(focalRay, testRay, &(this->p1));
     }
-    focalRay = Ray();
-    // Find f and P for back half of lens system
-    for (int i = 0; i < 100000; i++)
+    // Refine f and P for back half of lens system
+    if (TraceB(testRay, &focalRay, NULL, stop) && focalRay.d.y != 0.0)
     {
-        Ray testRay = Ray(Point(0.0, this->minAperture() / 8.0 - (float) i/1000.0, this->lenses[this->lenses.size()-1].zpos - 1.0), Vector(0.0, 0.0, 1.0));
-        glColor3f(1.0, 0.0, 0.0);
-        if (TraceB(testRay, &focalRay, false, getAperture()->elemNum))
-        {
-            // Compute focal point
-            float fT = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
-            drawLine(focalRay(0).z, focalRay(0).y, focalRay(100).z, focalRay(100).y);
-            drawPoint(5, fT, 0);
-            // Compute principal axis
-            this->findP(focalRay, testRay, &(this->p1T));
-            //printf("F: %4.2f\n", f);
-            this->f1T = fT;
-            break;
-        }
+        this->f1T = focalRay.o.z + (-focalRay.o.y/focalRay.d.y)*focalRay.d.z;
+        this->findP(focalRay, testRay, &(this->p1T));
     }
 }
 
 // Trace rays to find principal axis
-void lensSystem::findP(const Ray focalRay, const Ray r2, float* p)
+void lensSystem::findP(const Ray &focalRay, const Ray &r2, float* p) const
 {
     Ray r1 = Ray(focalRay(-focalRay.o.y/focalRay.d.y), -focalRay.d);
     float t1;
@@ -394,239 +682,51 @@ void lensSystem::findP(const Ray focalRay, const Ray r2, float* p)
 }
 
 // Trace a ray forward (from focal plane) through the system
-bool lensSystem::TraceF(Ray &ray, Ray* res, bool draw, int startLens)
+bool lensSystem::TraceF(const Ray &ray, Ray* res, lensPainter *paint,
+                        int startLens) const
 {
-    printf("TraceF - 1\n");
-    float tHit;
-    Ray r = ray;
-    //drawLine(ray(0).x, ray(0).y, ray(1).x, ray(1).y);
-    Vector n;
-    this->curLens = max(this->curLens, 0);
-    printf("TraceF - 2\n");
-    int lensSize = this->lenses.size();
-    this->curLens = min(this->curLens, lensSize);
-    printf("TraceF - 3\n");
-    //int i = this->curLens;
-    int lensSizess = this->lenses.size();
-
-    if (lensSizess > 0)
-    {
-        for (int i = startLens; i < lensSizess ; i++)
-        {
-            printf("TraceF - 4\n");
-            if(this->lenses[i].isStop)
-            {
-                printf("TraceF - 5\n");
-                float phiMax = Radians(360.0f);
-                printf("TraceF - 6\n");
-                //r.o = r.o - Vector(center) + negativeRad * Vector(Point(radius,0,0));
-                // Compute plane intersection for disk
-                printf("TraceF - 7\n");
-                if (fabsf(r.d.z) < 1e-7) return false;
-                printf("TraceF - 8\n");
-                float thit = (this->lenses[i].zpos - r.o.z) / r.d.z;
-                if (thit < r.mint || thit > r.maxt)
-                    return false;
-
-                printf("TraceF - 9\n");
-                // See if hit point is inside disk radii and \phimax
-                Point phit = r(thit);
-                printf("TraceF - 10\n");
-                float dist2 = phit.x * phit.x + phit.y * phit.y;
-                if (dist2 > (this->lenses[i].aper/2) * (this->lenses[i].aper/2) ||
-                        dist2 < 0)
-                    return false;
-                printf("TraceF - 11\n");
-                // Test disk $\phi$ value against \phimax
-                float phi = atan2f(phit.y, phit.x);
-                printf("TraceF - 12\n");
-                if (phi < 0) phi += 2. * M_PI;
-
-                if (phi > phiMax)
-                    return false;
-            }
-            else if(this->lenses[i].lensSph.Intersect(r, &tHit, &n) && !this->lenses[i].isStop)
-            {
-                if (draw)
-                    drawLine(r(0).z, r(0).y, r(tHit).z, r(tHit).y);
-
-                float prevN = i == 0 || this->lenses[i-1].ndr == 0 ? 1 : this->lenses[i-1].ndr;
-                float mu = prevN / this->lenses[i].ndr;
-
-                Vector rayHit = Vector(r(tHit)-r(0));
-
-                float gamma = mu - 1;
-                r.o = r(tHit);
-                r.d = mu * Normalize(rayHit) - gamma * Normalize(n);
-                if ((i == this->lenses.size()-1) && draw)
-                    drawLine(r(0).z, r(0).y, r(100).z, r(100).y);
-                //printf("HIT %0.2f: (%0.2f, %0.2f)\n", ray.o.y, ray(tHit).x, ray(tHit).y);
-            } else
-            {
-                return false;
-                //drawLine(ray(0).x, ray(0).y, ray(INFINITY).x, ray(INFINITY).y);
-            }
-        }
-    }
-
-
-
-    *res = r;
-    return true;
+    if (!paint)
+        return this->prescription.TraceFromScene(ray, res, NULL, startLens);
+    Point unreached(INFINITY, INFINITY, INFINITY);
+    vector<Point> hits(this->numLenses(), unreached);
+    bool passed = this->prescription.TraceFromScene(ray, res, &hits[0], startLens);
+    paintPath(paint, ray.o, hits, startLens, this->numLenses() - 1, 1);
+    if (passed)
+        paint->line(res->o.z, res->o.y, (*res)(100).z, (*res)(100).y);
+    return passed;
 }
 
 // Trace a ray backward (from image plane) through the system
-bool lensSystem::TraceB(Ray &ray, Ray* res, bool draw, int endLens)
+bool lensSystem::TraceB(const Ray &ray, Ray* res, lensPainter *paint,
+                        int endLens) const
 {
-    float tHit;
-    Ray r = ray;
-    Vector n;
-    this->curLens = std::max(this->curLens, 0);
-
-    int sizeLens = this->lenses.size();
-    this->curLens = std::min(this->curLens, sizeLens);
-    //int i = this->curLens;
-    for (int i = this->lenses.size() - 1; i >= endLens; i--)
-    {
-        if(this->lenses[i].isStop)
-        {
-            float phiMax = Radians(360.0f);
-            lensElement aperture = this->lenses[i];
-            // Compute plane intersection for disk
-            if (fabsf(r.d.z) < 1e-7) return false;
-            float thit = (aperture.zpos - r.o.z) / r.d.z;
-            if (thit < r.mint || thit > r.maxt)
-                return false;
-            // See if hit point is inside disk radii and \phimax
-            Point phit = r(thit);
-            float dist2 = phit.x * phit.x + phit.y * phit.y;
-            if (dist2 > (aperture.aper/2) * (aperture.aper/2) ||
-                    dist2 < 0)
-                return false;
-            // Test disk $\phi$ value against \phimax
-            float phi = atan2f(phit.y, phit.x);
-            if (phi < 0) phi += 2. * M_PI;
-            if (phi > phiMax)
-                return false;
-        }
-        else if(this->lenses[i].lensSph.Intersect(r, &tHit, &n))
-        {
-            if (draw)
-                drawLine(r(0).z, r(0).y, r(tHit).z, r(tHit).y);
-            float nextN = i == 0 || this->lenses[i-1].ndr == 0 ? 1 : this->lenses[i-1].ndr;
-            float mu = this->lenses[i].ndr / nextN;
-
-            Vector rayHit = Vector(r(tHit)-r(0));
-
-            float gamma = mu - 1;
-            r.o = r(tHit);
-            r.d = mu * Normalize(rayHit) + gamma * Normalize(n);
-            if (i == 0 && draw)
-                drawLine(r(0).z, r(0).y, r(300).z, r(300).y);
-        } else
-        {
-            return false;
-        }
-    }
-    *res = r;
-    return true;
-}
-
-// Draw the entire lens system (all interfaces and aperture)
-void lensSystem::Draw(void) {
-
-    glColor3f(0.75f, 0.75f, 0.75f); glLineWidth(1);
-    vector<lensElement>::iterator Li, Ln;
-
-    for (Li = lenses.begin(); Li != lenses.end(); Li++)
-        if (Li->isActive && !Li->isStop)
-            Li->Draw();
-
-    for (Li = lenses.begin(); Li != lenses.end() - 1; Li++) {
-        Ln = Li + 1;
-        if ((Ln->isStop || Li->isStop) || Li->isAir() || !Li->isActive)
-            continue;
-
-        float lip[2] = {Li->edge[X], Li->edge[Y]};
-        float lnp[2] = {Ln->edge[X], Ln->edge[Y]};
-
-        if (Li->aper < Ln->aper) {
-            drawLine(lip[X],  lip[Y], lip[X],  lnp[Y]);
-            drawLine(lnp[X],  lnp[Y], lip[X],  lnp[Y]);
-            drawLine(lip[X], -lip[Y], lip[X], -lnp[Y]);
-            drawLine(lnp[X], -lnp[Y], lip[X], -lnp[Y]);
-        } else {
-            drawLine(lip[X],  lip[Y], lnp[X],  lip[Y]);
-            drawLine(lnp[X],  lnp[Y], lnp[X],  lip[Y]);
-            drawLine(lip[X], -lip[Y], lnp[X], -lip[Y]);
-            drawLine(lnp[X], -lnp[Y], lnp[X], -lip[Y]);
-        }
-    }
-
-    // Draw the aperture stop interface
-    lensElement *stop = this->getAperture();
-    float maxp = this->maxAperture();
-    float haxp = stop->aper / 2.0f;
-    float taxp = haxp + maxp / 2.0f;
-    glColor3f(1, 1, 1);
-    glLineWidth(2);
-    drawLine(stop->zpos, haxp, stop->zpos, taxp);
-    drawLine(stop->zpos, -haxp, stop->zpos, -taxp);
-    glLineWidth(1);
+    if (!paint)
+        return this->prescription.TraceFromFilm(ray, res, NULL, endLens);
+    Point unreached(INFINITY, INFINITY, INFINITY);
+    vector<Point> hits(this->numLenses(), unreached);
+    bool passed = this->prescription.TraceFromFilm(ray, res, &hits[0], endLens);
+    paintPath(paint, ray.o, hits, this->numLenses() - 1, endLens, -1);
+    if (passed && endLens == 0)
+        paint->line(res->o.z, res->o.y, (*res)(300).z, (*res)(300).y);
+    return passed;
 }
 
 // Get the maximum aperture in the lens system
-float lensSystem::maxAperture(void) {
+float lensSystem::maxAperture(void) const {
     float dist = 0.0f;
-    vector<lensElement>::iterator Li;
+    vector<lensElement>::const_iterator Li;
     for (Li = lenses.begin(); Li != lenses.end(); Li++)
         if (Li->aper > dist)
             dist = Li->aper;
     return dist;
 }
 
-// Get the maximum aperture in the lens system
-float lensSystem::minAperture(void) {
+// Get the minimum aperture in the lens system
+float lensSystem::minAperture(void) const {
     float dist = INFINITY;
-    vector<lensElement>::iterator Li;
+    vector<lensElement>::const_iterator Li;
     for (Li = lenses.begin(); Li != lenses.end(); Li++)
         if (Li->aper < dist)
             dist = Li->aper;
     return dist;
 }
-
-// Method to get the aperture interface
-lensElement* lensSystem::getAperture(void) {
-    int i;
-    for (i = 0; i < numLenses(); i++)
-        if (lenses[i].isStop)
-        {
-            this->stopElement = i;
-            return (&lenses[i]);
-        }
-    return NULL;
-}
-
-// Draw a single lens interface
-void lensElement::Draw(void) 
-{
-    float nextX, nextY, thisX, thisY;
-    thisY = -this->aper / 2.0f;
-    float rs = this->rad / fabs(this->rad);
-    int i;
-
-    float step = this->aper / LVSD;
-    float posx = sqrt(rad*rad - thisY*thisY);
-    thisX = rs * posx - rad + zpos;
-
-    for (i = 1; i <= LVSD; i++) {
-        nextY = thisY + step;
-        posx = sqrt(rad*rad - nextY*nextY);
-        nextX = rs * posx - rad + zpos;
-        drawLine(thisX, thisY, nextX, nextY);
-        thisX = nextX; thisY = nextY;
-    }
-    this->edge[X] = thisX;
-    this->edge[Y] = thisY;
-}
-
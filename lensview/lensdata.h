@@ -3,21 +3,64 @@
 #ifndef _LENSDATA_H_
 #define _LENSDATA_H_
 
-#include "lensSphere.h"
-#include "lensview.h"
+#include "lens.h"
 
 enum mode {thick, precise};
 
+// Furthest the image plane may travel behind F' while refocusing
+#define FOCUS_TRAVEL 70.0f
+
+// A paraxial ray-transfer (ABCD) matrix acting on (height, n * angle)
+class rayTransfer {
+public:
+	rayTransfer(void): A(1), B(0), C(0), D(1) {}
+	rayTransfer(float a, float b, float c, float d): A(a), B(b), C(c), D(d) {}
+	// Compose two transfers; the right-hand matrix is applied first
+	rayTransfer operator*(const rayTransfer &m) const {
+		return rayTransfer(A*m.A + B*m.C, A*m.B + B*m.D,
+		                   C*m.A + D*m.C, C*m.B + D*m.D);
+	}
+	float A, B, C, D;
+};
+
+// A monotone table of object distance to image plane for focus pulls,
+// sampled uniformly in inverse object distance
+class focusTable {
+public:
+	focusTable(void): aper(0) {}
+	bool empty(void) const { return invDist.empty(); }
+	// Interpolate the image plane for an object at zPos; returns false
+	// outside the table or for a different stop aperture
+	bool lookup(float zPos, float _aper, float* iPlane) const;
+	// Write and read the table as text
+	bool Save(const char *file) const;
+	bool Load(const char *file);
+
+	float aper;				// Stop aperture the table was built for
+	vector<float> invDist;	// Increasing inverse object distances
+	vector<float> iPlane;	// Image plane for each entry
+};
+
+// Receives the segments of traced rays for display; lensview draws
+// them with OpenGL, headless users pass no painter at all
+class lensPainter {
+public:
+	virtual ~lensPainter(void) {}
+	// A ray segment in the (z, y) plane
+	virtual void line(float z1, float y1, float z2, float y2) = 0;
+	// A marked point, such as a thick-lens image point
+	virtual void point(float size, float z, float y) = 0;
+};
+
 // A simple class for the camera lens interface elements
 class lensElement {
 public:
     lensElement(void): 
-	    isStop(true), rad(0), zpos(0), ndr(0), aper(0), isActive(false) {
-		    edge[X] = edge[Y] = 0.0f;
-		}
+	    isStop(true), rad(0), zpos(0), ndr(0), aper(0), isActive(false), thickness(0) {
+		this->setAsphere(0.0f, NULL);
+	}
 	lensElement(float _rad, float _xpos, float _ndr, float _aper) {
 		this->Init(_rad, _xpos, _ndr, _aper);
-		edge[X] = edge[Y] = 0.0f;
 	}
    
 	// Method to initialize a lens interface object
@@ -27,32 +70,57 @@ public:
 		rad = _rad; zpos = _xpos; 
 		ndr = _ndr; aper = _aper;
 		this->isActive = true;
+		this->thickness = 0.0f;
 		if (rad == 0.0f && ndr == 0.0f)
 			this->isStop = true;
-
-		this->lensSph = lensSphere(_rad, -_rad, _rad, 360.0f, _aper, Point(0, 0, _xpos));
+		this->setAsphere(0.0f, NULL);
+	}
+	// Set the conic constant and even asphere terms from r^4 upward;
+	// NULL clears the terms
+	void setAsphere(float k, const float *coeffs)
+	{
+		conic = k;
+		for (int j = 0; j < LENS_ASPHERE_TERMS; j++)
+			asphere[j] = coeffs ? coeffs[j] : 0.0f;
+	}
+	bool isAir(void) const { return (ndr == 1.0f)?true:false; }
+	// Gap to the next interface, fixed or per zoom and focus state
+	float gap(const int state[4], const float weight[4], int n) const {
+		return spacing.empty() ? thickness :
+			LensStateTable::Interpolate(spacing, state, weight, n);
 	}
-	// Draw a single lens interfaces
-	void Draw(void);
-	bool isAir(void) { return (ndr == 1.0f)?true:false; }
 
     bool isStop;	// Flag to identify the aperture stop
-	lensSphere lensSph;	// Sphere from which lens element was derived
     float rad;		// Radius for the lens interface
 	float zpos;		// Lens interface position (1D);
 	float ndr;		// Index of refraction
 	float aper;		// Aperture (diameter) of the interface
 	bool isActive;	// Flag to set interface active
-	float edge[2];	// Top edge point of each interface
 	int elemNum;	// Stores position in lens system
+	float conic;	// Conic constant of an aspheric interface
+	float asphere[LENS_ASPHERE_TERMS];	// Even asphere terms
+	float thickness;	// Gap to the next interface
+	vector<float> spacing;	// Per-state gaps, overriding thickness
+};
+
+// Paraxial properties of the lens system in one zoom and focus state,
+// found with the stop wide open
+class lensState {
+public:
+	float f1, f2, f1T, f2T;
+	float p1, p2, p1T, p2T;
+	Point pupil, entPupil;
+	float efl, minFS;
 };
 
-// A simple class for the camera lens systems: lens interfaces
+// A simple class for the camera lens systems: lens interfaces. Once
+// findIntrinsics has run, the const tracing and analysis methods may be
+// called from many threads at once.
 class lensSystem {
 public:
-	lensSystem(void): f1(0), f2(0), p1(0), p2(0), fstop(1) {
+	lensSystem(void): f1(0), f2(0), p1(0), p2(0), efl(0), fstop(1), zoom(0), focusDist(INFINITY) {
 		this->oPlane = INFINITY; this->iPlane = f2; stopElement = 0; stopTrans = 1; this->M = precise;}
-	lensSystem(const char *file): f1(0), f2(0), p1(0), p2(0), fstop(1) {
+	lensSystem(const char *file): f1(0), f2(0), p1(0), p2(0), efl(0), fstop(1), zoom(0), focusDist(INFINITY) {
 		this->oPlane = INFINITY; this->iPlane = f2; stopElement = 0; stopTrans = 1; this->M = precise;
 		this->Load(file); 
 	}
@@ -60,42 +128,78 @@ public:
 	// a vector of lens interfaces. 
 	bool Load(const char *file);
 	// Get the number of lens interfaces
-	int numLenses(void) { return int(lenses.size()); }
-	// Draw the entire lens system (all interfaces)
-	void Draw(void);
-	// Trace a ray through the system
-    bool Trace(Ray &ray, Ray* res);
-	bool TraceF(Ray &ray, Ray* res, bool draw, int startLens = 0);
-	bool TraceB(Ray &ray, Ray* res, bool draw, int endLens = 0);
+	int numLenses(void) const { return int(lenses.size()); }
+	// Trace a ray through the system, handing its path to paint if given
+	bool Trace(const Ray &ray, Ray* res, lensPainter *paint = NULL) const;
+	bool TraceF(const Ray &ray, Ray* res, lensPainter *paint = NULL,
+	            int startLens = 0) const;
+	bool TraceB(const Ray &ray, Ray* res, lensPainter *paint = NULL,
+	            int endLens = 0) const;
 	// Find intrinsic lens properties
 	void findIntrinsics();
+	// Build the thick lens matrices from the cardinal points
+	void buildThickMatrices();
+	// Position the interfaces for a blend of zoom and focus states
+	void placeElements(const int state[4], const float weight[4], int n);
+	// Find the paraxial properties of every zoom and focus state
+	void buildStateCache();
+	// Move to zoom position z with the focus group set for an object at
+	// distance d, interpolating the cached properties of nearby states
+	void setState(float z, float d);
 	// Trace rays to find (focal point)'
 	void findFp();
 	// Trace rays to find focal point
 	void findF();
 	// Trace rays to find (principal axis)
-	void findP(const Ray focalRay, const Ray r2, float* p);
+	void findP(const Ray &focalRay, const Ray &r2, float* p) const;
 	// Refocus the system at a point z
 	void refocus(float zPos, int direction);
+	// Trace a fan of rays from an object at zPos to find its image plane
+	bool findImagePlane(float zPos, float* plane) const;
+	// Closest object distance reachable within FOCUS_TRAVEL
+	float nearFocus(void) const;
+	// Tabulate image planes from infinity down to zNear for refocus
+	bool buildFocusTable(float zNear, int n);
+	// Area in the rear element's plane through which rays from film
+	// height h on the image plane leave the front, from an n x n grid
+	float transmission(float h, int n) const;
+	// Percent distortion of the chief ray from film height h
+	bool distortion(float h, float* percent) const;
 	// Find the minimum fstop
 	void findMinFStop();
 	// Find exit pupil
 	void findExitPupil();
+	// Find entrance pupil
+	void findEntrancePupil();
+	// Paraxial transfer matrix between the vertices of two interfaces
+	rayTransfer paraxialMatrix(int first, int last) const;
+	// Paraxial focal points and principal planes of a sub-system
+	bool paraxialCardinal(int first, int last, float* f, float* fp,
+	                      float* p, float* pp) const;
+	// Index of refraction of the medium behind an interface
+	float mediumAfter(int i) const;
 	// Recalculates aperture
 	void recalAper();
+	// Rebuild the flattened prescription used for ray tracing
+	void compile();
 	// Calculates thick lens transformation
-	void thickLens(Point &e, Point* et, Reference<Matrix4x4> transform);
+	void thickLens(const Point &e, Point* et,
+	               const Reference<Matrix4x4> &transform) const;
 	// Get the maximum aperture in the lens system
-	float maxAperture(void);
+	float maxAperture(void) const;
 	// Get the minimum aperture in the lens system
-	float minAperture(void);
+	float minAperture(void) const;
 	// Get the aperture interface
-	lensElement *getAperture(void);
+	lensElement *getAperture(void) { return &lenses[stopElement]; }
+	const lensElement *getAperture(void) const { return &lenses[stopElement]; }
 
     vector<lensElement> lenses; // Vector of lens elements
+	LensPrescription prescription; // Flattened copy of lenses for tracing
 	float f1, f2, f1T, f2T;     // Focal points for the lens
 	float p1, p2, p1T, p2T;     // Locations of principle planes
 	Point pupil;			    // Exit pupil for the lens system
+	Point entPupil;			    // Entrance pupil for the lens system
+	float efl;				    // Paraxial effective focal length
 	
 	float fstop;		        // Current fstop for the camera
 	float maxFS;                // Maximum fstop for the camera
@@ -103,11 +207,15 @@ public:
 
 	float iPlane;				// Image plane
 	float oPlane;				// Object focal plane
+	focusTable focus;			// Precomputed focus-pull table
 
-	int curLens;				// Dummy to test lens intersection
-	int stopElement;
+	int stopElement;			// Index of the aperture stop, found by Load
 	int stopTrans;				// Controls whether the object can move closer to the lens system
 	float thetaMax;
+	LensStateTable states;		// Zoom and focus states from the lens file
+	vector<lensState> stateCache; // Paraxial properties per state
+	float stopAper;				// Stop diameter given in the lens file
+	float zoom, focusDist;		// Current zoom position and focus distance
 	Reference<Matrix4x4> thick;
 	Reference<Matrix4x4> backThick;
 	mode M;
@@ -0,0 +1,126 @@
+// Lens-accurate depth of field as a post process: lensdof builds a bokeh
+// kernel bank from a lens prescription and scatters a pinhole render
+// through it using the depth AOV written by ImageFilm's depthfilename.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "lensbokeh.h"
+#include "color.h"
+
+using namespace std;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lensdof [options] lens.dat pinhole.exr depth.exr out.exr\n"
+		"  -fov deg      fov of the perspective camera that rendered the\n"
+		"                image, across its shorter axis (required)\n"
+		"  -focus d      distance in focus, in scene units (required)\n"
+		"  -units mm     millimetres per scene unit (1)\n"
+		"  -fstop f      stop the lens down from wide open\n"
+		"  -depths n     kernel rows in inverse distance (16)\n"
+		"  -fields n     kernel columns in image radius (16)\n"
+		"  -rays n       rays traced per kernel (32768)\n"
+		"  -kernel n     largest kernel in pixels (64)\n"
+		"  -threads n    worker threads (default: one per core)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	float fov = 0.0f, focus = 0.0f, units = 1.0f, fstop = 0.0f;
+	int nDepths = 16, nFields = 16, maxKernel = 64;
+	psfSettings settings;
+	settings.nRays = 32768;
+	settings.nThreads = lensNumCores();
+	const char *names[4];
+	int nNames = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "-fov") && more) fov = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-focus") && more) focus = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-units") && more) units = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-fstop") && more) fstop = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-depths") && more) nDepths = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-fields") && more) nFields = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-rays") && more) settings.nRays = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-kernel") && more) maxKernel = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-threads") && more) settings.nThreads = max(1, atoi(argv[++i]));
+		else if (argv[i][0] == '-' || nNames == 4) usage();
+		else names[nNames++] = argv[i];
+	}
+	if (nNames != 4 || fov <= 0.0f || focus <= 0.0f || units <= 0.0f)
+		usage();
+
+	// Focus the lens, stopped down if asked
+	lensSystem lsys;
+	if (!lsys.Load(names[0])) {
+		fprintf(stderr, "lensdof: cannot load %s\n", names[0]);
+		return 1;
+	}
+	lsys.findIntrinsics();
+	if (fstop > 0.0f) {
+		lsys.fstop = max(fstop, lsys.minFS);
+		lsys.recalAper();
+		lsys.findEntrancePupil();
+	}
+	float plane;
+	if (!lsys.findImagePlane(focus * units + lsys.entPupil.z, &plane)) {
+		fprintf(stderr, "lensdof: cannot focus at %g\n", focus);
+		return 1;
+	}
+	lsys.iPlane = plane;
+
+	// Read the pinhole render and its ray distances
+	int xRes, yRes, dxRes, dyRes;
+	Spectrum *image = ReadImage(names[1], &xRes, &yRes);
+	float *depth = ReadDepthImage(names[2], &dxRes, &dyRes);
+	if (!image || !depth)
+		return 1;
+	if (dxRes != xRes || dyRes != yRes) {
+		fprintf(stderr, "lensdof: %s is %dx%d but %s is %dx%d\n", names[1],
+			xRes, yRes, names[2], dxRes, dyRes);
+		return 1;
+	}
+	int nPix = xRes * yRes;
+	float *rgb = new float[3 * nPix], *out = new float[3 * nPix];
+	for (int i = 0; i < nPix; i++) {
+		float xyz[3];
+		image[i].XYZ(xyz);
+		rgb[3*i  ] =  3.240479f*xyz[0] - 1.537150f*xyz[1] - 0.498535f*xyz[2];
+		rgb[3*i+1] = -0.969256f*xyz[0] + 1.875991f*xyz[1] + 0.041556f*xyz[2];
+		rgb[3*i+2] =  0.055648f*xyz[0] - 0.204043f*xyz[1] + 1.057311f*xyz[2];
+	}
+	delete[] image;
+
+	// The pinhole image maps to a sensor with the lens's focal length;
+	// turn ray distances into axial distances in millimetres
+	float pixel = lsys.efl * tanf(Radians(0.5f * fov)) / (0.5f * min(xRes, yRes));
+	float zNear = INFINITY;
+	for (int y = 0; y < yRes; y++)
+		for (int x = 0; x < xRes; x++) {
+			float px = x + 0.5f - 0.5f * xRes, py = y + 0.5f - 0.5f * yRes;
+			float tanTheta = sqrtf(px*px + py*py) * pixel / lsys.efl;
+			float &z = depth[y * xRes + x];
+			z *= units / sqrtf(1.0f + tanTheta * tanTheta);
+			if (z > 0.0f) zNear = min(zNear, z);
+		}
+	if (zNear == INFINITY) zNear = focus * units;
+
+	bokehBank bank;
+	float maxRadius = pixel * 0.5f * sqrtf(float(xRes * xRes + yRes * yRes));
+	if (!bank.build(lsys, zNear, maxRadius, pixel, nDepths, nFields,
+			maxKernel, settings)) {
+		fprintf(stderr, "lensdof: cannot build kernels for %s\n", names[0]);
+		return 1;
+	}
+	bank.apply(rgb, depth, xRes, yRes, out, settings.nThreads);
+	WriteRGBAImage(names[3], out, NULL, xRes, yRes, xRes, yRes, 0, 0);
+	delete[] rgb;
+	delete[] out;
+	delete[] depth;
+	return 0;
+}
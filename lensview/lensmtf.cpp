@@ -0,0 +1,165 @@
+// Image quality of one lens prescription without a display: lensmtf
+// traces a PSF at each field point with the lensquality engine and
+// writes spot sizes and MTF values as CSV.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "lensquality.h"
+
+using namespace std;
+
+// Parse a comma separated list of numbers
+static vector<float> parseList(const char *s)
+{
+	vector<float> v;
+	while (*s) {
+		char *end;
+		float f = float(strtod(s, &end));
+		if (end == s) break;
+		v.push_back(f);
+		s = (*end == ',') ? end + 1 : end;
+	}
+	return v;
+}
+
+// Write the PSF as an 8-bit PGM scaled to its peak
+static bool writePGM(const char *file, const lensPSF &psf)
+{
+	FILE *f = fopen(file, "wb");
+	if (!f) return false;
+	fprintf(f, "P5\n%d %d\n255\n", psf.bins, psf.bins);
+	float peak = *max_element(psf.data.begin(), psf.data.end());
+	// Rows top to bottom, so +y is up
+	for (int y = psf.bins - 1; y >= 0; y--)
+		for (int x = 0; x < psf.bins; x++) {
+			float v = peak > 0.0f ? psf.data[y * psf.bins + x] / peak : 0.0f;
+			fputc(int(255.0f * v + 0.5f), f);
+		}
+	fclose(f);
+	return true;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lensmtf [options] lens.dat\n"
+		"  -fields a,b,..  field angles in degrees (default: -nfields heights\n"
+		"                  out to -radius on the image plane)\n"
+		"  -nfields n      number of default field points (5)\n"
+		"  -radius mm      image circle radius for default fields (21.65)\n"
+		"  -object z       object plane distance in front of the lens (infinity)\n"
+		"  -rays n         rays traced per field point (1048576)\n"
+		"  -bins n         PSF histogram size (256)\n"
+		"  -pixel mm       PSF pixel size (default: from the spot size)\n"
+		"  -freqs a,b,..   MTF columns in lp/mm (10,20,40)\n"
+		"  -threads n      worker threads (default: one per core)\n"
+		"  -curves file    write full MTF curves as CSV\n"
+		"  -spots file     write spot diagram hits as CSV\n"
+		"  -psf prefix     write each PSF to prefix<field index>.pgm\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	psfSettings settings;
+	settings.nThreads = lensNumCores();
+	vector<float> fields, freqs = parseList("10,20,40");
+	int nFields = 5;
+	float radius = LENS_FIELD_RADIUS;
+	const char *lensFile = NULL, *curvesFile = NULL, *spotsFile = NULL;
+	const char *psfPrefix = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "-fields") && more) fields = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "-nfields") && more) nFields = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-radius") && more) radius = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-object") && more) settings.objectZ = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-rays") && more) settings.nRays = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-bins") && more) settings.bins = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-pixel") && more) settings.pixel = float(atof(argv[++i]));
+		else if (!strcmp(argv[i], "-freqs") && more) freqs = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "-threads") && more) settings.nThreads = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-curves") && more) curvesFile = argv[++i];
+		else if (!strcmp(argv[i], "-spots") && more) spotsFile = argv[++i];
+		else if (!strcmp(argv[i], "-psf") && more) psfPrefix = argv[++i];
+		else if (argv[i][0] == '-' || lensFile) usage();
+		else lensFile = argv[i];
+	}
+	if (!lensFile) usage();
+
+	lensSystem lsys;
+	if (!lsys.Load(lensFile)) {
+		fprintf(stderr, "lensmtf: cannot load %s\n", lensFile);
+		return 1;
+	}
+	lsys.findIntrinsics();
+	if (settings.objectZ != INFINITY) {
+		float plane;
+		if (!lsys.findImagePlane(settings.objectZ, &plane)) {
+			fprintf(stderr, "lensmtf: cannot focus on an object at %g\n",
+				settings.objectZ);
+			return 1;
+		}
+		lsys.iPlane = plane;
+	}
+	// Default fields image heights evenly out to the image circle
+	if (fields.empty())
+		for (int k = 0; k < nFields; k++) {
+			float h = nFields > 1 ? radius * k / (nFields - 1) : 0.0f;
+			fields.push_back(Degrees(atanf(h / lsys.efl)));
+		}
+	if (spotsFile) settings.maxSpots = 10000;
+
+	FILE *curves = curvesFile ? fopen(curvesFile, "w") : NULL;
+	FILE *spots = spotsFile ? fopen(spotsFile, "w") : NULL;
+	if ((curvesFile && !curves) || (spotsFile && !spots)) {
+		fprintf(stderr, "lensmtf: cannot write %s\n",
+			(curvesFile && !curves) ? curvesFile : spotsFile);
+		return 1;
+	}
+	if (curves) fprintf(curves, "field_deg,freq_lpmm,sagittal,tangential\n");
+	if (spots) fprintf(spots, "field_deg,x,y\n");
+	printf("field_deg,centroid_y,rms_radius,geo_radius,pupil_area");
+	for (size_t k = 0; k < freqs.size(); k++)
+		printf(",mtf_s_%g,mtf_t_%g", freqs[k], freqs[k]);
+	printf("\n");
+
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		lensPSF psf;
+		lensMTF mtf;
+		if (!computePSF(lsys, fields[i], settings, &psf)) {
+			fprintf(stderr, "lensmtf: no rays reach the image at %g degrees\n",
+				fields[i]);
+			continue;
+		}
+		computeMTF(psf, &mtf);
+		printf("%g,%g,%g,%g,%g", psf.field, psf.centroidY, psf.rmsRadius,
+			psf.geoRadius, psf.pupilArea);
+		for (size_t k = 0; k < freqs.size(); k++)
+			printf(",%g,%g", mtf.at(freqs[k], false), mtf.at(freqs[k], true));
+		printf("\n");
+		if (curves)
+			for (size_t k = 0; k < mtf.freq.size(); k++)
+				fprintf(curves, "%g,%g,%g,%g\n", psf.field, mtf.freq[k],
+					mtf.sagittal[k], mtf.tangential[k]);
+		if (spots)
+			for (size_t k = 0; k < psf.spots.size(); k++)
+				fprintf(spots, "%g,%g,%g\n", psf.field, psf.spots[k].x,
+					psf.spots[k].y);
+		if (psfPrefix) {
+			char index[16];
+			sprintf(index, "%d", int(i));
+			string name = string(psfPrefix) + index + ".pgm";
+			if (!writePGM(name.c_str(), psf))
+				fprintf(stderr, "lensmtf: cannot write %s\n", name.c_str());
+		}
+	}
+	if (curves) fclose(curves);
+	if (spots) fclose(spots);
+	return 0;
+}
@@ -0,0 +1,502 @@
+// Geometric image-quality analysis of lens systems: spot diagrams,
+// point spread functions and MTFs from rays traced through TraceF
+#include "lensquality.h"
+
+#include <math.h>
+#include <algorithm>
+using namespace std;
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Tasks handed out to lensParallelFor's workers one at a time
+struct parallelJob {
+    int nTasks, next;
+    void (*func)(int, void *);
+    void *arg;
+#ifdef WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static int takeTask(parallelJob *job)
+{
+#ifdef WIN32
+    EnterCriticalSection(&job->lock);
+#else
+    pthread_mutex_lock(&job->lock);
+#endif
+    int task = (job->next < job->nTasks) ? job->next++ : -1;
+#ifdef WIN32
+    LeaveCriticalSection(&job->lock);
+#else
+    pthread_mutex_unlock(&job->lock);
+#endif
+    return task;
+}
+
+#ifdef WIN32
+static DWORD WINAPI parallelWorker(LPVOID arg)
+#else
+static void *parallelWorker(void *arg)
+#endif
+{
+    parallelJob *job = (parallelJob *)arg;
+    int task;
+    while ((task = takeTask(job)) != -1)
+        job->func(task, job->arg);
+    return 0;
+}
+
+int lensNumCores(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return int(info.dwNumberOfProcessors);
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? int(n) : 1;
+#endif
+}
+
+void lensParallelFor(int nTasks, int nThreads,
+                     void (*func)(int task, void *arg), void *arg)
+{
+    nThreads = min(nThreads, nTasks);
+    if (nThreads <= 1)
+    {
+        for (int i = 0; i < nTasks; i++)
+            func(i, arg);
+        return;
+    }
+    parallelJob job;
+    job.nTasks = nTasks;
+    job.next = 0;
+    job.func = func;
+    job.arg = arg;
+#ifdef WIN32
+    InitializeCriticalSection(&job.lock);
+    vector<HANDLE> threads(nThreads);
+    for (int i = 0; i < nThreads; i++)
+        threads[i] = CreateThread(NULL, 0, parallelWorker, &job, 0, NULL);
+    WaitForMultipleObjects(nThreads, &threads[0], TRUE, INFINITE);
+    for (int i = 0; i < nThreads; i++)
+        CloseHandle(threads[i]);
+    DeleteCriticalSection(&job.lock);
+#else
+    pthread_mutex_init(&job.lock, NULL);
+    vector<pthread_t> threads(nThreads);
+    for (int i = 0; i < nThreads; i++)
+        pthread_create(&threads[i], NULL, parallelWorker, &job);
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+#endif
+}
+
+static bool hasDatSuffix(const string &name)
+{
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".dat") == 0;
+}
+
+bool lensListFiles(const char *path, vector<string> *files)
+{
+    vector<string> found;
+#ifdef WIN32
+    WIN32_FIND_DATA fd;
+    string pattern = string(path) + "\\*.dat";
+    DWORD attr = GetFileAttributes(path);
+    if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        files->push_back(path);
+        return true;
+    }
+    HANDLE h = FindFirstFile(pattern.c_str(), &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            found.push_back(string(path) + "\\" + fd.cFileName);
+        } while (FindNextFile(h, &fd));
+        FindClose(h);
+    }
+#else
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        files->push_back(path);
+        return true;
+    }
+    DIR *dir = opendir(path);
+    if (!dir)
+        return false;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL)
+        if (hasDatSuffix(e->d_name))
+            found.push_back(string(path) + "/" + e->d_name);
+    closedir(dir);
+#endif
+    sort(found.begin(), found.end());
+    files->insert(files->end(), found.begin(), found.end());
+    return true;
+}
+
+void lensWriteJSONString(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void lensWriteCSVString(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// One row of the pupil grid per task; each row seeds its own jitter so
+// the result does not depend on the thread count
+struct psfTrace {
+    const lensSystem *lsys;
+    bool distant;           // Collimated rays along dir, else from source
+    Vector dir;
+    Point source;
+    float zStart;           // Plane in front of the first element
+    float pupilZ;           // Plane of aim points through the entrance pupil
+    float x0, y0, dx, dy;   // Corner and cell size of the aim grid
+    int n;                  // Grid is n x n cells
+    vector< vector<float> > hits;   // Image-plane x, y pairs per row
+};
+
+// Trace the ray from the field point through aim point (x, y) on the
+// entrance pupil plane to the image plane
+static Ray aimRay(const psfTrace *job, float x, float y)
+{
+    Point aim(x, y, job->pupilZ);
+    if (job->distant)
+        return Ray(aim + job->dir * ((job->zStart - aim.z) / job->dir.z), job->dir);
+    return Ray(job->source, Normalize(aim - job->source));
+}
+
+static bool traceAim(const psfTrace *job, float x, float y, Point *pImage)
+{
+    Ray res;
+    if (!job->lsys->TraceF(aimRay(job, x, y), &res) || res.d.z >= 0.0f)
+        return false;
+    *pImage = res((job->lsys->iPlane - res.o.z) / res.d.z);
+    return true;
+}
+
+// Trace LENS_PACKET_SIZE aim points together as traceAim does, returning
+// the mask of rays that reach the image plane
+static int traceAimPacket(const psfTrace *job, const float *x, const float *y,
+                          Point *pImage)
+{
+    LensRayPacket packet, res;
+    for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+    {
+        Ray ray = aimRay(job, x[lane], y[lane]);
+        packet.ox[lane] = ray.o.x; packet.oy[lane] = ray.o.y;
+        packet.oz[lane] = ray.o.z; packet.dx[lane] = ray.d.x;
+        packet.dy[lane] = ray.d.y; packet.dz[lane] = ray.d.z;
+    }
+    int mask = job->lsys->prescription.TracePacketFromScene(packet, &res,
+        (1 << LENS_PACKET_SIZE) - 1);
+    for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+    {
+        if (!(mask & (1 << lane)))
+            continue;
+        if (res.dz[lane] >= 0.0f)
+        {
+            mask &= ~(1 << lane);
+            continue;
+        }
+        float t = (job->lsys->iPlane - res.oz[lane]) / res.dz[lane];
+        pImage[lane] = Point(res.ox[lane] + t * res.dx[lane],
+                             res.oy[lane] + t * res.dy[lane],
+                             res.oz[lane] + t * res.dz[lane]);
+    }
+    return mask;
+}
+
+static inline float jitter(unsigned int *state)
+{
+    // xorshift32
+    unsigned int x = *state;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    *state = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static void tracePSFRow(int j, void *arg)
+{
+    psfTrace *job = (psfTrace *)arg;
+    unsigned int state = 2654435761u * unsigned(j + 1);
+    vector<float> &row = job->hits[j];
+    // Trace the row in packets, and any rays left over one at a time
+    int i = 0;
+    for (; i + LENS_PACKET_SIZE <= job->n; i += LENS_PACKET_SIZE)
+    {
+        float x[LENS_PACKET_SIZE], y[LENS_PACKET_SIZE];
+        for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+        {
+            x[lane] = job->x0 + (i + lane + jitter(&state)) * job->dx;
+            y[lane] = job->y0 + (j + jitter(&state)) * job->dy;
+        }
+        Point pImage[LENS_PACKET_SIZE];
+        int mask = traceAimPacket(job, x, y, pImage);
+        for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+            if (mask & (1 << lane))
+            {
+                row.push_back(pImage[lane].x);
+                row.push_back(pImage[lane].y);
+            }
+    }
+    for (; i < job->n; i++)
+    {
+        float x = job->x0 + (i + jitter(&state)) * job->dx;
+        float y = job->y0 + (j + jitter(&state)) * job->dy;
+        Point pImage;
+        if (!traceAim(job, x, y, &pImage))
+            continue;
+        row.push_back(pImage.x);
+        row.push_back(pImage.y);
+    }
+}
+
+// Trace a pupil-filling grid of rays from a field point at fieldDeg
+// degrees above the axis and bin their hits on lsys.iPlane
+bool computePSF(const lensSystem &lsys, float fieldDeg,
+                const psfSettings &settings, lensPSF *psf)
+{
+    if (lsys.numLenses() == 0)
+        return false;
+    psfTrace job;
+    job.lsys = &lsys;
+    float theta = Radians(fieldDeg);
+    job.zStart = lsys.lenses[0].zpos + 1.0f;
+    job.distant = (settings.objectZ == INFINITY);
+    if (job.distant)
+        job.dir = Vector(0, -sinf(theta), -cosf(theta));
+    else
+    {
+        if (settings.objectZ <= job.zStart)
+            return false;
+        float z = settings.objectZ;
+        job.source = Point(0, (z - lsys.entPupil.z) * tanf(theta), z);
+    }
+    // Bound the aim points that pass with a coarse grid across 1.5
+    // times the front element, which covers off-axis beams whose pupils
+    // shift and stretch, then spend the rays on that bound alone
+    job.pupilZ = lsys.entPupil.z;
+    float r = 0.75f * max(lsys.lenses[0].aper, lsys.entPupil.y);
+    const int nCoarse = 64;
+    float cell = 2.0f * r / nCoarse;
+    float xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY;
+    for (int j = 0; j < nCoarse; j++)
+        for (int i = 0; i < nCoarse; i += LENS_PACKET_SIZE)
+        {
+            float x[LENS_PACKET_SIZE], y[LENS_PACKET_SIZE];
+            for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+            {
+                x[lane] = -r + (i + lane + 0.5f) * cell;
+                y[lane] = -r + (j + 0.5f) * cell;
+            }
+            Point pImage[LENS_PACKET_SIZE];
+            int mask = traceAimPacket(&job, x, y, pImage);
+            for (int lane = 0; lane < LENS_PACKET_SIZE; lane++)
+                if (mask & (1 << lane))
+                {
+                    xMin = min(xMin, x[lane]); xMax = max(xMax, x[lane]);
+                    yMin = min(yMin, y[lane]); yMax = max(yMax, y[lane]);
+                }
+        }
+    psf->field = fieldDeg;
+    psf->pupilArea = 0;
+    psf->data.clear();
+    psf->spots.clear();
+    if (xMin > xMax)
+        return false;
+    job.n = max(1, int(ceilf(sqrtf(float(settings.nRays)))));
+    job.x0 = xMin - cell;
+    job.y0 = yMin - cell;
+    job.dx = (xMax - xMin + 2.0f * cell) / job.n;
+    job.dy = (yMax - yMin + 2.0f * cell) / job.n;
+    job.hits.resize(job.n);
+    lensParallelFor(job.n, settings.nThreads, tracePSFRow, &job);
+
+    // Spot statistics about the centroid
+    size_t nHits = 0;
+    double sx = 0, sy = 0;
+    for (int j = 0; j < job.n; j++)
+    {
+        const vector<float> &row = job.hits[j];
+        nHits += row.size() / 2;
+        for (size_t k = 0; k < row.size(); k += 2)
+        {
+            sx += row[k];
+            sy += row[k+1];
+        }
+    }
+    psf->pupilArea = float(nHits) / (job.n * job.n) *
+        (job.n * job.dx) * (job.n * job.dy);
+    if (nHits == 0)
+        return false;
+    float cx = float(sx / nHits), cy = float(sy / nHits);
+    double sr2 = 0, maxR2 = 0;
+    for (int j = 0; j < job.n; j++)
+    {
+        const vector<float> &row = job.hits[j];
+        for (size_t k = 0; k < row.size(); k += 2)
+        {
+            double dx = row[k] - cx, dy = row[k+1] - cy;
+            sr2 += dx*dx + dy*dy;
+            maxR2 = max(maxR2, dx*dx + dy*dy);
+        }
+    }
+    psf->centroidX = cx;
+    psf->centroidY = cy;
+    psf->rmsRadius = float(sqrt(sr2 / nHits));
+    psf->geoRadius = float(sqrt(maxR2));
+
+    // Bin the hits into a histogram with the centroid in the middle of
+    // pixel bins / 2, spanning eight RMS radii unless the caller fixed
+    // the pixel size
+    psf->bins = int(RoundUpPow2(u_int(max(2, settings.bins))));
+    psf->pixel = settings.pixel > 0.0f ? settings.pixel :
+        max(8.0f * psf->rmsRadius / psf->bins, 1e-5f);
+    int bins = psf->bins;
+    psf->data.assign(bins * bins, 0.0f);
+    float invPixel = 1.0f / psf->pixel;
+    size_t spotStride = settings.maxSpots > 0 ?
+        max(size_t(1), nHits / settings.maxSpots) : 0;
+    size_t index = 0, binned = 0;
+    for (int j = 0; j < job.n; j++)
+    {
+        const vector<float> &row = job.hits[j];
+        for (size_t k = 0; k < row.size(); k += 2, index++)
+        {
+            if (spotStride && index % spotStride == 0 &&
+                int(psf->spots.size()) < settings.maxSpots)
+                psf->spots.push_back(Point(row[k], row[k+1], lsys.iPlane));
+            int ix = Floor2Int((row[k] - cx) * invPixel + 0.5f) + bins / 2;
+            int iy = Floor2Int((row[k+1] - cy) * invPixel + 0.5f) + bins / 2;
+            if (ix < 0 || iy < 0 || ix >= bins || iy >= bins)
+                continue;
+            psf->data[iy * bins + ix] += 1.0f;
+            binned++;
+        }
+    }
+    if (binned > 0)
+        for (int i = 0; i < bins * bins; i++)
+            psf->data[i] /= binned;
+    return true;
+}
+
+// In-place radix-2 FFT of n complex values; n must be a power of two
+static void fft(vector<float> &re, vector<float> &im)
+{
+    int n = int(re.size());
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+        {
+            swap(re[i], re[j]);
+            swap(im[i], im[j]);
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        double a = -2.0 * M_PI / len;
+        float wr = float(cos(a)), wi = float(sin(a));
+        for (int i = 0; i < n; i += len)
+        {
+            float cr = 1.0f, ci = 0.0f;
+            for (int k = 0; k < len / 2; k++)
+            {
+                int p = i + k, q = p + len / 2;
+                float tr = re[q] * cr - im[q] * ci;
+                float ti = re[q] * ci + im[q] * cr;
+                re[q] = re[p] - tr; im[q] = im[p] - ti;
+                re[p] += tr; im[p] += ti;
+                float t = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = t;
+            }
+        }
+    }
+}
+
+// Modulus of the line spread function's spectrum, normalised at DC
+static void lineMTF(vector<float> &lsf, vector<float> *mtf)
+{
+    vector<float> im(lsf.size(), 0.0f);
+    fft(lsf, im);
+    int half = int(lsf.size()) / 2;
+    float dc = fabsf(lsf[0]);
+    mtf->resize(half + 1);
+    for (int k = 0; k <= half; k++)
+        (*mtf)[k] = dc > 0.0f ?
+            sqrtf(lsf[k] * lsf[k] + im[k] * im[k]) / dc : 0.0f;
+}
+
+// Fourier transform the PSF's line spread functions. By the projection
+// slice theorem these are the axes of the PSF's 2D spectrum: the field
+// lies along y, so the tangential LSF sums each row over x.
+void computeMTF(const lensPSF &psf, lensMTF *mtf)
+{
+    int bins = psf.bins;
+    mtf->freq.clear();
+    mtf->sagittal.clear();
+    mtf->tangential.clear();
+    if (bins == 0 || psf.data.empty())
+        return;
+    vector<float> lsfX(bins, 0.0f), lsfY(bins, 0.0f);
+    for (int y = 0; y < bins; y++)
+        for (int x = 0; x < bins; x++)
+        {
+            float v = psf.data[y * bins + x];
+            lsfX[x] += v;
+            lsfY[y] += v;
+        }
+    lineMTF(lsfX, &mtf->sagittal);
+    lineMTF(lsfY, &mtf->tangential);
+    mtf->freq.resize(bins / 2 + 1);
+    for (int k = 0; k <= bins / 2; k++)
+        mtf->freq[k] = k / (bins * psf.pixel);
+}
+
+// Interpolate the MTF at spatial frequency f (lp/mm)
+float lensMTF::at(float f, bool tan) const
+{
+    const vector<float> &m = tan ? this->tangential : this->sagittal;
+    if (m.empty() || f < 0.0f)
+        return 0.0f;
+    float step = this->freq.size() > 1 ? this->freq[1] : 0.0f;
+    if (step <= 0.0f)
+        return m[0];
+    float u = f / step;
+    int k = Floor2Int(u);
+    if (k >= int(m.size()) - 1)
+        return 0.0f;
+    u -= k;
+    return (1.0f - u) * m[k] + u * m[k+1];
+}
@@ -0,0 +1,70 @@
+// Geometric image-quality analysis of lens systems: spot diagrams,
+// point spread functions and MTFs from rays traced through TraceF
+#ifndef _LENSQUALITY_H_
+#define _LENSQUALITY_H_
+
+#include "lensdata.h"
+
+// Number of processors available to lensParallelFor
+int lensNumCores(void);
+// Run func(task, arg) for every task in [0, nTasks) on nThreads threads
+void lensParallelFor(int nTasks, int nThreads,
+                     void (*func)(int task, void *arg), void *arg);
+// Append the .dat files in a directory, sorted, or the path itself if it
+// is not a directory; false if the directory cannot be read
+bool lensListFiles(const char *path, vector<string> *files);
+// Write s as a quoted JSON string, escaping quotes and backslashes
+void lensWriteJSONString(FILE *out, const char *s);
+// Write s as a quoted CSV field, doubling embedded quotes
+void lensWriteCSVString(FILE *out, const char *s);
+
+// Default image circle radius (mm), half the 35mm frame diagonal
+#define LENS_FIELD_RADIUS 21.65f
+
+// Ray and histogram settings for computePSF
+class psfSettings {
+public:
+	psfSettings(void): objectZ(INFINITY), nRays(1 << 20), bins(256),
+		pixel(0), nThreads(1), maxSpots(0) {}
+	float objectZ;	// Object plane, INFINITY for a distant object
+	int nRays;		// Rays launched across the entrance pupil
+	int bins;		// Histogram size, rounded up to a power of two
+	float pixel;	// Histogram pixel (mm); 0 picks one from the spot size
+	int nThreads;	// Worker threads tracing rays
+	int maxSpots;	// Image-plane hits kept for a spot diagram
+};
+
+// A geometric PSF on the image plane, centred on the spot centroid
+class lensPSF {
+public:
+	lensPSF(void): field(0), centroidX(0), centroidY(0), rmsRadius(0),
+		geoRadius(0), pupilArea(0), bins(0), pixel(0) {}
+	float field;					// Field angle (degrees)
+	float centroidX, centroidY;		// Spot centroid on the image plane
+	float rmsRadius, geoRadius;		// RMS and largest distance from it
+	float pupilArea;				// Area of aim points imaged (mm^2)
+	int bins;						// Histogram is bins x bins pixels
+	float pixel;					// Pixel size (mm)
+	vector<float> data;				// Rows from -y to +y, summing to 1
+	vector<Point> spots;			// Sampled hits for a spot diagram
+};
+
+// Sagittal and tangential MTF from the line spread functions of a PSF
+class lensMTF {
+public:
+	// Interpolate the MTF at spatial frequency f (lp/mm)
+	float at(float f, bool tangential) const;
+
+	vector<float> freq;			// Spatial frequencies (lp/mm)
+	vector<float> sagittal;		// Response across the field direction
+	vector<float> tangential;	// Response along the field direction
+};
+
+// Trace a pupil-filling grid of rays from a field point at fieldDeg
+// degrees above the axis and bin their hits on lsys.iPlane
+bool computePSF(const lensSystem &lsys, float fieldDeg,
+                const psfSettings &settings, lensPSF *psf);
+// Fourier transform the PSF's line spread functions
+void computeMTF(const lensPSF &psf, lensMTF *mtf);
+
+#endif
@@ -17,6 +17,90 @@ static int lastx = 0, lasty = 0;
 
 float scale = 1;
 
+// Paints rays traced through the lens system with OpenGL
+class glPainter : public lensPainter {
+public:
+	void line(float z1, float y1, float z2, float y2) {
+		drawLine(z1, y1, z2, y2);
+	}
+	void point(float size, float z, float y) {
+		drawPoint(size, z, y);
+	}
+};
+static glPainter painter;
+
+// Axial position of interface i at height y, from its sag
+static float surfaceZ(const lensSystem &ls, int i, float y)
+{
+	float s, ds;
+	if (!ls.prescription.Sag(i, y * y, &s, &ds))
+		s = ls.lenses[i].rad;
+	return ls.lenses[i].zpos - s;
+}
+
+// Draw a single lens interface and return its top edge point
+static void drawElement(const lensSystem &ls, int elem, float edge[2])
+{
+	const lensElement &lens = ls.lenses[elem];
+	float nextX, nextY, thisX, thisY;
+	thisY = -lens.aper / 2.0f;
+
+	float step = lens.aper / LVSD;
+	thisX = surfaceZ(ls, elem, thisY);
+
+	for (int i = 1; i <= LVSD; i++) {
+		nextY = thisY + step;
+		nextX = surfaceZ(ls, elem, nextY);
+		drawLine(thisX, thisY, nextX, nextY);
+		thisX = nextX; thisY = nextY;
+	}
+	edge[X] = thisX;
+	edge[Y] = thisY;
+}
+
+// Draw the entire lens system (all interfaces and aperture)
+static void drawSystem(const lensSystem &ls)
+{
+	glColor3f(0.75f, 0.75f, 0.75f); glLineWidth(1);
+	int n = ls.numLenses();
+	vector<float> edges(2 * n, 0.0f);
+
+	for (int i = 0; i < n; i++)
+		if (ls.lenses[i].isActive && !ls.lenses[i].isStop)
+			drawElement(ls, i, &edges[2 * i]);
+
+	for (int i = 0; i < n - 1; i++) {
+		const lensElement &Li = ls.lenses[i], &Ln = ls.lenses[i + 1];
+		if ((Ln.isStop || Li.isStop) || Li.isAir() || !Li.isActive)
+			continue;
+
+		const float *lip = &edges[2 * i], *lnp = &edges[2 * (i + 1)];
+
+		if (Li.aper < Ln.aper) {
+			drawLine(lip[X],  lip[Y], lip[X],  lnp[Y]);
+			drawLine(lnp[X],  lnp[Y], lip[X],  lnp[Y]);
+			drawLine(lip[X], -lip[Y], lip[X], -lnp[Y]);
+			drawLine(lnp[X], -lnp[Y], lip[X], -lnp[Y]);
+		} else {
+			drawLine(lip[X],  lip[Y], lnp[X],  lip[Y]);
+			drawLine(lnp[X],  lnp[Y], lnp[X],  lip[Y]);
+			drawLine(lip[X], -lip[Y], lnp[X], -lip[Y]);
+			drawLine(lnp[X], -lnp[Y], lnp[X], -lip[Y]);
+		}
+	}
+
+	// Draw the aperture stop interface
+	const lensElement *stop = ls.getAperture();
+	float maxp = ls.maxAperture();
+	float haxp = stop->aper / 2.0f;
+	float taxp = haxp + maxp / 2.0f;
+	glColor3f(1, 1, 1);
+	glLineWidth(2);
+	drawLine(stop->zpos, haxp, stop->zpos, taxp);
+	drawLine(stop->zpos, -haxp, stop->zpos, -taxp);
+	glLineWidth(1);
+}
+
 // Printf style formatting for rendering text in OpenGL
 static void lvText(int x, int y, void *font, int height, 
 				   char *format, ...) {
@@ -65,7 +149,7 @@ static void lvDisplay(void) {
 	drawLine(0, -lvHeight-lvTransY, 0, lvHeight-lvTransY);
 	glLineWidth(1);
 
-	lsystem.Draw();		
+	drawSystem(lsystem);
 
 	// Draw image planes
 	glColor3f(1.0, 0.0, 1.0);
@@ -82,8 +166,8 @@ static void lvDisplay(void) {
 	for (int i = -9; i < 10; i++)
 	{
         Ray rayv = Ray(Point(0, iPlaneY, lsystem.iPlane), Vector(0, lsystem.pupil.y/2 * (float) i/9 - iPlaneY, lsystem.pupil.z - lsystem.iPlane));
-        Ray& rays = rayv;
-        lsystem.Trace(rays, new Ray());
+        Ray res;
+        lsystem.Trace(rayv, &res, &painter);
 	}
 	
 
@@ -208,16 +292,33 @@ static void lvKey(unsigned char key, int x, int y) {
             lsystem.fstop -= .1;
 			lsystem.recalAper();
 			lsystem.findExitPupil();			
+			lsystem.buildFocusTable(lsystem.nearFocus(), FOCUS_TABLE_SIZE);
 			break;
 		case '=': // increase fstop
 			lsystem.fstop += .1;
 			lsystem.recalAper();
 			lsystem.findExitPupil();			
+			lsystem.buildFocusTable(lsystem.nearFocus(), FOCUS_TABLE_SIZE);
 			break;	
 
     case 's':
         scale *= 2;
         break;
+		case ',': // zoom toward the first zoom position
+		case '.': // zoom toward the last zoom position
+		case 'f': // move the focus group for the current object
+		{
+			const vector<float> &zoom = lsystem.states.zoom;
+			if (lsystem.states.NumStates() < 2)
+				break;
+			float z = lsystem.zoom;
+			if (key != 'f' && zoom.size() > 1)
+				z += (key == '.' ? 0.05f : -0.05f) * (zoom.back() - zoom.front());
+			lsystem.setState(z, key == 'f' ? zDist : lsystem.focusDist);
+			lsystem.buildFocusTable(lsystem.nearFocus(), FOCUS_TABLE_SIZE);
+			lsystem.refocus(zDist, -1);
+			break;
+		}
 		default: 
 			break;
 	}
@@ -240,10 +341,8 @@ int main(int argc, char** argv) {
 		exit(-1);
 	}
 
-    printf("1\n");
 	lvZoom = lvHeight / lsystem.maxAperture() / 3;
 	lvZoom = maxv(1, lvZoom);
-    printf("2\n");
 	glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
     glutInitWindowSize(lvWidth, lvHeight);
@@ -259,13 +358,16 @@ int main(int argc, char** argv) {
     glMatrixMode(GL_PROJECTION); glLoadIdentity();	
 	glClearColor(BGR, BGG, BGB, 1);
 
-    printf("3\n");
 	glLineWidth(1);
-    printf("4\n");
 	lsystem.findIntrinsics();
-    printf("5\n");
+	// Load the focus-pull table named on the command line, or build it
+	if (argc < 3 || !lsystem.focus.Load(argv[2]) ||
+		lsystem.focus.aper != lsystem.getAperture()->aper) {
+		lsystem.buildFocusTable(lsystem.nearFocus(), FOCUS_TABLE_SIZE);
+		if (argc >= 3)
+			lsystem.focus.Save(argv[2]);
+	}
     lsystem.refocus(zDist, -1);
-    printf("6\n");
 	glutMainLoop();
 	return (0);
 }
@@ -12,6 +12,7 @@
 #define LVW 770
 #define LVH 480
 #define LVSD 24
+#define FOCUS_TABLE_SIZE 512
 
 #define BARC 0.75f
 #define BART 0.0f
@@ -35,7 +35,7 @@ public:
 		index = i;
 		bumpMap = bump;
 	}
-	BSDF *GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeometry &dgShading) const;
+	BSDF *GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeometry &dgShading, MemoryArena &arena) const;
 private:
 	// Glass Private Data
 	Reference<Texture<Spectrum> > Kr, Kt;
@@ -43,7 +43,7 @@ private:
 	Reference<Texture<float> > bumpMap;
 };
 // Glass Method Definitions
-BSDF *Glass::GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeometry &dgShading) const {
+BSDF *Glass::GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeometry &dgShading, MemoryArena &arena) const {
 	// Allocate _BSDF_, possibly doing bump-mapping with _bumpMap_
 	DifferentialGeometry dgs;
 	if (bumpMap)
@@ -51,14 +51,14 @@ BSDF *Glass::GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeome
 	else
 		dgs = dgShading;
 	float ior = index->Evaluate(dgs);
-	BSDF *bsdf = BSDF_ALLOC(BSDF)(dgs, dgGeom.nn, ior);
+	BSDF *bsdf = BSDF_ALLOC(arena, BSDF)(dgs, dgGeom.nn, ior);
 	Spectrum R = Kr->Evaluate(dgs).Clamp();
 	Spectrum T = Kt->Evaluate(dgs).Clamp();
 	if (!R.Black())
-		bsdf->Add(BSDF_ALLOC(SpecularReflection)(R,
-			BSDF_ALLOC(FresnelDielectric)(1., ior)));
+		bsdf->Add(BSDF_ALLOC(arena, SpecularReflection)(R,
+			BSDF_ALLOC(arena, FresnelDielectric)(1., ior)));
 	if (!T.Black())
-		bsdf->Add(BSDF_ALLOC(SpecularTransmission)(T, 1., ior));
+		bsdf->Add(BSDF_ALLOC(arena, SpecularTransmission)(T, 1., ior));
 	return bsdf;
 }
 extern "C" DLLEXPORT Material * CreateMaterial(const Transform &xform,
@@ -35,16 +35,38 @@ int main(int argc, char *argv[]) {
 	printf("covered by the GNU General Public License.  See the file COPYING.txt\n");
 	printf("for the conditions of the license.\n");
 	fflush(stdout);
-	pbrtInit();
+	// Process command-line options
+	Options options;
+	vector<string> filenames;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--ncores") && i + 1 < argc)
+			options.nCores = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			options.seed = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--time-budget") && i + 1 < argc)
+			options.timeBudget = max(0.f, float(atof(argv[++i])));
+		else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+			printf("usage: pbrt [--ncores n] [--seed n] [--time-budget s]\n"
+			       "            [<filename.pbrt> ...]\n");
+			printf("  --ncores n   render with n threads (default: one per core)\n");
+			printf("  --seed n     offset the random numbers of every image tile\n");
+			printf("  --time-budget s  stop multi-pass samplers after s seconds\n");
+			return 0;
+		}
+		else
+			filenames.push_back(argv[i]);
+	}
+	pbrtInit(options);
 	// Process scene description
-	if (argc == 1) {
+	if (filenames.size() == 0) {
 		// Parse scene from standard input
 		ParseFile("-");
 	} else {
 		// Parse scene from input files
-		for (int i = 1; i < argc; i++)
-			if (!ParseFile(argv[i]))
-				Error("Couldn't open scene file \"%s\"\n", argv[i]);
+		for (u_int i = 0; i < filenames.size(); i++)
+			if (!ParseFile(filenames[i].c_str()))
+				Error("Couldn't open scene file \"%s\"\n",
+					filenames[i].c_str());
 	}
 	pbrtCleanup();
 	return 0;
@@ -0,0 +1,273 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+// adaptive.cpp*
+#include "sampling.h"
+#include "paramset.h"
+#include "film.h"
+// AdaptiveSampler Declarations
+class AdaptiveSampler : public Sampler {
+public:
+	// AdaptiveSampler Public Methods
+	AdaptiveSampler(int xstart, int xend, int ystart, int yend,
+		int spp, int minSamples, int maxSamples, float threshold,
+		int radius);
+	~AdaptiveSampler() {
+		delete[] imageSamples;
+		for (int i = 0; i < n1D; ++i)
+			delete[] oneDSamples[i];
+		for (int i = 0; i < n2D; ++i)
+			delete[] twoDSamples[i];
+		delete[] oneDSamples;
+		delete[] twoDSamples;
+	}
+	int RoundSize(int size) const {
+		return RoundUpPow2(size);
+	}
+	bool GetNextSample(Sample *sample);
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const;
+	bool NextPass(const Film *film);
+private:
+	// AdaptiveSampler Private Methods
+	AdaptiveSampler(const AdaptiveSampler *parent,
+		int xstart, int xend, int ystart, int yend);
+	void Init();
+	void StartPass();
+	int PixelOffset(int x, int y) const {
+		return (y - yPixelStart) * (xPixelEnd - xPixelStart) +
+			(x - xPixelStart);
+	}
+	// AdaptiveSampler Private Data
+	const AdaptiveSampler *parent;
+	int minSamples, maxSamples;
+	float threshold;
+	int radius;
+	// Samples each pixel of the full image takes in the current pass
+	// and in all passes so far; sub-samplers read their parent's counts
+	vector<int> passSamples, totalSamples;
+	double budget;
+	int xPos, yPos, pixelStart, pixelSamples, samplePos;
+	float *imageSamples, *lensSamples, *timeSamples;
+	float **oneDSamples, **twoDSamples;
+	int n1D, n2D;
+};
+// AdaptiveSampler Utility Functions
+// Replace each value of an image with the largest one within _radius_
+template <class T> static void DilateMax(vector<T> &image,
+		int xRes, int yRes, int radius) {
+	vector<T> rows(image.size());
+	for (int y = 0; y < yRes; ++y)
+		for (int x = 0; x < xRes; ++x) {
+			T v = image[y * xRes + x];
+			for (int u = max(x - radius, 0);
+			     u <= min(x + radius, xRes - 1); ++u)
+				v = max(v, image[y * xRes + u]);
+			rows[y * xRes + x] = v;
+		}
+	for (int y = 0; y < yRes; ++y)
+		for (int x = 0; x < xRes; ++x) {
+			T v = rows[y * xRes + x];
+			for (int w = max(y - radius, 0);
+			     w <= min(y + radius, yRes - 1); ++w)
+				v = max(v, rows[w * xRes + x]);
+			image[y * xRes + x] = v;
+		}
+}
+// AdaptiveSampler Method Definitions
+AdaptiveSampler::AdaptiveSampler(int xstart, int xend,
+		int ystart, int yend, int spp, int minSamp, int maxSamp,
+		float thresh, int rad)
+	: Sampler(xstart, xend, ystart, yend, spp) {
+	parent = NULL;
+	minSamples = minSamp;
+	maxSamples = maxSamp;
+	threshold = thresh;
+	radius = rad;
+	// Every pixel takes _minSamples_ in the base pass
+	int nPixels = (xPixelEnd - xPixelStart) * (yPixelEnd - yPixelStart);
+	passSamples.resize(nPixels, minSamples);
+	totalSamples.resize(nPixels, minSamples);
+	budget = double(samplesPerPixel - minSamples) * nPixels;
+	Init();
+}
+AdaptiveSampler::AdaptiveSampler(const AdaptiveSampler *p,
+		int xstart, int xend, int ystart, int yend)
+	: Sampler(xstart, xend, ystart, yend, p->samplesPerPixel) {
+	parent = p;
+	minSamples = p->minSamples;
+	maxSamples = p->maxSamples;
+	threshold = p->threshold;
+	radius = p->radius;
+	budget = 0.;
+	Init();
+}
+Sampler *AdaptiveSampler::GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+	return new AdaptiveSampler(parent ? parent : this,
+		xstart, xend, ystart, yend);
+}
+void AdaptiveSampler::Init() {
+	imageSamples = new float[5 * maxSamples];
+	lensSamples = imageSamples + 2 * maxSamples;
+	timeSamples = imageSamples + 4 * maxSamples;
+	oneDSamples = twoDSamples = NULL;
+	n1D = n2D = 0;
+	StartPass();
+}
+void AdaptiveSampler::StartPass() {
+	xPos = xPixelStart - 1;
+	yPos = yPixelStart;
+	pixelStart = pixelSamples = samplePos = 0;
+}
+bool AdaptiveSampler::GetNextSample(Sample *sample) {
+	if (!oneDSamples) {
+		// Allocate space for pixel's low-discrepancy sample tables
+		oneDSamples = new float *[sample->n1D.size()];
+		n1D = sample->n1D.size();
+		for (u_int i = 0; i < sample->n1D.size(); ++i)
+			oneDSamples[i] = new float[sample->n1D[i] * maxSamples];
+		twoDSamples = new float *[sample->n2D.size()];
+		n2D = sample->n2D.size();
+		for (u_int i = 0; i < sample->n2D.size(); ++i)
+			twoDSamples[i] = new float[2 * sample->n2D[i] * maxSamples];
+	}
+	// Move to the next pixel that takes samples in this pass
+	while (samplePos == pixelSamples) {
+		if (++xPos == xPixelEnd) {
+			xPos = xPixelStart;
+			++yPos;
+		}
+		if (yPos >= yPixelEnd)
+			return false;
+		const AdaptiveSampler *counts = parent ? parent : this;
+		int offset = counts->PixelOffset(xPos, yPos);
+		pixelSamples = counts->passSamples[offset];
+		pixelStart = counts->totalSamples[offset] - pixelSamples;
+		samplePos = 0;
+		if (pixelSamples == 0) continue;
+		// Generate the pixel's next low-discrepancy samples
+		int dim = 0;
+		LDPixelSamples2D(xPos, yPos, dim++, pixelStart, pixelSamples, 1,
+			imageSamples);
+		LDPixelSamples2D(xPos, yPos, dim++, pixelStart, pixelSamples, 1,
+			lensSamples);
+		LDPixelSamples1D(xPos, yPos, dim++, pixelStart, pixelSamples, 1,
+			timeSamples);
+		for (u_int i = 0; i < sample->n1D.size(); ++i)
+			LDPixelSamples1D(xPos, yPos, dim++, pixelStart, pixelSamples,
+				sample->n1D[i], oneDSamples[i]);
+		for (u_int i = 0; i < sample->n2D.size(); ++i)
+			LDPixelSamples2D(xPos, yPos, dim++, pixelStart, pixelSamples,
+				sample->n2D[i], twoDSamples[i]);
+	}
+	// Copy low-discrepancy samples from tables
+	sample->imageX = xPos + imageSamples[2*samplePos];
+	sample->imageY = yPos + imageSamples[2*samplePos+1];
+	sample->time = timeSamples[samplePos];
+	sample->lensU = lensSamples[2*samplePos];
+	sample->lensV = lensSamples[2*samplePos+1];
+	for (u_int i = 0; i < sample->n1D.size(); ++i) {
+		int startSamp = sample->n1D[i] * samplePos;
+		for (u_int j = 0; j < sample->n1D[i]; ++j)
+			sample->oneD[i][j] = oneDSamples[i][startSamp+j];
+	}
+	for (u_int i = 0; i < sample->n2D.size(); ++i) {
+		int startSamp = 2 * sample->n2D[i] * samplePos;
+		for (u_int j = 0; j < 2*sample->n2D[i]; ++j)
+			sample->twoD[i][j] = twoDSamples[i][startSamp+j];
+	}
+	++samplePos;
+	return true;
+}
+bool AdaptiveSampler::NextPass(const Film *film) {
+	// Compute the relative error of every pixel's mean
+	int xRes = xPixelEnd - xPixelStart, yRes = yPixelEnd - yPixelStart;
+	int nPixels = xRes * yRes;
+	vector<float> error(nPixels, 0.f);
+	for (int y = 0; y < yRes; ++y)
+		for (int x = 0; x < xRes; ++x) {
+			int n;
+			float mean, variance;
+			if (!film->GetPixelStatistics(x + xPixelStart,
+					y + yPixelStart, &n, &mean, &variance) || n < 2)
+				continue;
+			// Standard error relative to the mean; the floor keeps
+			// nearly black pixels from looking noisy
+			error[y * xRes + x] = sqrtf(variance / n) / max(mean, 1e-3f);
+		}
+	// Pick sample counts for the pixels above the threshold. Error falls
+	// with the square root of the sample count, and no pixel more than
+	// doubles its samples in one pass, so estimates are refreshed before
+	// much is spent on them.
+	DilateMax(error, xRes, yRes, radius);
+	vector<int> target(totalSamples);
+	for (int i = 0; i < nPixels; ++i) {
+		int n = totalSamples[i];
+		if (error[i] <= threshold || n >= maxSamples) continue;
+		float needed = n * (error[i] * error[i] / (threshold * threshold));
+		target[i] = min(needed < 2 * n ? Ceil2Int(needed) : 2 * n,
+			maxSamples);
+	}
+	// Filters blend neighboring pixels, and a pixel sampled much less
+	// than its neighbors would be biased toward them, so pixels near
+	// noisy ones are sampled as densely. This also covers pixels outside
+	// the film, whose samples still reach the pixels along its edges.
+	DilateMax(target, xRes, yRes, radius);
+	double passTotal = 0.;
+	for (int i = 0; i < nPixels; ++i) {
+		passSamples[i] = target[i] - totalSamples[i];
+		passTotal += passSamples[i];
+	}
+	// Scale the pass down evenly if it would overrun the budget
+	if (passTotal > budget) {
+		double scale = budget / passTotal;
+		passTotal = 0.;
+		for (int i = 0; i < nPixels; ++i) {
+			passSamples[i] = int(passSamples[i] * scale);
+			passTotal += passSamples[i];
+		}
+	}
+	for (int i = 0; i < nPixels; ++i)
+		totalSamples[i] += passSamples[i];
+	budget -= passTotal;
+	StartPass();
+	return passTotal > 0.;
+}
+extern "C" DLLEXPORT Sampler *CreateSampler(const ParamSet &params, const Film *film) {
+	// Initialize common sampler parameters
+	int xstart, xend, ystart, yend;
+	film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
+	int nsamp = params.FindOneInt("pixelsamples", 16);
+	int minsamp = params.FindOneInt("minsamples", 4);
+	int maxsamp = params.FindOneInt("maxsamples", 4 * nsamp);
+	float threshold = params.FindOneFloat("threshold", .02f);
+	// Pixels around noisy ones are sampled with them; this should be
+	// at least the pixel filter's radius
+	int radius = params.FindOneInt("radius", 2);
+	// Variance needs two samples; the base pass must fit the budget
+	minsamp = Clamp(minsamp, 2, max(2, nsamp));
+	maxsamp = max(maxsamp, minsamp);
+	return new AdaptiveSampler(xstart, xend, ystart, yend,
+		max(nsamp, minsamp), minsamp, maxsamp, max(threshold, 0.f),
+		max(radius, 0));
+}
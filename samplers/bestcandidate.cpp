@@ -29,6 +29,8 @@
 #define SQRT_SAMPLE_TABLE_SIZE 64
 #define SAMPLE_TABLE_SIZE (SQRT_SAMPLE_TABLE_SIZE * \
                            SQRT_SAMPLE_TABLE_SIZE)
+// Cells per side of the grid that sorts the table's samples by position
+#define TABLE_CELLS 16
 // BestCandidateSampler Declarations
 class BestCandidateSampler : public Sampler {
 public:
@@ -38,112 +40,186 @@ public:
 						 int pixelsamples);
 	~BestCandidateSampler() {
 		delete[] strat2D;
-		// so we leak on the individual elements of these arrays.  so it goes...
-		delete[] oneDSamples;
-		delete[] twoDSamples;
 	}
 	int RoundSize(int size) const {
 		int root = Ceil2Int(sqrtf((float)size - .5f));
 		return root*root;
 	}
 	bool GetNextSample(Sample *sample);
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+		return new BestCandidateSampler(parent ? parent : this,
+			xstart, xend, ystart, yend);
+	}
 private:
+	// BestCandidateSampler Private Methods
+	BestCandidateSampler(const BestCandidateSampler *parent,
+		int xstart, int xend, int ystart, int yend);
+	void Init();
+	bool NextTablePosition(Sample *sample);
 	// BestCandidateSampler Private Data
-	int tableOffset;
-	float xTableCorner, yTableCorner, tableWidth;
+	// Table positions tile the whole image from its corner, so that
+	// sub-samplers continue the pattern across their edges; each one
+	// visits only the table samples inside its own pixels
+	const BestCandidateSampler *parent;
+	float xTableStart, yTableStart, tableWidth;
+	int xTable, yTable, xTable0, xTable1, yTable1;
+	float xTableCorner, yTableCorner;
+	vector<int> positionSamples;
+	int positionOffset;
+	// Table samples sorted by the cell of the table they fall in
+	vector<int> cellStart, cellSamples;
 	static const float sampleTable[SAMPLE_TABLE_SIZE][5];
-	float **oneDSamples, **twoDSamples;
+	// Hashes of the table position, for the shifts of time and lens
+	// samples and the scrambles of single integrator samples
+	vector<u_int> positionHash;
 	int *strat2D;
-	float sampleOffsets[3];
 };
+// BestCandidateSampler Utility Functions
+// Bijection on table sample indices, keyed by _key_; it shuffles the
+// scrambled low-discrepancy values of a table position the same way for
+// every sub-sampler, one sample at a time
+static inline u_int PermuteTableSample(u_int i, u_int key) {
+	const u_int mask = SAMPLE_TABLE_SIZE - 1;
+	i = (i ^ key) & mask;
+	i = (i * 0x2c1b3c6du) & mask;
+	i ^= i >> 6;
+	i = (i + (key >> 16)) & mask;
+	i = (i * 0x297a2d39u) & mask;
+	i ^= i >> 5;
+	return i;
+}
 // BestCandidateSampler Method Definitions
 BestCandidateSampler::
     BestCandidateSampler(int xstart, int xend,
 		                 int ystart, int yend,
 						 int pixelSamples)
 	: Sampler(xstart, xend, ystart, yend, pixelSamples) {
+	parent = NULL;
+	xTableStart = float(xPixelStart);
+	yTableStart = float(yPixelStart);
+	// Sort table samples into cells for sub-samplers' lookups
+	cellStart.resize(TABLE_CELLS * TABLE_CELLS + 1, 0);
+	cellSamples.resize(SAMPLE_TABLE_SIZE);
+	vector<int> cell(SAMPLE_TABLE_SIZE);
+	for (int i = 0; i < SAMPLE_TABLE_SIZE; ++i) {
+		int cx = min(Floor2Int(sampleTable[i][0] * TABLE_CELLS),
+			TABLE_CELLS - 1);
+		int cy = min(Floor2Int(sampleTable[i][1] * TABLE_CELLS),
+			TABLE_CELLS - 1);
+		cell[i] = cy * TABLE_CELLS + cx;
+		++cellStart[cell[i] + 1];
+	}
+	for (int c = 0; c < TABLE_CELLS * TABLE_CELLS; ++c)
+		cellStart[c + 1] += cellStart[c];
+	vector<int> next(cellStart.begin(), cellStart.end() - 1);
+	for (int i = 0; i < SAMPLE_TABLE_SIZE; ++i)
+		cellSamples[next[cell[i]]++] = i;
+	Init();
+}
+BestCandidateSampler::BestCandidateSampler(const BestCandidateSampler *p,
+		int xstart, int xend, int ystart, int yend)
+	: Sampler(xstart, xend, ystart, yend, p->samplesPerPixel) {
+	parent = p;
+	xTableStart = p->xTableStart;
+	yTableStart = p->yTableStart;
+	Init();
+}
+void BestCandidateSampler::Init() {
+	// Find the table positions that overlap this sampler's pixels
 	tableWidth =
-		(float)SQRT_SAMPLE_TABLE_SIZE / sqrtf(pixelSamples);
-	xTableCorner = float(xPixelStart) - tableWidth;
-	yTableCorner = float(yPixelStart);
-	tableOffset = SAMPLE_TABLE_SIZE;
-	// _BestCandidateSampler_ constructor implementation
-	oneDSamples = twoDSamples = NULL;
+		(float)SQRT_SAMPLE_TABLE_SIZE / sqrtf(samplesPerPixel);
+	xTable0 = Floor2Int((xPixelStart - xTableStart) / tableWidth);
+	xTable1 = Ceil2Int((xPixelEnd - xTableStart) / tableWidth);
+	yTable = Floor2Int((yPixelStart - yTableStart) / tableWidth);
+	yTable1 = Ceil2Int((yPixelEnd - yTableStart) / tableWidth);
+	xTable = xTable0 - 1;
+	positionOffset = 0;
 	strat2D = NULL;
 }
 #include "samplers/sampledata.cpp"
-bool BestCandidateSampler::GetNextSample(Sample *sample) {
-again:
-	if (tableOffset == SAMPLE_TABLE_SIZE) {
-		// Advance to next best-candidate sample table position
-		tableOffset = 0;
-		xTableCorner += tableWidth;
-		if (xTableCorner >= xPixelEnd) {
-			xTableCorner = float(xPixelStart);
-			yTableCorner += tableWidth;
-			if (yTableCorner >= yPixelEnd)
-				return false;
-		}
-		if (!oneDSamples) {
-			// Initialize sample tables and precompute _strat2D_ values
-			oneDSamples = new float *[sample->n1D.size()];
-			for (u_int i = 0; i < sample->n1D.size(); ++i) {
-				oneDSamples[i] = (sample->n1D[i] == 1) ?
-					new float[SAMPLE_TABLE_SIZE] : NULL;
-			}
-			twoDSamples = new float *[sample->n2D.size()];
-			strat2D = new int[sample->n2D.size()];
-			for (u_int i = 0; i < sample->n2D.size(); ++i) {
-				twoDSamples[i] = (sample->n2D[i] == 1) ?
-					new float[2 * SAMPLE_TABLE_SIZE] : NULL;
-				strat2D[i] =
-					Ceil2Int(sqrtf((float)sample->n2D[i] - .5f));
-			}
-		}
-		// Update sample shifts
-		for (int i = 0; i < 3; ++i)
-			sampleOffsets[i] = RandomFloat();
-		// Generate _SAMPLE\_TABLE\_SIZE_-sized tables for single samples
-		for (u_int i = 0; i < sample->n1D.size(); ++i)
-			if (sample->n1D[i] == 1)
-				LDShuffleScrambled1D(SAMPLE_TABLE_SIZE, 1,
-				                     oneDSamples[i]);
+bool BestCandidateSampler::NextTablePosition(Sample *sample) {
+	// Advance to next best-candidate sample table position
+	if (++xTable >= xTable1) {
+		xTable = xTable0;
+		++yTable;
+	}
+	if (yTable >= yTable1)
+		return false;
+	xTableCorner = xTableStart + xTable * tableWidth;
+	yTableCorner = yTableStart + yTable * tableWidth;
+	if (!strat2D) {
+		// Precompute _strat2D_ values
+		strat2D = new int[sample->n2D.size()];
 		for (u_int i = 0; i < sample->n2D.size(); ++i)
-			if (sample->n2D[i] == 1)
-				LDShuffleScrambled2D(SAMPLE_TABLE_SIZE, 1,
-				                     twoDSamples[i]);
+			strat2D[i] =
+				Ceil2Int(sqrtf((float)sample->n2D[i] - .5f));
+		positionHash.resize(3 + 2 * sample->n1D.size() +
+			3 * sample->n2D.size());
 	}
+	for (u_int i = 0; i < positionHash.size(); ++i)
+		positionHash[i] = LDPixelScramble(xTable, yTable, i);
+	// Collect the table samples that fall in this sampler's pixels
+	positionSamples.clear();
+	positionOffset = 0;
+	float u0 = (xPixelStart - xTableCorner) / tableWidth;
+	float u1 = (xPixelEnd - xTableCorner) / tableWidth;
+	float v0 = (yPixelStart - yTableCorner) / tableWidth;
+	float v1 = (yPixelEnd - yTableCorner) / tableWidth;
+	int cx0 = Clamp(Floor2Int(u0 * TABLE_CELLS), 0, TABLE_CELLS - 1);
+	int cx1 = Clamp(Floor2Int(u1 * TABLE_CELLS), 0, TABLE_CELLS - 1);
+	int cy0 = Clamp(Floor2Int(v0 * TABLE_CELLS), 0, TABLE_CELLS - 1);
+	int cy1 = Clamp(Floor2Int(v1 * TABLE_CELLS), 0, TABLE_CELLS - 1);
+	const BestCandidateSampler *cells = parent ? parent : this;
+	for (int cy = cy0; cy <= cy1; ++cy)
+		for (int cx = cx0; cx <= cx1; ++cx) {
+			int c = cy * TABLE_CELLS + cx;
+			for (int j = cells->cellStart[c];
+			     j < cells->cellStart[c + 1]; ++j) {
+				// Test samples as _GetNextSample()_ places them, so that
+				// each belongs to exactly one sub-sampler
+				int i = cells->cellSamples[j];
+				float x = xTableCorner + tableWidth * sampleTable[i][0];
+				float y = yTableCorner + tableWidth * sampleTable[i][1];
+				if (x >= xPixelStart && x < xPixelEnd &&
+				    y >= yPixelStart && y < yPixelEnd)
+					positionSamples.push_back(i);
+			}
+		}
+	return true;
+}
+bool BestCandidateSampler::GetNextSample(Sample *sample) {
+	while (positionOffset == int(positionSamples.size()))
+		if (!NextTablePosition(sample))
+			return false;
+	int tableOffset = positionSamples[positionOffset++];
 	// Compute raster sample from table
 	#define WRAP(x) ((x) > 1 ? ((x)-1) : (x))
+	const float toFloat = 1.f / 16777216.f;
 	sample->imageX = xTableCorner + tableWidth *
 		sampleTable[tableOffset][0];
 	sample->imageY = yTableCorner + tableWidth *
 		sampleTable[tableOffset][1];
-	sample->time  = WRAP(sampleOffsets[0] +
+	sample->time  = WRAP((positionHash[0] >> 8) * toFloat +
 		sampleTable[tableOffset][2]);
-	sample->lensU = WRAP(sampleOffsets[1] +
+	sample->lensU = WRAP((positionHash[1] >> 8) * toFloat +
 		sampleTable[tableOffset][3]);
-	sample->lensV = WRAP(sampleOffsets[2] +
+	sample->lensV = WRAP((positionHash[2] >> 8) * toFloat +
 		sampleTable[tableOffset][4]);
-	// Check sample against crop window, goto _again_ if outside
-	if (sample->imageX <  xPixelStart ||
-	    sample->imageX >= xPixelEnd   ||
-	    sample->imageY <  yPixelStart ||
-	    sample->imageY >= yPixelEnd) {
-		++tableOffset;
-		goto again;
-	}
 	// Compute integrator samples for best-candidate sample
-	for (u_int i = 0; i < sample->n1D.size(); ++i) {
+	const u_int *hash = &positionHash[3];
+	for (u_int i = 0; i < sample->n1D.size(); ++i, hash += 2) {
 		if (sample->n1D[i] == 1)
-			sample->oneD[i][0] = oneDSamples[i][tableOffset];
+			sample->oneD[i][0] = VanDerCorput(
+				PermuteTableSample(tableOffset, hash[1]), hash[0]);
 		else
 			StratifiedSample1D(sample->oneD[i], sample->n1D[i]);
 	}
-	for (u_int i = 0; i < sample->n2D.size(); ++i) {
+	for (u_int i = 0; i < sample->n2D.size(); ++i, hash += 3) {
 		if (sample->n2D[i] == 1) {
-		   sample->twoD[i][0] = twoDSamples[i][2*tableOffset];
-		   sample->twoD[i][1] = twoDSamples[i][2*tableOffset+1];
+			u_int scramble[2] = { hash[0], hash[1] };
+			Sample02(PermuteTableSample(tableOffset, hash[2]), scramble,
+				sample->twoD[i]);
 		}
 		else {
 			StratifiedSample2D(sample->twoD[i],
@@ -151,7 +227,6 @@ again:
 							   strat2D[i]);
 		}
 	}
-	++tableOffset;
 	return true;
 }
 extern "C" DLLEXPORT Sampler *CreateSampler(const ParamSet &params, const Film *film) {
@@ -45,6 +45,10 @@ public:
 		return RoundUpPow2(size);
 	}
 	bool GetNextSample(Sample *sample);
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+		return new LDSampler(xstart, xend, ystart, yend, pixelSamples);
+	}
 private:
 	// LDSampler Private Data
 	int xPos, yPos, pixelSamples;
@@ -0,0 +1,172 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2010 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    pbrt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.  Note that the text contents of
+    the book "Physically Based Rendering" are *not* licensed under the
+    GNU GPL.
+
+    pbrt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+// progressive.cpp*
+#include "sampling.h"
+#include "paramset.h"
+#include "film.h"
+// ProgressiveSampler Declarations
+class ProgressiveSampler : public Sampler {
+public:
+	// ProgressiveSampler Public Methods
+	ProgressiveSampler(int xstart, int xend, int ystart, int yend,
+		int spp, int firstSamples);
+	~ProgressiveSampler() {
+		delete[] imageSamples;
+		for (int i = 0; i < n1D; ++i)
+			delete[] oneDSamples[i];
+		for (int i = 0; i < n2D; ++i)
+			delete[] twoDSamples[i];
+		delete[] oneDSamples;
+		delete[] twoDSamples;
+	}
+	int RoundSize(int size) const {
+		return RoundUpPow2(size);
+	}
+	bool GetNextSample(Sample *sample);
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const;
+	bool NextPass(const Film *film);
+private:
+	// ProgressiveSampler Private Methods
+	ProgressiveSampler(const ProgressiveSampler *parent,
+		int xstart, int xend, int ystart, int yend);
+	void Init();
+	void StartPass();
+	// ProgressiveSampler Private Data
+	// Every pixel takes _passSamples_ in the current pass, continuing its
+	// sequences at sample _passStart_
+	int passStart, passSamples;
+	int xPos, yPos, samplePos;
+	float *imageSamples, *lensSamples, *timeSamples;
+	float **oneDSamples, **twoDSamples;
+	int n1D, n2D;
+};
+// ProgressiveSampler Method Definitions
+ProgressiveSampler::ProgressiveSampler(int xstart, int xend,
+		int ystart, int yend, int spp, int firstSamples)
+	: Sampler(xstart, xend, ystart, yend, spp) {
+	passStart = 0;
+	passSamples = firstSamples;
+	Init();
+}
+ProgressiveSampler::ProgressiveSampler(const ProgressiveSampler *p,
+		int xstart, int xend, int ystart, int yend)
+	: Sampler(xstart, xend, ystart, yend, p->samplesPerPixel) {
+	passStart = p->passStart;
+	passSamples = p->passSamples;
+	Init();
+}
+Sampler *ProgressiveSampler::GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+	return new ProgressiveSampler(this, xstart, xend, ystart, yend);
+}
+void ProgressiveSampler::Init() {
+	// No pass takes more than _samplesPerPixel_ samples in a pixel
+	imageSamples = new float[5 * samplesPerPixel];
+	lensSamples = imageSamples + 2 * samplesPerPixel;
+	timeSamples = imageSamples + 4 * samplesPerPixel;
+	oneDSamples = twoDSamples = NULL;
+	n1D = n2D = 0;
+	StartPass();
+}
+void ProgressiveSampler::StartPass() {
+	xPos = xPixelStart - 1;
+	yPos = yPixelStart;
+	samplePos = passSamples;
+}
+bool ProgressiveSampler::GetNextSample(Sample *sample) {
+	if (!oneDSamples) {
+		// Allocate space for pixel's low-discrepancy sample tables
+		oneDSamples = new float *[sample->n1D.size()];
+		n1D = sample->n1D.size();
+		for (u_int i = 0; i < sample->n1D.size(); ++i)
+			oneDSamples[i] = new float[sample->n1D[i] * samplesPerPixel];
+		twoDSamples = new float *[sample->n2D.size()];
+		n2D = sample->n2D.size();
+		for (u_int i = 0; i < sample->n2D.size(); ++i)
+			twoDSamples[i] =
+				new float[2 * sample->n2D[i] * samplesPerPixel];
+	}
+	if (samplePos == passSamples) {
+		// Advance to next pixel for progressive sampling
+		if (++xPos == xPixelEnd) {
+			xPos = xPixelStart;
+			++yPos;
+		}
+		if (yPos >= yPixelEnd)
+			return false;
+		samplePos = 0;
+		// Generate the pixel's next low-discrepancy samples
+		int dim = 0;
+		LDPixelSamples2D(xPos, yPos, dim++, passStart, passSamples, 1,
+			imageSamples);
+		LDPixelSamples2D(xPos, yPos, dim++, passStart, passSamples, 1,
+			lensSamples);
+		LDPixelSamples1D(xPos, yPos, dim++, passStart, passSamples, 1,
+			timeSamples);
+		for (u_int i = 0; i < sample->n1D.size(); ++i)
+			LDPixelSamples1D(xPos, yPos, dim++, passStart, passSamples,
+				sample->n1D[i], oneDSamples[i]);
+		for (u_int i = 0; i < sample->n2D.size(); ++i)
+			LDPixelSamples2D(xPos, yPos, dim++, passStart, passSamples,
+				sample->n2D[i], twoDSamples[i]);
+	}
+	// Copy low-discrepancy samples from tables
+	sample->imageX = xPos + imageSamples[2*samplePos];
+	sample->imageY = yPos + imageSamples[2*samplePos+1];
+	sample->time = timeSamples[samplePos];
+	sample->lensU = lensSamples[2*samplePos];
+	sample->lensV = lensSamples[2*samplePos+1];
+	for (u_int i = 0; i < sample->n1D.size(); ++i) {
+		int startSamp = sample->n1D[i] * samplePos;
+		for (u_int j = 0; j < sample->n1D[i]; ++j)
+			sample->oneD[i][j] = oneDSamples[i][startSamp+j];
+	}
+	for (u_int i = 0; i < sample->n2D.size(); ++i) {
+		int startSamp = 2 * sample->n2D[i] * samplePos;
+		for (u_int j = 0; j < 2*sample->n2D[i]; ++j)
+			sample->twoD[i][j] = twoDSamples[i][startSamp+j];
+	}
+	++samplePos;
+	return true;
+}
+bool ProgressiveSampler::NextPass(const Film *film) {
+	// Double the samples taken so far, up to _samplesPerPixel_
+	passStart += passSamples;
+	passSamples = min(passStart, samplesPerPixel - passStart);
+	StartPass();
+	return passSamples > 0;
+}
+extern "C" DLLEXPORT Sampler *CreateSampler(const ParamSet &params, const Film *film) {
+	// Initialize common sampler parameters
+	int xstart, xend, ystart, yend;
+	film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
+	int nsamp = params.FindOneInt("pixelsamples", 16);
+	// The first pass covers the image quickly; each later one doubles
+	// the samples, so every finished pass halves the variance
+	int firstsamp = params.FindOneInt("firstsamples", 1);
+	nsamp = max(nsamp, 1);
+	firstsamp = Clamp(firstsamp, 1, nsamp);
+	return new ProgressiveSampler(xstart, xend, ystart, yend,
+		nsamp, firstsamp);
+}
@@ -34,6 +34,11 @@ public:
 	}
 	bool GetNextSample(Sample *sample);
 	int RoundSize(int sz) const { return sz; }
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+		return new RandomSampler(xstart, xend, ystart, yend,
+			xPixelSamples, yPixelSamples);
+	}
 private:
 	// RandomSampler Private Data
 	bool jitterSamples;
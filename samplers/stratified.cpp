@@ -39,6 +39,11 @@ public:
 		FreeAligned(imageSamples);
 	}
 	bool GetNextSample(Sample *sample);
+	Sampler *GetSubSampler(int xstart, int xend,
+		int ystart, int yend) const {
+		return new StratifiedSampler(xstart, xend, ystart, yend,
+			xPixelSamples, yPixelSamples, jitterSamples);
+	}
 private:
 	// StratifiedSampler Private Data
 	int xPixelSamples, yPixelSamples;